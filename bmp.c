@@ -290,13 +290,29 @@ int picasso_save_to_bmp(bmp *image, const char *file_path, picasso_icc_profile p
 
 bmp *picasso_create_bmp_from_rgba(int width, int height, int channels, const uint8_t *pixel_data)
 {
-    if (width <= 0 || height == 0 || !pixel_data) {
+    if (width <= 0 || height == 0 || !pixel_data || (channels != 3 && channels != 4)) {
         ERROR("Invalid BMP creation params: %dx%d", width, height);
         return NULL;
     }
-    bool all_alpha_zero = (channels == 4);          // I only care if alpha exist
     int abs_height = PICASSO_ABS(height);
-    int row_stride = width * channels;                         // tightly packed source
+    picasso_view v = picasso_view_from_pixels((void *)pixel_data, width, abs_height,
+                                              (ptrdiff_t)width * channels,  // tightly packed source
+                                              channels == 4 ? PICASSO_FORMAT_RGBA8 : PICASSO_FORMAT_RGB8);
+    return picasso_create_bmp_from_view(&v);
+}
+
+bmp *picasso_create_bmp_from_view(const picasso_view *v)
+{
+    if (!v || !v->pixels) {
+        ERROR("Invalid BMP creation params: empty view");
+        return NULL;
+    }
+    int width = v->width;
+    int channels = picasso_format_bytes(v->format);
+    bool premultiplied = v->format == PICASSO_FORMAT_RGBA8_PREMUL;
+    bool all_alpha_zero = (channels == 4);          // I only care if alpha exist
+    int abs_height = v->height;
+    int row_stride = width * channels;
     int row_size   = ((row_stride + 3) / 4) * 4;               // padded BMP row size
     size_t pixel_array_size = (size_t)row_size * abs_height;
 
@@ -340,22 +356,16 @@ bmp *picasso_create_bmp_from_rgba(int width, int height, int channels, const uin
 
     // --- Fill each row ---
     for (int y = 0; y < abs_height; ++y) {
-        const uint8_t *src_row = pixel_data + y * row_stride;
+        const uint8_t *src_row = v->pixels + (ptrdiff_t)y * v->stride;
         uint8_t *dst_row = b->pixels + y * row_size;
 
-        for (int x = 0; x < width; ++x) {
-            const uint8_t *src = src_row + x * channels;
-            uint8_t *dst = dst_row + x * channels;
-
-            // Two operations in once, writing to, and
-            // swapping RGBA -> BGRA
-            dst[0] = src[2]; // B
-            dst[1] = src[1]; // G
-            dst[2] = src[0]; // R
-            if (channels == 4) {
-                dst[3] = src[3]; // Respect original alpha
-                if(src[3] != 0) all_alpha_zero = false;
-            }
+        // BMP stores straight alpha, and BGR(A) instead of RGB(A)
+        if (premultiplied) picasso_unpremultiply_pixels(dst_row, src_row, width);
+        else               memcpy(dst_row, src_row, row_stride);
+        picasso_swap_rb(dst_row, width, channels);
+
+        for (int x = 0; x < width && channels == 4 && all_alpha_zero; ++x) {
+            if (dst_row[x * 4 + 3] != 0) all_alpha_zero = false;
         }
         // Fill padding bytes with zeros
         int padding = row_size - row_stride;
@@ -378,6 +388,23 @@ bmp *picasso_create_bmp_from_rgba(int width, int height, int channels, const uin
     return b;
 }
 
+void picasso_free_bmp(bmp *image)
+{
+    if (!image) return;
+    picasso_free(image->pixels);
+    picasso_free(image);
+}
+
+int picasso_save_view_to_bmp(const picasso_view *v, const char *file_path, picasso_icc_profile profile)
+{
+    bmp *b = picasso_create_bmp_from_view(v);
+    if (!b) return -1;
+
+    int result = picasso_save_to_bmp(b, file_path, profile);
+    picasso_free_bmp(b);
+    return result;
+}
+
 typedef struct {
     bmp image;
     bmp_header_type type;
@@ -586,6 +613,11 @@ static void picasso__parse_v5_fields(_bmp_load_info *bmp)
 }
 /* Robust, and should handle all format now.. */
 picasso_image *picasso_load_bmp(const char *filename)
+{
+    return picasso_load_bmp_ex(filename, PICASSO_LOAD_DEFAULT);
+}
+
+picasso_image *picasso_load_bmp_ex(const char *filename, uint32_t flags)
 {
     _bmp_load_info bmp = {0};
     picasso_image *img = NULL;
@@ -623,15 +655,16 @@ picasso_image *picasso_load_bmp(const char *filename)
         img->height     = bmp.height;
         img->channels   = bmp.channels;
         img->row_stride = bmp.row_stride;
-        img->pixels     = picasso_malloc(bmp.row_stride * bmp.height);
+        img->pixels     = picasso_malloc_aligned((size_t)bmp.row_stride * bmp.height, PICASSO_ALIGNMENT);
+        img->premultiplied = false;
     }
 
-    uint8_t *row_buf = malloc(bmp.row_size);
+    uint8_t *row_buf = picasso_malloc(bmp.row_size);
 
     for (int y = 0; y < bmp.height; ++y) {
         if ((read = fread(row_buf, 1, bmp.row_size, fp)) != (size_t)bmp.row_size) {
             ERROR("Failed to read row %d", y);
-            free(row_buf);
+            picasso_free(row_buf);
             picasso_free(img->pixels);
             picasso_free(img);
             fclose(fp);
@@ -639,27 +672,27 @@ picasso_image *picasso_load_bmp(const char *filename)
         }
 
         int dest_y = bmp.is_flipped ? (bmp.height - 1 - y) : y;
-        memcpy(img->pixels + dest_y * img->row_stride, row_buf, img->row_stride);
+        memcpy(img->pixels + (size_t)dest_y * img->row_stride, row_buf, img->row_stride);
     }
 
-    free(row_buf);
+    picasso_free(row_buf);
     /* Finally done reading the file */
     fclose(fp);
 
 
-    color pixel;
-    foreach_pixel(img,
-    {
-        if (bmp.comp == BI_BITFIELDS && bmp.channels == 4)
+    if (bmp.comp == BI_BITFIELDS && bmp.channels == 4) {
+        color pixel;
+        foreach_pixel(img,
         {
             decode_and_write_pixel_32bit(pixel, pixels); // Decode from 32-bit pixel using bitmasks
             bmp.set_all_alpha = (!bmp.set_all_alpha && (pixels[3] != 0));
-
-        } else {
-            // Legacy BGR -> RGB swap
-            PICASSO_SWAP(pixels[0],pixels[2]);
+        });
+    } else {
+        // Legacy BGR -> RGB swap
+        for (int y = 0; y < img->height; ++y) {
+            picasso_swap_rb(img->pixels + (size_t)y * img->row_stride, img->width, img->channels);
         }
-    });
+    }
 
     if (bmp.set_all_alpha && img->channels == 4)
     {
@@ -668,5 +701,10 @@ picasso_image *picasso_load_bmp(const char *filename)
                 pixels[3] = 0xFF;
         });
     }
+
+    // Done once here, so blits never have to
+    if ((flags & PICASSO_LOAD_PREMULTIPLY) && img->channels == 4) {
+        picasso_premultiply_image(img);
+    }
     return img;
 }
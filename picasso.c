@@ -3,6 +3,24 @@
 #include <stdint.h>
 #include <string.h>
 #include <ctype.h>
+#include <stdatomic.h>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+#if defined(__APPLE__)
+#include <mach/vm_statistics.h>
+#endif
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#if defined(__linux__)
+#include <sys/auxv.h>
+#endif
+#endif
 
 #include "picasso.h"
 #include "logger.h"
@@ -11,20 +29,419 @@
 
 void picasso_image_free(picasso_image *img);
 
+/* -------------------- Custom Allocators -------------------- */
+/* Every block carries a small header right in front of the pointer handed
+ * out, recording which allocator made it and with what size and alignment.
+ * That way picasso_free() can hand the exact same numbers back to the
+ * allocator, and blocks go home correctly even if the active allocator was
+ * swapped in the meantime */
+typedef struct {
+    picasso_allocator allocator;
+    size_t size;      // payload size as requested
+    size_t alignment; // payload alignment
+    size_t offset;    // distance from the raw block to the payload
+} picasso__alloc_header;
+
+#define PICASSO__MIN_ALIGN 16
+#define PICASSO__ALIGN_UP(n, a) (((n) + ((a) - 1)) & ~((size_t)(a) - 1))
+
+static void *picasso__libc_alloc(void *user, size_t size, size_t alignment)
+{
+    (void)user;
+    if (alignment <= PICASSO__MIN_ALIGN) return malloc(size);
+
+    void *ptr = NULL;
+    if (posix_memalign(&ptr, alignment, size) != 0) return NULL;
+    return ptr;
+}
+
+static void picasso__libc_free(void *user, void *ptr, size_t size, size_t alignment)
+{
+    (void)user; (void)size; (void)alignment;
+    free(ptr);
+}
+
+static const picasso_allocator picasso__libc_allocator = {
+    .alloc = picasso__libc_alloc,
+    .free  = picasso__libc_free,
+    .user  = NULL,
+};
+
+static picasso_allocator picasso__global_allocator = {
+    .alloc = picasso__libc_alloc,
+    .free  = picasso__libc_free,
+    .user  = NULL,
+};
+static _Thread_local picasso_allocator picasso__thread_allocator;
+static _Thread_local bool picasso__thread_allocator_set = false;
+
+void picasso_set_allocator(const picasso_allocator *allocator)
+{
+    if (allocator && (!allocator->alloc || !allocator->free)) {
+        ERROR("Allocator needs both alloc and free, keeping the current one");
+        return;
+    }
+    picasso__global_allocator = allocator ? *allocator : picasso__libc_allocator;
+}
+
+void picasso_set_thread_allocator(const picasso_allocator *allocator)
+{
+    if (allocator && (!allocator->alloc || !allocator->free)) {
+        ERROR("Allocator needs both alloc and free, keeping the current one");
+        return;
+    }
+    picasso__thread_allocator_set = allocator != NULL;
+    if (allocator) picasso__thread_allocator = *allocator;
+}
+
+picasso_allocator picasso_get_allocator(void)
+{
+    return picasso__thread_allocator_set ? picasso__thread_allocator : picasso__global_allocator;
+}
+
+static inline picasso__alloc_header *picasso__header_of(void *ptr)
+{
+    return (picasso__alloc_header *)((uint8_t *)ptr - sizeof(picasso__alloc_header));
+}
+
+/* Writes the header in front of the payload inside an already obtained raw
+ * block. Anything that produces memory for picasso_free() goes through here */
+static void *picasso__place_header(void *raw, const picasso_allocator *a,
+                                   size_t size, size_t alignment, size_t offset)
+{
+    uint8_t *payload = (uint8_t *)raw + offset;
+    picasso__alloc_header *h = picasso__header_of(payload);
+    h->allocator = *a;
+    h->size      = size;
+    h->alignment = alignment;
+    h->offset    = offset;
+    return payload;
+}
+
+static void *picasso__alloc_with(const picasso_allocator *a, size_t size,
+                                 size_t alignment, bool zero)
+{
+    if (alignment < PICASSO__MIN_ALIGN) alignment = PICASSO__MIN_ALIGN;
+    if (alignment & (alignment - 1)) {
+        ERROR("Alignment %zu is not a power of two", alignment);
+        return NULL;
+    }
+
+    size_t offset = PICASSO__ALIGN_UP(sizeof(picasso__alloc_header), alignment);
+    if (size > SIZE_MAX - offset) return NULL;
+
+    void *raw;
+    // calloc hands back lazily zeroed pages, far cheaper than a memset on big
+    // buffers. There is no aligned calloc, so over-allocate and align by hand
+    if (zero && a->alloc == picasso__libc_alloc) {
+        size_t slack = alignment > PICASSO__MIN_ALIGN ? alignment : 0;
+        if (size > SIZE_MAX - offset - slack) return NULL;
+        raw = calloc(1, offset + size + slack);
+        if (!raw) return NULL;
+        uintptr_t payload = PICASSO__ALIGN_UP((uintptr_t)raw + sizeof(picasso__alloc_header), alignment);
+        offset = (size_t)(payload - (uintptr_t)raw);
+        zero = false;
+    } else {
+        raw = a->alloc(a->user, offset + size, alignment);
+    }
+    if (!raw) return NULL;
+
+    void *payload = picasso__place_header(raw, a, size, alignment, offset);
+    if (zero) memset(payload, 0, size);
+    return payload;
+}
+
+void *picasso_malloc_aligned(size_t size, size_t alignment)
+{
+    picasso_allocator a = picasso_get_allocator();
+    return picasso__alloc_with(&a, size, alignment, false);
+}
+
 void* picasso_calloc(size_t count, size_t size){
-    return calloc(count, size);
+    if (size && count > SIZE_MAX / size) return NULL;
+    picasso_allocator a = picasso_get_allocator();
+    return picasso__alloc_with(&a, count * size, PICASSO__MIN_ALIGN, true);
 }
 
 void picasso_free(void *ptr){
-    free(ptr);
+    if (!ptr) return;
+    picasso__alloc_header *h = picasso__header_of(ptr);
+    picasso_allocator a = h->allocator;
+    a.free(a.user, (uint8_t *)ptr - h->offset, h->offset + h->size, h->alignment);
 }
 
 void *picasso_malloc(size_t size){
-    return malloc(size);
+    return picasso_malloc_aligned(size, PICASSO__MIN_ALIGN);
 }
 
 void * picasso_realloc(void *ptr, size_t size){
-    return realloc(ptr, size);
+    if (!ptr) return picasso_malloc(size);
+    if (size == 0) {
+        picasso_free(ptr);
+        return NULL;
+    }
+
+    picasso__alloc_header *h = picasso__header_of(ptr);
+    if (size <= h->size) return ptr; // shrinking in place is always fine
+
+    // The block stays with the allocator that made it, whatever is active now
+    picasso_allocator a = h->allocator;
+    void *grown = picasso__alloc_with(&a, size, h->alignment, false);
+    if (!grown) return NULL;
+
+    memcpy(grown, ptr, h->size);
+    picasso_free(ptr);
+    return grown;
+}
+
+/* Page mapped buffers. These bypass the active allocator on purpose, since
+ * the whole point is to get memory straight from the kernel in 2 MB pages.
+ * Header offset and length are set up so picasso_free() unmaps all of it */
+#define PICASSO__HUGE_PAGE_SIZE ((size_t)2 << 20)
+
+#if defined(__unix__) || defined(__APPLE__)
+static void *picasso__pages_alloc(void *user, size_t size, size_t alignment)
+{
+    (void)user; (void)size; (void)alignment;
+    return NULL; // Only ever reached through picasso__alloc_pages
+}
+
+static void picasso__pages_free(void *user, void *ptr, size_t size, size_t alignment)
+{
+    (void)user; (void)alignment;
+    munmap(ptr, size);
+}
+
+static const picasso_allocator picasso__pages_allocator = {
+    .alloc = picasso__pages_alloc,
+    .free  = picasso__pages_free,
+    .user  = NULL,
+};
+
+#ifndef MAP_ANONYMOUS
+#define MAP_ANONYMOUS MAP_ANON
+#endif
+
+/* Touch every small page so the cost of faulting is paid here, not in the
+ * first frame drawn. Writing zero is fine, anonymous memory is zero already */
+static void picasso__prefault(uint8_t *mem, size_t len)
+{
+#if defined(MADV_POPULATE_WRITE)
+    if (madvise(mem, len, MADV_POPULATE_WRITE) == 0) return;
+#endif
+    long page = sysconf(_SC_PAGESIZE);
+    if (page <= 0) page = 4096;
+    for (size_t i = 0; i < len; i += (size_t)page) {
+        ((volatile uint8_t *)mem)[i] = 0;
+    }
+}
+
+static void *picasso__alloc_pages(size_t size, picasso_page_mode *mode)
+{
+    size_t offset = PICASSO_ALIGNMENT; // keeps the payload cache line aligned
+    if (size > SIZE_MAX - offset - 2 * PICASSO__HUGE_PAGE_SIZE) return NULL;
+    size_t len = PICASSO__ALIGN_UP(offset + size, PICASSO__HUGE_PAGE_SIZE);
+    uint8_t *raw = MAP_FAILED;
+
+#if defined(MAP_HUGETLB)
+    // Explicit huge pages from the reserved pool, faulted in up front
+    raw = mmap(NULL, len, PROT_READ | PROT_WRITE,
+               MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | MAP_POPULATE, -1, 0);
+#elif defined(__APPLE__) && defined(VM_FLAGS_SUPERPAGE_SIZE_2MB)
+    // Superpages only exist on Intel Macs, elsewhere this fails and we fall back
+    raw = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS,
+               VM_FLAGS_SUPERPAGE_SIZE_2MB, 0);
+    if (raw != MAP_FAILED) picasso__prefault(raw, len);
+#endif
+
+    if (raw != MAP_FAILED) {
+        *mode = PICASSO_PAGES_HUGE;
+    } else {
+        // Over-map so the region can be trimmed to a 2 MB boundary, which is
+        // what transparent huge pages need to back it
+        size_t map_len = len + PICASSO__HUGE_PAGE_SIZE;
+        uint8_t *map = mmap(NULL, map_len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (map == MAP_FAILED) return NULL;
+
+        raw = (uint8_t *)PICASSO__ALIGN_UP((uintptr_t)map, PICASSO__HUGE_PAGE_SIZE);
+        size_t head = (size_t)(raw - map);
+        if (head) munmap(map, head);
+        if (map_len - head > len) munmap(raw + len, map_len - head - len);
+
+        *mode = PICASSO_PAGES_MAPPED;
+#if defined(MADV_HUGEPAGE)
+        if (madvise(raw, len, MADV_HUGEPAGE) == 0) *mode = PICASSO_PAGES_TRANSPARENT_HUGE;
+#endif
+        picasso__prefault(raw, len);
+    }
+
+    TRACE("Mapped %zu bytes for a %zu byte buffer", len, size);
+    // The payload gets everything past the header, so free unmaps the full length
+    return picasso__place_header(raw, &picasso__pages_allocator, len - offset, PICASSO_ALIGNMENT, offset);
+}
+#else
+static void *picasso__alloc_pages(size_t size, picasso_page_mode *mode)
+{
+    (void)size; (void)mode;
+    return NULL;
+}
+#endif
+
+/* Bump arena */
+static void *picasso__arena_alloc(void *user, size_t size, size_t alignment)
+{
+    picasso_arena *arena = user;
+    uintptr_t base  = (uintptr_t)arena->base;
+    uintptr_t start = PICASSO__ALIGN_UP(base + arena->offset, alignment);
+
+    if (start - base > arena->capacity || size > arena->capacity - (start - base)) {
+        WARN("Arena out of memory (%zu of %zu bytes used, asked for %zu)",
+             arena->offset, arena->capacity, size);
+        return NULL;
+    }
+
+    arena->offset = (start - base) + size;
+    if (arena->offset > arena->peak) arena->peak = arena->offset;
+    return (void *)start;
+}
+
+static void picasso__arena_free(void *user, void *ptr, size_t size, size_t alignment)
+{
+    (void)alignment;
+    picasso_arena *arena = user;
+    // Only the most recent allocation can be given back, the rest waits for reset
+    if ((uint8_t *)ptr + size == arena->base + arena->offset) {
+        arena->offset = (size_t)((uint8_t *)ptr - arena->base);
+    }
+}
+
+void picasso_arena_init(picasso_arena *arena, void *buffer, size_t capacity)
+{
+    if (!arena) return;
+    arena->base     = buffer;
+    arena->capacity = buffer ? capacity : 0;
+    arena->offset   = 0;
+    arena->peak     = 0;
+}
+
+void picasso_arena_reset(picasso_arena *arena)
+{
+    if (arena) arena->offset = 0;
+}
+
+picasso_allocator picasso_arena_allocator(picasso_arena *arena)
+{
+    return (picasso_allocator){
+        .alloc = picasso__arena_alloc,
+        .free  = picasso__arena_free,
+        .user  = arena,
+    };
+}
+
+/* Fixed-size block pool. Blocks that were never handed out are taken from
+ * `next`, so neither init nor reset needs to walk the buffer */
+static void *picasso__pool_alloc(void *user, size_t size, size_t alignment)
+{
+    picasso_pool *pool = user;
+    if (size > pool->block_size || alignment > PICASSO_POOL_ALIGN) {
+        WARN("Pool blocks are %zu bytes aligned to %d, asked for %zu aligned to %zu",
+             pool->block_size, PICASSO_POOL_ALIGN, size, alignment);
+        return NULL;
+    }
+
+    void *block;
+    if (pool->free_list) {
+        block = pool->free_list;
+        pool->free_list = *(void **)block;
+    } else if (pool->next < pool->block_count) {
+        block = pool->base + pool->next++ * pool->block_size;
+    } else {
+        WARN("Pool exhausted (%zu blocks)", pool->block_count);
+        return NULL;
+    }
+    pool->used++;
+    return block;
+}
+
+static void picasso__pool_free(void *user, void *ptr, size_t size, size_t alignment)
+{
+    (void)size; (void)alignment;
+    picasso_pool *pool = user;
+    *(void **)ptr = pool->free_list;
+    pool->free_list = ptr;
+    pool->used--;
+}
+
+void picasso_pool_init(picasso_pool *pool, void *buffer, size_t buffer_size, size_t block_size)
+{
+    if (!pool) return;
+    memset(pool, 0, sizeof(*pool));
+    if (!buffer || block_size == 0) return;
+
+    uint8_t *base = (uint8_t *)PICASSO__ALIGN_UP((uintptr_t)buffer, PICASSO_POOL_ALIGN);
+    size_t lost = (size_t)(base - (uint8_t *)buffer);
+    if (lost >= buffer_size) return;
+
+    // Room for the allocation header, rounded so every block stays aligned
+    pool->block_size  = PICASSO__ALIGN_UP(block_size + PICASSO_ALLOC_OVERHEAD, PICASSO_POOL_ALIGN);
+    pool->base        = base;
+    pool->block_count = (buffer_size - lost) / pool->block_size;
+    TRACE("Pool of %zu blocks, %zu bytes each", pool->block_count, pool->block_size);
+}
+
+void picasso_pool_reset(picasso_pool *pool)
+{
+    if (!pool) return;
+    pool->free_list = NULL;
+    pool->next      = 0;
+    pool->used      = 0;
+}
+
+picasso_allocator picasso_pool_allocator(picasso_pool *pool)
+{
+    return (picasso_allocator){
+        .alloc = picasso__pool_alloc,
+        .free  = picasso__pool_free,
+        .user  = pool,
+    };
+}
+
+/* -------------------- CPU Dispatch -------------------- */
+/* Pixel kernels exist once per instruction set, all compiled into the same
+ * binary. x86 ones are built with target attributes, so the build itself
+ * needs no -m flags. The table in use is picked on first use, see
+ * picasso__select_kernels */
+#if defined(__x86_64__) || defined(__i386__)
+#define PICASSO__X86 1
+#define PICASSO__TARGET(isa) __attribute__((target(isa)))
+#else
+#define PICASSO__X86 0
+#endif
+
+typedef struct {
+    picasso_simd_level level;
+    void (*fill_span)(uint32_t *dst, size_t n, uint32_t value, bool stream);
+    void (*blend_span_solid)(uint32_t *dst, size_t n, uint32_t src);
+    void (*blend_span)(uint32_t *dst, const uint8_t *src, size_t n);
+    void (*blend_span_solid_premul)(uint32_t *dst, size_t n, uint32_t src);
+    void (*blend_span_premul)(uint32_t *dst, const uint8_t *src, size_t n);
+    void (*premultiply)(uint8_t *dst, const uint8_t *src, size_t count);
+    void (*rgba_to_rgb)(uint8_t *dst, const uint8_t *src, size_t count);
+    void (*rgb_to_rgba)(uint32_t *dst, const uint8_t *src, size_t count);
+    void (*swap_rb)(uint8_t *pixels, size_t count, int channels);
+    void (*bilinear_row)(uint32_t *dst, const uint32_t *row0, const uint32_t *row1,
+                         const int32_t *cols, const uint16_t *weights, size_t n, uint32_t wy);
+    void (*bilinear_gather)(uint32_t *dst, const uint32_t *texels, size_t stride, const int32_t *offsets,
+                            const uint16_t *wx, const uint16_t *wy, size_t n);
+} picasso__kernel_table;
+
+static const picasso__kernel_table *picasso__select_kernels(void);
+static _Atomic(const picasso__kernel_table *) picasso__active_kernels = NULL;
+
+static inline const picasso__kernel_table *picasso__kernels(void)
+{
+    const picasso__kernel_table *k = atomic_load_explicit(&picasso__active_kernels, memory_order_acquire);
+    return k ? k : picasso__select_kernels();
 }
 
 /* -------------------- Little Endian Byte Readers Utility -------------------- */
@@ -193,16 +610,22 @@ picasso_image *picasso_load_ppm(const char *filename)
     }
 
     image = picasso_alloc_image(width, height, 3);
+    if (!image) {
+        ERROR("Failed to allocate %dx%d image", width, height);
+        goto fail;
+    }
 
     // Skip single whitespace after maxval before pixel data
     fgetc(f);
     TRACE("Skipped whitespace after maxval");
 
-    size_t pixels_size = (size_t)image->row_stride*image->height;
-    size_t read = fread(image->pixels, 1, pixels_size, f);
-    if (read != pixels_size) {
-        ERROR("Unexpected EOF: expected %zu bytes, got %zu", pixels_size, read);
-        goto fail;
+    size_t row_bytes = (size_t)image->width * 3;
+    for (int y = 0; y < image->height; ++y) {
+        size_t read = fread(image->pixels + (size_t)y * image->row_stride, 1, row_bytes, f);
+        if (read != row_bytes) {
+            ERROR("Unexpected EOF in row %d: expected %zu bytes, got %zu", y, row_bytes, read);
+            goto fail;
+        }
     }
 
     TRACE("Read pixel data");
@@ -218,8 +641,118 @@ fail:
     return NULL;
 }
 
-int picasso_save_to_ppm(ppm *image, const char *file_path)
+/* Converting and writing happens in chunks of this size, so saving never
+ * needs more than this on the stack, whatever the image dimensions are.
+ * Small enough to stay resident in L1/L2 between convert and fwrite */
+#define PICASSO_PPM_CHUNK_BYTES (16 * 1024)
+
+/* Packs RGBA (4 bytes per pixel) into RGB (3 bytes per pixel), dropping alpha */
+static void picasso__rgba_to_rgb_scalar(uint8_t *dst, const uint8_t *src, size_t count)
+{
+    for (size_t i = 0; i < count; ++i) {
+        dst[i*3 + 0] = src[i*4 + 0];
+        dst[i*3 + 1] = src[i*4 + 1];
+        dst[i*3 + 2] = src[i*4 + 2];
+    }
+}
+
+#if PICASSO__X86
+// 16 pixels per round: 64 bytes in, 48 bytes out in three full stores
+PICASSO__TARGET("ssse3")
+static void picasso__rgba_to_rgb_ssse3(uint8_t *dst, const uint8_t *src, size_t count)
+{
+    size_t i = 0;
+    const __m128i pack = _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14,
+                                       -1, -1, -1, -1);
+    for (; i + 16 <= count; i += 16) {
+        __m128i a = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(src + i*4 +  0)), pack);
+        __m128i b = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(src + i*4 + 16)), pack);
+        __m128i c = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(src + i*4 + 32)), pack);
+        __m128i d = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(src + i*4 + 48)), pack);
+
+        _mm_storeu_si128((__m128i *)(dst + i*3 +  0), _mm_or_si128(a, _mm_slli_si128(b, 12)));
+        _mm_storeu_si128((__m128i *)(dst + i*3 + 16), _mm_or_si128(_mm_srli_si128(b, 4), _mm_slli_si128(c, 8)));
+        _mm_storeu_si128((__m128i *)(dst + i*3 + 32), _mm_or_si128(_mm_srli_si128(c, 8), _mm_slli_si128(d, 4)));
+    }
+    picasso__rgba_to_rgb_scalar(dst + i*3, src + i*4, count - i);
+}
+#endif
+
+#if defined(__ARM_NEON)
+static void picasso__rgba_to_rgb_neon(uint8_t *dst, const uint8_t *src, size_t count)
+{
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        uint8x16x4_t rgba = vld4q_u8(src + i*4);
+        uint8x16x3_t rgb  = { { rgba.val[0], rgba.val[1], rgba.val[2] } };
+        vst3q_u8(dst + i*3, rgb);
+    }
+    picasso__rgba_to_rgb_scalar(dst + i*3, src + i*4, count - i);
+}
+#endif
+
+/* Streams rows out as P6 body. RGB rows are written as they are, RGBA rows
+ * are packed into a fixed chunk which is flushed every time it fills up.
+ * Premultiplied rows are turned back to straight color a few pixels at a time
+ * on the way into the chunk */
+static bool picasso__write_ppm_pixels(FILE *f, const uint8_t *pixels, int width, int height,
+                                      int channels, size_t stride, bool premul)
+{
+    size_t row_bytes = (size_t)width * 3;
+
+    if (channels == 3) {
+        if (stride == row_bytes) {
+            return fwrite(pixels, 1, row_bytes * height, f) == row_bytes * height;
+        }
+        for (int y = 0; y < height; ++y) {
+            if (fwrite(pixels + y * stride, 1, row_bytes, f) != row_bytes) return false;
+        }
+        return true;
+    }
+
+    uint8_t chunk[PICASSO_PPM_CHUNK_BYTES];
+    uint32_t straight[256];
+    size_t chunk_pixels = sizeof(chunk) / 3;
+    size_t fill = 0; // pixels currently waiting in chunk
+
+    for (int y = 0; y < height; ++y) {
+        const uint8_t *src = pixels + y * stride;
+        size_t remaining = (size_t)width;
+
+        while (remaining > 0) {
+            size_t n = PICASSO_MIN(remaining, chunk_pixels - fill);
+            if (premul) {
+                n = PICASSO_MIN(n, sizeof(straight) / sizeof(straight[0]));
+                picasso_unpremultiply_pixels((uint8_t *)straight, src, n);
+                picasso__kernels()->rgba_to_rgb(chunk + fill * 3, (const uint8_t *)straight, n);
+            } else {
+                picasso__kernels()->rgba_to_rgb(chunk + fill * 3, src, n);
+            }
+            src += n * 4;
+            fill += n;
+            remaining -= n;
+
+            if (fill == chunk_pixels) {
+                if (fwrite(chunk, 3, fill, f) != fill) return false;
+                fill = 0;
+            }
+        }
+    }
+    return fill == 0 || fwrite(chunk, 3, fill, f) == fill;
+}
+
+static int picasso__save_ppm(const char *file_path, const uint8_t *pixels,
+                             int width, int height, int channels, size_t stride, bool premul)
 {
+    if (!pixels || width <= 0 || height <= 0 || (channels != 3 && channels != 4)) {
+        ERROR("Invalid PPM save params: %dx%d, %d channels", width, height, channels);
+        return -1;
+    }
+    if (stride < (size_t)width * channels) {
+        ERROR("Row stride %zu is too small for %d pixels of %d channels", stride, width, channels);
+        return -1;
+    }
+
     FILE *f = fopen(file_path, "wb");
     if (f == NULL) {
         ERROR("Failed to open file for writing: %s", file_path);
@@ -227,28 +760,75 @@ int picasso_save_to_ppm(ppm *image, const char *file_path)
     }
     TRACE("Opened file for writing: %s", file_path);
 
-    fprintf(f, "P6\n%zu %zu\n255\n", image->width, image->height);
-    DEBUG("Wrote PPM header: P6 %zux%zu", image->width, image->height);
-
-    size_t total_pixels = image->width * image->height;
-    TRACE("Saving %zu pixels", total_pixels);
+    fprintf(f, "P6\n%d %d\n255\n", width, height);
+    DEBUG("Wrote PPM header: P6 %dx%d", width, height);
+    TRACE("Saving %zu pixels from %d channels, stride %zu", (size_t)width * height, channels, stride);
 
-    size_t total_bytes = image->width * image->height * 3;
-    size_t written = fwrite(image->pixels, sizeof(uint8_t), total_bytes, f);
-    if (written != total_bytes) {
+    if (!picasso__write_ppm_pixels(f, pixels, width, height, channels, stride, premul)) {
         ERROR("Failed to write pixel data");
         fclose(f);
         return -1;
     }
 
     fclose(f);
-    INFO("Saved PPM image to %s (%zux%zu)", file_path, image->width, image->height);
+    INFO("Saved PPM image to %s (%dx%d)", file_path, width, height);
     return 0;
 }
 
+int picasso_save_pixels_to_ppm(const char *file_path, const uint8_t *pixels,
+                               int width, int height, int channels, size_t stride)
+{
+    return picasso__save_ppm(file_path, pixels, width, height, channels, stride, false);
+}
+
+int picasso_save_to_ppm(ppm *image, const char *file_path)
+{
+    if (!image) return -1;
+    return picasso_save_pixels_to_ppm(file_path, image->pixels, (int)image->width,
+                                      (int)image->height, 3, image->width * 3);
+}
+
+int picasso_save_image_to_ppm(const picasso_image *img, const char *file_path)
+{
+    if (!img) return -1;
+    picasso_view v = picasso_view_from_image(img);
+    return picasso_save_view_to_ppm(&v, file_path);
+}
+
 picasso_image *picasso_alloc_image(int width, int height, int channels)
 {
-    if (width <= 0 || height <= 0 || (channels != 3 && channels != 4)) return NULL;
+    return picasso_alloc_image_ex(width, height, channels, PICASSO_ALLOC_DEFAULT);
+}
+
+/* All size math for pixel storage lives here, in size_t and overflow checked.
+ * Row strides must still fit the int/uint32 fields of image and backbuffer */
+static bool picasso__storage_size(int width, int height, int bytes_per_pixel, uint32_t flags,
+                                  size_t *stride, size_t *bytes)
+{
+    size_t row;
+    if (width <= 0 || height <= 0 ||
+        __builtin_mul_overflow((size_t)width, (size_t)bytes_per_pixel, &row)) {
+        return false;
+    }
+    if (flags & PICASSO_ALLOC_PAD_ROWS) {
+        if (row > SIZE_MAX - PICASSO_ALIGNMENT) return false;
+        row = PICASSO__ALIGN_UP(row, PICASSO_ALIGNMENT);
+    }
+    if (row > INT32_MAX || __builtin_mul_overflow(row, (size_t)height, bytes)) {
+        ERROR("%dx%d at %d bytes per pixel does not fit in memory", width, height, bytes_per_pixel);
+        return false;
+    }
+    *stride = row;
+    return true;
+}
+
+/* Pixels always start on a PICASSO_ALIGNMENT boundary. With PICASSO_ALLOC_PAD_ROWS
+ * every row does too, so SIMD kernels can use aligned loads on any row */
+picasso_image *picasso_alloc_image_ex(int width, int height, int channels, uint32_t flags)
+{
+    size_t stride, bytes;
+    if (channels != 3 && channels != 4) return NULL;
+    if (!picasso__storage_size(width, height, channels, flags, &stride, &bytes)) return NULL;
 
     picasso_image *img = picasso_malloc(sizeof(picasso_image));
     if (!img) return NULL;
@@ -256,8 +836,15 @@ picasso_image *picasso_alloc_image(int width, int height, int channels)
     img->width = width;
     img->height = height;
     img->channels = channels;
-    img->row_stride = channels*width;
-    img->pixels = picasso_malloc(width * height * channels);
+    img->row_stride = (int)stride;
+    img->premultiplied = channels == 4 && (flags & PICASSO_ALLOC_PREMULTIPLIED);
+    picasso_page_mode mode = PICASSO_PAGES_DEFAULT;
+    img->pixels = NULL;
+    if (flags & PICASSO_ALLOC_HUGE_PAGES) {
+        img->pixels = picasso__alloc_pages(bytes, &mode);
+        if (!img->pixels) WARN("Could not map pages for %dx%d image, using the allocator", width, height);
+    }
+    if (!img->pixels) img->pixels = picasso_malloc_aligned(bytes, PICASSO_ALIGNMENT);
     if (!img->pixels) {
         picasso_free(img);
         return NULL;
@@ -266,209 +853,3449 @@ picasso_image *picasso_alloc_image(int width, int height, int channels)
     return img;
 }
 
-void picasso_free_image(picasso_image *img)
+void picasso_premultiply_image(picasso_image *img)
 {
-    if (img->pixels) picasso_free(img->pixels);
-    if (img)         picasso_free(img);
+    if (!img || img->channels != 4 || img->premultiplied) return;
+    for (int y = 0; y < img->height; ++y) {
+        uint8_t *row = img->pixels + (size_t)y * img->row_stride;
+        picasso_premultiply_pixels(row, row, img->width);
+    }
+    img->premultiplied = true;
+}
 
+void picasso_unpremultiply_image(picasso_image *img)
+{
+    if (!img || img->channels != 4 || !img->premultiplied) return;
+    for (int y = 0; y < img->height; ++y) {
+        uint8_t *row = img->pixels + (size_t)y * img->row_stride;
+        picasso_unpremultiply_pixels(row, row, img->width);
+    }
+    img->premultiplied = false;
 }
-// SPRITES
 
-picasso_sprite_sheet* picasso_create_sprite_sheet(
-    uint32_t* pixels,
-    int sheet_width,
-    int sheet_height,
-    int frame_width,
-    int frame_height,
-    int margin_x,
-    int margin_y,
-    int spacing_x,
-    int spacing_y)
+void picasso_free_image(picasso_image *img)
 {
-    if (!pixels || frame_width <= 0 || frame_height <= 0) return NULL;
+    if (!img) return;
+    if (img->pixels) picasso_free(img->pixels);
+    picasso_free(img);
+}
 
-    int cols = (sheet_width  - 2 * margin_x + spacing_x) / (frame_width + spacing_x);
-    int rows = (sheet_height - 2 * margin_y + spacing_y) / (frame_height + spacing_y);
-    int total = cols * rows;
+// IMAGE POOL
 
-    picasso_sprite_sheet* sheet = picasso_malloc(sizeof(picasso_sprite_sheet));
-    if (!sheet) return NULL;
+/* Idle buffers wait in a list ordered by last release, most recent first,
+ * so trimming always drops whatever has been idle the longest */
+typedef enum { PICASSO__POOL_IMAGE, PICASSO__POOL_BACKBUFFER } picasso__pool_kind;
 
-    sheet->pixels         = pixels;
-    sheet->sheet_width    = sheet_width;
-    sheet->sheet_height   = sheet_height;
-    sheet->frame_width    = frame_width;
-    sheet->frame_height   = frame_height;
-    sheet->margin_x       = margin_x;
-    sheet->margin_y       = margin_y;
-    sheet->spacing_x      = spacing_x;
-    sheet->spacing_y      = spacing_y;
-    sheet->frames_per_row = cols;
-    sheet->frames_per_col = rows;
-    sheet->frame_count    = total;
+typedef struct picasso__pool_entry {
+    struct picasso__pool_entry *prev, *next;
+    picasso__pool_kind kind;
+    int width, height, channels;
+    size_t stride;
+    size_t bytes;
+    void *object; // picasso_image* or picasso_backbuffer*
+} picasso__pool_entry;
 
-    sheet->frames = picasso_malloc(sizeof(picasso_sprite) * total);
-    if (!sheet->frames) {
-        picasso_free(sheet);
-        return NULL;
-    }
+struct picasso_image_pool {
+    picasso__pool_entry *head, *tail;
+    picasso__pool_entry *spare; // recycled list nodes
+    size_t budget;
+    picasso_image_pool_stats stats;
+};
 
-    int i = 0;
-    for (int row = 0; row < rows; ++row) {
-        for (int col = 0; col < cols; ++col) {
-            int x = margin_x + col * (frame_width + spacing_x);
-            int y = margin_y + row * (frame_height + spacing_y);
-            sheet->frames[i++] = (picasso_sprite){ x, y, frame_width, frame_height };
-        }
-    }
+picasso_image_pool *picasso_image_pool_create(size_t byte_budget)
+{
+    picasso_image_pool *pool = picasso_calloc(1, sizeof(picasso_image_pool));
+    if (!pool) return NULL;
+    pool->budget = byte_budget;
+    return pool;
+}
 
-    return sheet;
+static void picasso__pool_unlink(picasso_image_pool *pool, picasso__pool_entry *e)
+{
+    if (e->prev) e->prev->next = e->next; else pool->head = e->next;
+    if (e->next) e->next->prev = e->prev; else pool->tail = e->prev;
+    pool->stats.bytes_cached -= e->bytes;
+    pool->stats.buffers_cached--;
+
+    e->next = pool->spare;
+    pool->spare = e;
 }
 
-void picasso_destroy_sprite_sheet(picasso_sprite_sheet* sheet)
+static void picasso__pool_free_object(picasso__pool_entry *e)
 {
-    if (!sheet) return;
-    picasso_free(sheet->frames);
-    picasso_free(sheet);
+    if (e->kind == PICASSO__POOL_IMAGE) picasso_free_image(e->object);
+    else                                picasso_destroy_backbuffer(e->object);
 }
 
+void picasso_image_pool_trim(picasso_image_pool *pool, size_t target_bytes)
+{
+    if (!pool) return;
+    while (pool->tail && pool->stats.bytes_cached > target_bytes) {
+        picasso__pool_entry *lru = pool->tail;
+        picasso__pool_free_object(lru);
+        picasso__pool_unlink(pool, lru);
+        pool->stats.evictions++;
+    }
+}
 
-// --------------------------------------------------------
+void picasso_image_pool_set_budget(picasso_image_pool *pool, size_t byte_budget)
+{
+    if (!pool) return;
+    pool->budget = byte_budget;
+    picasso_image_pool_trim(pool, byte_budget);
+}
+
+void picasso_image_pool_destroy(picasso_image_pool *pool)
+{
+    if (!pool) return;
+    picasso_image_pool_trim(pool, 0);
+    while (pool->spare) {
+        picasso__pool_entry *next = pool->spare->next;
+        picasso_free(pool->spare);
+        pool->spare = next;
+    }
+    picasso_free(pool);
+}
+
+picasso_image_pool_stats picasso_image_pool_get_stats(const picasso_image_pool *pool)
+{
+    picasso_image_pool_stats stats = {0};
+    if (pool) stats = pool->stats;
+    return stats;
+}
+
+static void *picasso__pool_take(picasso_image_pool *pool, picasso__pool_kind kind,
+                                int width, int height, int channels, size_t stride)
+{
+    for (picasso__pool_entry *e = pool->head; e; e = e->next) {
+        if (e->kind == kind && e->width == width && e->height == height &&
+            e->channels == channels && e->stride == stride) {
+            void *object = e->object;
+            picasso__pool_unlink(pool, e);
+            pool->stats.hits++;
+            return object;
+        }
+    }
+    pool->stats.misses++;
+    return NULL;
+}
+
+static void picasso__pool_give(picasso_image_pool *pool, picasso__pool_kind kind, void *object,
+                               int width, int height, int channels, size_t stride)
+{
+    picasso__pool_entry e = {
+        .kind = kind, .width = width, .height = height, .channels = channels,
+        .stride = stride, .object = object,
+        .bytes = stride * height + (kind == PICASSO__POOL_IMAGE ? sizeof(picasso_image)
+                                                                : sizeof(picasso_backbuffer)),
+    };
+
+    picasso__pool_entry *node = pool->spare;
+    if (node) pool->spare = node->next;
+    else      node = picasso_malloc(sizeof(picasso__pool_entry));
+
+    if (e.bytes > pool->budget || !node) {
+        // Would never fit, or no room to track it, so let it go right away
+        if (node) { node->next = pool->spare; pool->spare = node; }
+        picasso__pool_free_object(&e);
+        pool->stats.evictions++;
+        return;
+    }
+
+    *node = e;
+    node->prev = NULL;
+    node->next = pool->head;
+    if (pool->head) pool->head->prev = node; else pool->tail = node;
+    pool->head = node;
+    pool->stats.bytes_cached += node->bytes;
+    pool->stats.buffers_cached++;
+
+    picasso_image_pool_trim(pool, pool->budget);
+}
+
+picasso_image *picasso_image_pool_acquire(picasso_image_pool *pool, int width, int height,
+                                          int channels, uint32_t flags)
+{
+    if (!pool) return picasso_alloc_image_ex(width, height, channels, flags);
+
+    size_t stride, bytes;
+    if (!picasso__storage_size(width, height, channels, flags, &stride, &bytes)) return NULL;
+
+    picasso_image *img = picasso__pool_take(pool, PICASSO__POOL_IMAGE, width, height, channels, stride);
+    if (!img) return picasso_alloc_image_ex(width, height, channels, flags);
+    img->premultiplied = channels == 4 && (flags & PICASSO_ALLOC_PREMULTIPLIED);
+    return img;
+}
+
+void picasso_image_pool_release(picasso_image_pool *pool, picasso_image *img)
+{
+    if (!img) return;
+    if (!pool) { picasso_free_image(img); return; }
+    picasso__pool_give(pool, PICASSO__POOL_IMAGE, img, img->width, img->height,
+                       img->channels, (size_t)img->row_stride);
+}
+
+picasso_backbuffer *picasso_image_pool_acquire_backbuffer(picasso_image_pool *pool,
+                                                          int width, int height, uint32_t flags)
+{
+    if (!pool) return picasso_create_backbuffer_ex(width, height, flags);
+
+    size_t pitch, bytes;
+    if (!picasso__storage_size(width, height, sizeof(uint32_t), flags, &pitch, &bytes)) return NULL;
+
+    picasso_backbuffer *bf = picasso__pool_take(pool, PICASSO__POOL_BACKBUFFER, width, height, 4, pitch);
+    if (!bf) return picasso_create_backbuffer_ex(width, height, flags);
+    bf->premultiplied = (flags & PICASSO_ALLOC_PREMULTIPLIED) != 0;
+    bf->damage = (picasso_damage){0}; // off, as on a fresh backbuffer
+    return bf;
+}
+
+void picasso_image_pool_release_backbuffer(picasso_image_pool *pool, picasso_backbuffer *bf)
+{
+    if (!bf) return;
+    if (!pool) { picasso_destroy_backbuffer(bf); return; }
+    picasso__pool_give(pool, PICASSO__POOL_BACKBUFFER, bf, (int)bf->width, (int)bf->height,
+                       4, bf->pitch);
+}
+// SPRITES
+
+picasso_sprite_sheet* picasso_create_sprite_sheet(
+    uint32_t* pixels,
+    int sheet_width,
+    int sheet_height,
+    int frame_width,
+    int frame_height,
+    int margin_x,
+    int margin_y,
+    int spacing_x,
+    int spacing_y)
+{
+    if (!pixels || frame_width <= 0 || frame_height <= 0) return NULL;
+
+    int cols = (sheet_width  - 2 * margin_x + spacing_x) / (frame_width + spacing_x);
+    int rows = (sheet_height - 2 * margin_y + spacing_y) / (frame_height + spacing_y);
+    int total = cols * rows;
+
+    picasso_sprite_sheet* sheet = picasso_malloc(sizeof(picasso_sprite_sheet));
+    if (!sheet) return NULL;
+
+    sheet->pixels         = pixels;
+    sheet->sheet_width    = sheet_width;
+    sheet->sheet_height   = sheet_height;
+    sheet->frame_width    = frame_width;
+    sheet->frame_height   = frame_height;
+    sheet->margin_x       = margin_x;
+    sheet->margin_y       = margin_y;
+    sheet->spacing_x      = spacing_x;
+    sheet->spacing_y      = spacing_y;
+    sheet->frames_per_row = cols;
+    sheet->frames_per_col = rows;
+    sheet->frame_count    = total;
+    sheet->premultiplied  = false;
+
+    sheet->frames = picasso_malloc(sizeof(picasso_sprite) * total);
+    if (!sheet->frames) {
+        picasso_free(sheet);
+        return NULL;
+    }
+
+    int i = 0;
+    for (int row = 0; row < rows; ++row) {
+        for (int col = 0; col < cols; ++col) {
+            int x = margin_x + col * (frame_width + spacing_x);
+            int y = margin_y + row * (frame_height + spacing_y);
+            sheet->frames[i++] = (picasso_sprite){ x, y, frame_width, frame_height };
+        }
+    }
+
+    return sheet;
+}
+
+void picasso_destroy_sprite_sheet(picasso_sprite_sheet* sheet)
+{
+    if (!sheet) return;
+    picasso_free(sheet->frames);
+    picasso_free(sheet);
+}
+
+
+// --------------------------------------------------------
 // Graphical functions and utilities
 // --------------------------------------------------------
-/* Here we are supporting negative width and height, drawing
- * in all directions! */
-static void picasso__normalize_rect(picasso_rect *r)
+/* Here we are supporting negative width and height, drawing
+ * in all directions! */
+static void picasso__normalize_rect(picasso_rect *r)
+{
+    if(!r) {WARN("Tried to normalize a NULL object");return;}
+    if (r->width < 0) {
+        r->x += r->width;
+        r->width = -r->width;
+    }
+    if (r->height < 0) {
+        r->y += r->height;
+        r->height = -r->height;
+    }
+}
+/* Creating the bounds for looping over, removing the logic from the draw functions */
+static bool picasso__clip_rect_to_bounds(picasso_backbuffer *bf, const picasso_rect *r,
+                                 picasso_draw_bounds *db)
+{
+    if (!r || r->width == 0 || r->height == 0)
+        return false;
+
+    if (r->x >= (int)bf->width || r->y >= (int)bf->height ||
+        r->x + r->width <= 0 || r->y + r->height <= 0)
+        return false;
+
+    db->x0 = (r->x > 0) ? r->x : 0;
+    db->y0 = (r->y > 0) ? r->y : 0;
+    db->x1 = (r->x + r->width < (int)bf->width) ? r->x + r->width : (int)bf->width;
+    db->y1 = (r->y + r->height < (int)bf->height) ? r->y + r->height : (int)bf->height;
+
+    return true;
+}
+
+/* x / 255 rounded to nearest, exact for every x up to 255 * 255. The SIMD
+ * kernels do the same with a 16 bit multiply-high, so all paths agree */
+static inline uint32_t picasso__div255(uint32_t x)
+{
+    return ((x + 128) * 257) >> 16;
+}
+
+static inline uint32_t picasso__blend_pixel(uint32_t dst, uint32_t src)
+{
+    uint32_t sa = src >> 24;
+    if (sa == 255) return src;
+    if (sa == 0) return dst;
+
+    uint32_t da = 255 - sa;
+    uint32_t r = picasso__div255((src & 0xFF)         * sa + (dst & 0xFF)         * da);
+    uint32_t g = picasso__div255(((src >> 8) & 0xFF)  * sa + ((dst >> 8) & 0xFF)  * da);
+    uint32_t b = picasso__div255(((src >> 16) & 0xFF) * sa + ((dst >> 16) & 0xFF) * da);
+
+    return 0xFF000000u | (b << 16) | (g << 8) | r;
+}
+
+/* Premultiplied src over dst, src + dst * (255 - a) / 255 on all four
+ * channels. No multiply on the source side at all */
+static inline uint32_t picasso__blend_pixel_premul(uint32_t dst, uint32_t src)
+{
+    uint32_t sa = src >> 24;
+    if (sa == 255) return src;
+    if (src == 0) return dst;
+
+    uint32_t inv = 255 - sa;
+    uint32_t r = (src & 0xFF)         + picasso__div255((dst & 0xFF)         * inv);
+    uint32_t g = ((src >> 8) & 0xFF)  + picasso__div255(((dst >> 8) & 0xFF)  * inv);
+    uint32_t b = ((src >> 16) & 0xFF) + picasso__div255(((dst >> 16) & 0xFF) * inv);
+    uint32_t a = sa                   + picasso__div255((dst >> 24)          * inv);
+
+    // Only invalid input (color above alpha) can overflow, clamp like the vector paths
+    return (a > 255 ? 255u : a) << 24 | (b > 255 ? 255u : b) << 16 |
+           (g > 255 ? 255u : g) << 8  | (r > 255 ? 255u : r);
+}
+
+static inline uint32_t picasso__premultiply(uint32_t px)
+{
+    uint32_t a = px >> 24;
+    if (a == 255) return px;
+    return (a << 24) |
+           (picasso__div255(((px >> 16) & 0xFF) * a) << 16) |
+           (picasso__div255(((px >> 8) & 0xFF) * a) << 8) |
+            picasso__div255((px & 0xFF) * a);
+}
+
+// Same rounding and clamping as picasso_unpremultiply_pixels
+static inline uint32_t picasso__unpremultiply(uint32_t px)
+{
+    uint32_t a = px >> 24;
+    if (a == 255) return px;
+    if (a == 0) return 0;
+
+    uint32_t out = a << 24;
+    for (int shift = 0; shift < 24; shift += 8) {
+        uint32_t v = (((px >> shift) & 0xFF) * 255u + a / 2) / a;
+        out |= (v > 255 ? 255u : v) << shift;
+    }
+    return out;
+}
+// --------------------------------------------------------
+// Damage tracking
+// --------------------------------------------------------
+/* Every primitive reports the clipped area it touched. Rects that overlap or
+ * touch are merged, and when the list is full the new rect is folded into
+ * whichever existing one grows the least. The result always covers every
+ * touched pixel, it may just cover a few more */
+static inline long long picasso__bounds_area(picasso_draw_bounds b)
+{
+    return (long long)(b.x1 - b.x0) * (b.y1 - b.y0);
+}
+
+static inline picasso_draw_bounds picasso__bounds_union(picasso_draw_bounds a, picasso_draw_bounds b)
+{
+    return (picasso_draw_bounds){
+        PICASSO_MIN(a.x0, b.x0), PICASSO_MIN(a.y0, b.y0),
+        PICASSO_MAX(a.x1, b.x1), PICASSO_MAX(a.y1, b.y1),
+    };
+}
+
+static void picasso__damage(picasso_backbuffer *bf, picasso_draw_bounds b)
+{
+    picasso_damage *d = &bf->damage;
+    if (!d->enabled || b.x0 >= b.x1 || b.y0 >= b.y1) return;
+
+    bool merged = true;
+    while (merged) {
+        merged = false;
+        for (int i = 0; i < d->count; ++i) {
+            picasso_draw_bounds r = d->rects[i];
+            if (r.x0 <= b.x0 && r.y0 <= b.y0 && r.x1 >= b.x1 && r.y1 >= b.y1) return; // already covered
+
+            bool touching = b.x0 <= r.x1 && r.x0 <= b.x1 && b.y0 <= r.y1 && r.y0 <= b.y1;
+            if (touching) {
+                // Take r out and keep growing b, it may now reach others
+                b = picasso__bounds_union(b, r);
+                d->rects[i] = d->rects[--d->count];
+                merged = true;
+                break;
+            }
+        }
+
+        if (!merged && d->count == PICASSO_MAX_DAMAGE_RECTS) {
+            int best = 0;
+            long long best_growth = -1;
+            for (int i = 0; i < d->count; ++i) {
+                picasso_draw_bounds u = picasso__bounds_union(b, d->rects[i]);
+                long long growth = picasso__bounds_area(u) - picasso__bounds_area(d->rects[i])
+                                                           - picasso__bounds_area(b);
+                if (best_growth < 0 || growth < best_growth) {
+                    best = i;
+                    best_growth = growth;
+                }
+            }
+            b = picasso__bounds_union(b, d->rects[best]);
+            d->rects[best] = d->rects[--d->count];
+            merged = true;
+        }
+    }
+    d->rects[d->count++] = b;
+}
+
+void picasso_backbuffer_track_damage(picasso_backbuffer *bf, bool enable)
+{
+    if (!bf) return;
+    bf->damage.enabled = enable;
+    bf->damage.count = 0;
+}
+
+void picasso_backbuffer_reset_damage(picasso_backbuffer *bf)
+{
+    if (bf) bf->damage.count = 0;
+}
+
+/* For pixels written behind Picasso's back */
+void picasso_backbuffer_add_damage(picasso_backbuffer *bf, const picasso_rect *r)
+{
+    if (!bf || !r) return;
+    picasso_rect copy = *r;
+    picasso_draw_bounds b;
+    picasso__normalize_rect(&copy);
+    if (picasso__clip_rect_to_bounds(bf, &copy, &b)) picasso__damage(bf, b);
+}
+
+int picasso_backbuffer_get_damage(const picasso_backbuffer *bf, picasso_rect *out, int max)
+{
+    if (!bf) return 0;
+    int n = PICASSO_MIN(bf->damage.count, max);
+    for (int i = 0; out && i < n; ++i) {
+        picasso_draw_bounds b = bf->damage.rects[i];
+        out[i] = (picasso_rect){ b.x0, b.y0, b.x1 - b.x0, b.y1 - b.y0 };
+    }
+    return bf->damage.count;
+}
+
+/* Rows are pitch bytes apart, which may be more than width pixels */
+static inline uint32_t *picasso__row(picasso_backbuffer *bf, int y)
+{
+    return (uint32_t *)((uint8_t *)bf->pixels + (size_t)y * bf->pitch);
+}
+static inline const uint8_t *picasso__view_row(const picasso_view *v, int y)
+{
+    return v->pixels + (ptrdiff_t)y * v->stride;
+}
+
+/* Clears bigger than this bypass the cache with non-temporal stores. Such a
+ * buffer would evict everything else on the way in, and will not be read
+ * back before most of it has left the cache anyway */
+#define PICASSO_STREAM_THRESHOLD ((size_t)4 << 20)
+
+/* Pixel kernels. Each one comes in a plain C version and one per instruction
+ * set that helps, the wrappers at the end of this section go through the
+ * table picked in picasso__select_kernels. Vector versions do what they can
+ * in bulk and hand the remainder down to the next simpler one, so every
+ * flavour gives the exact same pixels */
+
+static void picasso__fill_span_scalar(uint32_t *dst, size_t n, uint32_t value, bool stream)
+{
+    (void)stream;
+    for (size_t i = 0; i < n; ++i) dst[i] = value;
+}
+
+static void picasso__blend_span_solid_scalar(uint32_t *dst, size_t n, uint32_t src)
+{
+    for (size_t i = 0; i < n; ++i) dst[i] = picasso__blend_pixel(dst[i], src);
+}
+
+static void picasso__blend_span_scalar(uint32_t *dst, const uint8_t *src, size_t n)
+{
+    for (size_t i = 0; i < n; ++i) {
+        uint32_t px;
+        memcpy(&px, src + i * 4, 4);
+        dst[i] = picasso__blend_pixel(dst[i], px);
+    }
+}
+
+static void picasso__blend_span_solid_premul_scalar(uint32_t *dst, size_t n, uint32_t src)
+{
+    for (size_t i = 0; i < n; ++i) dst[i] = picasso__blend_pixel_premul(dst[i], src);
+}
+
+static void picasso__blend_span_premul_scalar(uint32_t *dst, const uint8_t *src, size_t n)
+{
+    for (size_t i = 0; i < n; ++i) {
+        uint32_t px;
+        memcpy(&px, src + i * 4, 4);
+        dst[i] = picasso__blend_pixel_premul(dst[i], px);
+    }
+}
+
+static void picasso__premultiply_scalar(uint8_t *dst, const uint8_t *src, size_t count)
+{
+    for (size_t i = 0; i < count; ++i) {
+        uint32_t px;
+        memcpy(&px, src + i * 4, 4);
+        px = picasso__premultiply(px);
+        memcpy(dst + i * 4, &px, 4);
+    }
+}
+
+// RGB sources are opaque, every pixel is a straight copy
+static void picasso__rgb_to_rgba_scalar(uint32_t *dst, const uint8_t *src, size_t n)
+{
+    for (size_t i = 0; i < n; ++i, src += 3) {
+        dst[i] = 0xFF000000u | ((uint32_t)src[2] << 16) | ((uint32_t)src[1] << 8) | src[0];
+    }
+}
+
+// RGB(A) <-> BGR(A) in place
+static void picasso__swap_rb_scalar(uint8_t *pixels, size_t count, int channels)
+{
+    for (size_t i = 0; i < count; ++i, pixels += channels) {
+        PICASSO_SWAP(pixels[0], pixels[2]);
+    }
+}
+
+/* a + (b - a) * w / 256 on all four channels, w from 0 to 256. Two channels
+ * per multiply, 255 * 256 + 128 still fits the 16 bits each one has */
+static inline uint32_t picasso__lerp_pixel(uint32_t a, uint32_t b, uint32_t w)
+{
+    uint32_t rb = ((a & 0x00FF00FFu) * (256 - w) + (b & 0x00FF00FFu) * w + 0x00800080u) >> 8;
+    uint32_t ag = ((a >> 8) & 0x00FF00FFu) * (256 - w) + ((b >> 8) & 0x00FF00FFu) * w + 0x00800080u;
+    return (rb & 0x00FF00FFu) | (ag & 0xFF00FF00u);
+}
+
+/* One row of bilinear samples. Pixel i mixes cols[i] and the one after it
+ * by weights[i], in row0 and in row1, then the two results by wy */
+static void picasso__bilinear_row_scalar(uint32_t *dst, const uint32_t *row0, const uint32_t *row1,
+                                         const int32_t *cols, const uint16_t *weights, size_t n, uint32_t wy)
+{
+    for (size_t i = 0; i < n; ++i) {
+        int32_t c = cols[i];
+        uint32_t top = picasso__lerp_pixel(row0[c], row0[c + 1], weights[i]);
+        uint32_t bottom = picasso__lerp_pixel(row1[c], row1[c + 1], weights[i]);
+        dst[i] = picasso__lerp_pixel(top, bottom, wy);
+    }
+}
+
+/* Bilinear samples anywhere in an image, every pixel with its own weights.
+ * The four taps are texels[offsets[i]], the one after and the same two a
+ * stride further down */
+static void picasso__bilinear_gather_scalar(uint32_t *dst, const uint32_t *texels, size_t stride,
+                                            const int32_t *offsets, const uint16_t *wx,
+                                            const uint16_t *wy, size_t n)
+{
+    for (size_t i = 0; i < n; ++i) {
+        const uint32_t *p = texels + offsets[i];
+        uint32_t top = picasso__lerp_pixel(p[0], p[1], wx[i]);
+        uint32_t bottom = picasso__lerp_pixel(p[stride], p[stride + 1], wx[i]);
+        dst[i] = picasso__lerp_pixel(top, bottom, wy[i]);
+    }
+}
+
+#if PICASSO__X86
+/* Fill: scalar until dst is aligned, then vector stores, streaming ones if
+ * asked to. Streaming stores are not fenced here, a band of rows is filled
+ * span by span and fenced once at the end, see picasso__stream_fence */
+PICASSO__TARGET("sse2")
+static void picasso__fill_span_sse2(uint32_t *dst, size_t n, uint32_t value, bool stream)
+{
+    size_t i = 0;
+    for (; i < n && ((uintptr_t)(dst + i) & 15); ++i) dst[i] = value;
+    __m128i v = _mm_set1_epi32((int)value);
+    if (stream) {
+        for (; i + 4 <= n; i += 4) _mm_stream_si128((__m128i *)(dst + i), v);
+    } else {
+        for (; i + 4 <= n; i += 4) _mm_store_si128((__m128i *)(dst + i), v);
+    }
+    for (; i < n; ++i) dst[i] = value;
+}
+
+PICASSO__TARGET("avx2")
+static void picasso__fill_span_avx2(uint32_t *dst, size_t n, uint32_t value, bool stream)
+{
+    size_t i = 0;
+    for (; i < n && ((uintptr_t)(dst + i) & 31); ++i) dst[i] = value;
+    __m256i v = _mm256_set1_epi32((int)value);
+    if (stream) {
+        for (; i + 8 <= n; i += 8) _mm256_stream_si256((__m256i *)(dst + i), v);
+    } else {
+        for (; i + 8 <= n; i += 8) _mm256_store_si256((__m256i *)(dst + i), v);
+    }
+    for (; i < n; ++i) dst[i] = value;
+}
+
+PICASSO__TARGET("avx512f")
+static void picasso__fill_span_avx512(uint32_t *dst, size_t n, uint32_t value, bool stream)
+{
+    size_t i = 0;
+    for (; i < n && ((uintptr_t)(dst + i) & 63); ++i) dst[i] = value;
+    __m512i v = _mm512_set1_epi32((int)value);
+    if (stream) {
+        for (; i + 16 <= n; i += 16) _mm512_stream_si512((void *)(dst + i), v);
+    } else {
+        for (; i + 16 <= n; i += 16) _mm512_store_si512((void *)(dst + i), v);
+    }
+    for (; i < n; ++i) dst[i] = value;
+}
+
+// Orders the streaming fills before it with every store after it
+PICASSO__TARGET("sse2")
+static void picasso__stream_fence_sse2(void)
+{
+    _mm_sfence();
+}
+
+/* Solid blend. Per channel: (s*a + 128 + d*(255-a)) * 257 >> 16, in 16 bit
+ * lanes. The alpha lane is overwritten with 0xFF afterwards */
+PICASSO__TARGET("sse2")
+static void picasso__blend_span_solid_sse2(uint32_t *dst, size_t n, uint32_t src)
+{
+    uint32_t sa = src >> 24;
+    size_t i = 0;
+    __m128i zero   = _mm_setzero_si128();
+    __m128i opaque = _mm_set1_epi32((int)0xFF000000u);
+    __m128i m257   = _mm_set1_epi16(257);
+    __m128i inv    = _mm_set1_epi16((short)(255 - sa));
+    __m128i s16    = _mm_unpacklo_epi8(_mm_cvtsi32_si128((int)src), zero);
+    s16 = _mm_unpacklo_epi64(s16, s16);
+    __m128i bias   = _mm_add_epi16(_mm_mullo_epi16(s16, _mm_set1_epi16((short)sa)), _mm_set1_epi16(128));
+    for (; i + 4 <= n; i += 4) {
+        __m128i d  = _mm_loadu_si128((const __m128i *)(dst + i));
+        __m128i lo = _mm_unpacklo_epi8(d, zero);
+        __m128i hi = _mm_unpackhi_epi8(d, zero);
+        lo = _mm_mulhi_epu16(_mm_add_epi16(_mm_mullo_epi16(lo, inv), bias), m257);
+        hi = _mm_mulhi_epu16(_mm_add_epi16(_mm_mullo_epi16(hi, inv), bias), m257);
+        _mm_storeu_si128((__m128i *)(dst + i), _mm_or_si128(_mm_packus_epi16(lo, hi), opaque));
+    }
+    picasso__blend_span_solid_scalar(dst + i, n - i, src);
+}
+
+PICASSO__TARGET("avx2")
+static void picasso__blend_span_solid_avx2(uint32_t *dst, size_t n, uint32_t src)
+{
+    uint32_t sa = src >> 24;
+    size_t i = 0;
+    __m256i zero   = _mm256_setzero_si256();
+    __m256i opaque = _mm256_set1_epi32((int)0xFF000000u);
+    __m256i m257   = _mm256_set1_epi16(257);
+    __m256i inv    = _mm256_set1_epi16((short)(255 - sa));
+    __m256i s16    = _mm256_unpacklo_epi8(_mm256_set1_epi32((int)src), zero);
+    __m256i bias   = _mm256_add_epi16(_mm256_mullo_epi16(s16, _mm256_set1_epi16((short)sa)), _mm256_set1_epi16(128));
+    for (; i + 8 <= n; i += 8) {
+        __m256i d  = _mm256_loadu_si256((const __m256i *)(dst + i));
+        __m256i lo = _mm256_unpacklo_epi8(d, zero);
+        __m256i hi = _mm256_unpackhi_epi8(d, zero);
+        lo = _mm256_mulhi_epu16(_mm256_add_epi16(_mm256_mullo_epi16(lo, inv), bias), m257);
+        hi = _mm256_mulhi_epu16(_mm256_add_epi16(_mm256_mullo_epi16(hi, inv), bias), m257);
+        _mm256_storeu_si256((__m256i *)(dst + i), _mm256_or_si256(_mm256_packus_epi16(lo, hi), opaque));
+    }
+    picasso__blend_span_solid_sse2(dst + i, n - i, src);
+}
+
+PICASSO__TARGET("avx512f,avx512bw")
+static void picasso__blend_span_solid_avx512(uint32_t *dst, size_t n, uint32_t src)
+{
+    uint32_t sa = src >> 24;
+    size_t i = 0;
+    __m512i zero   = _mm512_setzero_si512();
+    __m512i opaque = _mm512_set1_epi32((int)0xFF000000u);
+    __m512i m257   = _mm512_set1_epi16(257);
+    __m512i inv    = _mm512_set1_epi16((short)(255 - sa));
+    __m512i s16    = _mm512_unpacklo_epi8(_mm512_set1_epi32((int)src), zero);
+    __m512i bias   = _mm512_add_epi16(_mm512_mullo_epi16(s16, _mm512_set1_epi16((short)sa)), _mm512_set1_epi16(128));
+    for (; i + 16 <= n; i += 16) {
+        __m512i d  = _mm512_loadu_si512((const void *)(dst + i));
+        __m512i lo = _mm512_unpacklo_epi8(d, zero);
+        __m512i hi = _mm512_unpackhi_epi8(d, zero);
+        lo = _mm512_mulhi_epu16(_mm512_add_epi16(_mm512_mullo_epi16(lo, inv), bias), m257);
+        hi = _mm512_mulhi_epu16(_mm512_add_epi16(_mm512_mullo_epi16(hi, inv), bias), m257);
+        _mm512_storeu_si512((void *)(dst + i), _mm512_or_si512(_mm512_packus_epi16(lo, hi), opaque));
+    }
+    picasso__blend_span_solid_avx2(dst + i, n - i, src);
+}
+
+// Skips the math for groups of 4 that are all opaque or all clear
+PICASSO__TARGET("sse2")
+static void picasso__blend_span_sse2(uint32_t *dst, const uint8_t *src, size_t n)
+{
+    size_t i = 0;
+    __m128i zero   = _mm_setzero_si128();
+    __m128i alpha  = _mm_set1_epi32((int)0xFF000000u);
+    __m128i m255   = _mm_set1_epi16(255);
+    __m128i m128   = _mm_set1_epi16(128);
+    __m128i m257   = _mm_set1_epi16(257);
+    for (; i + 4 <= n; i += 4) {
+        __m128i s = _mm_loadu_si128((const __m128i *)(src + i * 4));
+        __m128i sa = _mm_and_si128(s, alpha);
+        __m128i clear = _mm_cmpeq_epi32(sa, zero);
+        int opaque = _mm_movemask_epi8(_mm_cmpeq_epi32(sa, alpha));
+
+        if (opaque == 0xFFFF) {
+            _mm_storeu_si128((__m128i *)(dst + i), s);
+            continue;
+        }
+        if (_mm_movemask_epi8(clear) == 0xFFFF) continue;
+
+        __m128i d  = _mm_loadu_si128((const __m128i *)(dst + i));
+        __m128i slo = _mm_unpacklo_epi8(s, zero);
+        __m128i shi = _mm_unpackhi_epi8(s, zero);
+        __m128i alo = _mm_shufflehi_epi16(_mm_shufflelo_epi16(slo, 0xFF), 0xFF);
+        __m128i ahi = _mm_shufflehi_epi16(_mm_shufflelo_epi16(shi, 0xFF), 0xFF);
+        __m128i lo = _mm_add_epi16(_mm_mullo_epi16(slo, alo),
+                                   _mm_mullo_epi16(_mm_unpacklo_epi8(d, zero), _mm_sub_epi16(m255, alo)));
+        __m128i hi = _mm_add_epi16(_mm_mullo_epi16(shi, ahi),
+                                   _mm_mullo_epi16(_mm_unpackhi_epi8(d, zero), _mm_sub_epi16(m255, ahi)));
+        lo = _mm_mulhi_epu16(_mm_add_epi16(lo, m128), m257);
+        hi = _mm_mulhi_epu16(_mm_add_epi16(hi, m128), m257);
+        __m128i out = _mm_or_si128(_mm_packus_epi16(lo, hi), alpha);
+
+        // Fully transparent pixels keep dst untouched, alpha included
+        out = _mm_or_si128(_mm_andnot_si128(clear, out), _mm_and_si128(clear, d));
+        _mm_storeu_si128((__m128i *)(dst + i), out);
+    }
+    picasso__blend_span_scalar(dst + i, src + i * 4, n - i);
+}
+
+// The SSE2 kernel 8 pixels at a time, with the same opaque and clear skips
+PICASSO__TARGET("avx2")
+static void picasso__blend_span_avx2(uint32_t *dst, const uint8_t *src, size_t n)
+{
+    size_t i = 0;
+    __m256i zero   = _mm256_setzero_si256();
+    __m256i alpha  = _mm256_set1_epi32((int)0xFF000000u);
+    __m256i m255   = _mm256_set1_epi16(255);
+    __m256i m128   = _mm256_set1_epi16(128);
+    __m256i m257   = _mm256_set1_epi16(257);
+    for (; i + 8 <= n; i += 8) {
+        __m256i s = _mm256_loadu_si256((const __m256i *)(src + i * 4));
+        __m256i sa = _mm256_and_si256(s, alpha);
+        __m256i clear = _mm256_cmpeq_epi32(sa, zero);
+
+        if (_mm256_movemask_epi8(_mm256_cmpeq_epi32(sa, alpha)) == -1) {
+            _mm256_storeu_si256((__m256i *)(dst + i), s);
+            continue;
+        }
+        if (_mm256_movemask_epi8(clear) == -1) continue;
+
+        __m256i d  = _mm256_loadu_si256((const __m256i *)(dst + i));
+        __m256i slo = _mm256_unpacklo_epi8(s, zero);
+        __m256i shi = _mm256_unpackhi_epi8(s, zero);
+        __m256i alo = _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(slo, 0xFF), 0xFF);
+        __m256i ahi = _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(shi, 0xFF), 0xFF);
+        __m256i lo = _mm256_add_epi16(_mm256_mullo_epi16(slo, alo),
+                                      _mm256_mullo_epi16(_mm256_unpacklo_epi8(d, zero), _mm256_sub_epi16(m255, alo)));
+        __m256i hi = _mm256_add_epi16(_mm256_mullo_epi16(shi, ahi),
+                                      _mm256_mullo_epi16(_mm256_unpackhi_epi8(d, zero), _mm256_sub_epi16(m255, ahi)));
+        lo = _mm256_mulhi_epu16(_mm256_add_epi16(lo, m128), m257);
+        hi = _mm256_mulhi_epu16(_mm256_add_epi16(hi, m128), m257);
+        __m256i out = _mm256_or_si256(_mm256_packus_epi16(lo, hi), alpha);
+
+        // Fully transparent pixels keep dst untouched, alpha included
+        out = _mm256_blendv_epi8(out, d, clear);
+        _mm256_storeu_si256((__m256i *)(dst + i), out);
+    }
+    picasso__blend_span_sse2(dst + i, src + i * 4, n - i);
+}
+
+PICASSO__TARGET("sse2")
+static void picasso__blend_span_solid_premul_sse2(uint32_t *dst, size_t n, uint32_t src)
+{
+    uint32_t sa = src >> 24;
+    size_t i = 0;
+    __m128i zero = _mm_setzero_si128();
+    __m128i m128 = _mm_set1_epi16(128);
+    __m128i m257 = _mm_set1_epi16(257);
+    __m128i inv  = _mm_set1_epi16((short)(255 - sa));
+    __m128i s    = _mm_set1_epi32((int)src);
+    for (; i + 4 <= n; i += 4) {
+        __m128i d  = _mm_loadu_si128((const __m128i *)(dst + i));
+        __m128i lo = _mm_mulhi_epu16(_mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(d, zero), inv), m128), m257);
+        __m128i hi = _mm_mulhi_epu16(_mm_add_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(d, zero), inv), m128), m257);
+        _mm_storeu_si128((__m128i *)(dst + i), _mm_adds_epu8(s, _mm_packus_epi16(lo, hi)));
+    }
+    picasso__blend_span_solid_premul_scalar(dst + i, n - i, src);
+}
+
+PICASSO__TARGET("avx2")
+static void picasso__blend_span_solid_premul_avx2(uint32_t *dst, size_t n, uint32_t src)
+{
+    uint32_t sa = src >> 24;
+    size_t i = 0;
+    __m256i zero = _mm256_setzero_si256();
+    __m256i m128 = _mm256_set1_epi16(128);
+    __m256i m257 = _mm256_set1_epi16(257);
+    __m256i inv  = _mm256_set1_epi16((short)(255 - sa));
+    __m256i s    = _mm256_set1_epi32((int)src);
+    for (; i + 8 <= n; i += 8) {
+        __m256i d  = _mm256_loadu_si256((const __m256i *)(dst + i));
+        __m256i lo = _mm256_mulhi_epu16(_mm256_add_epi16(_mm256_mullo_epi16(_mm256_unpacklo_epi8(d, zero), inv), m128), m257);
+        __m256i hi = _mm256_mulhi_epu16(_mm256_add_epi16(_mm256_mullo_epi16(_mm256_unpackhi_epi8(d, zero), inv), m128), m257);
+        _mm256_storeu_si256((__m256i *)(dst + i), _mm256_adds_epu8(s, _mm256_packus_epi16(lo, hi)));
+    }
+    picasso__blend_span_solid_premul_sse2(dst + i, n - i, src);
+}
+
+PICASSO__TARGET("avx512f,avx512bw")
+static void picasso__blend_span_solid_premul_avx512(uint32_t *dst, size_t n, uint32_t src)
+{
+    uint32_t sa = src >> 24;
+    size_t i = 0;
+    __m512i zero = _mm512_setzero_si512();
+    __m512i m128 = _mm512_set1_epi16(128);
+    __m512i m257 = _mm512_set1_epi16(257);
+    __m512i inv  = _mm512_set1_epi16((short)(255 - sa));
+    __m512i s    = _mm512_set1_epi32((int)src);
+    for (; i + 16 <= n; i += 16) {
+        __m512i d  = _mm512_loadu_si512((const void *)(dst + i));
+        __m512i lo = _mm512_mulhi_epu16(_mm512_add_epi16(_mm512_mullo_epi16(_mm512_unpacklo_epi8(d, zero), inv), m128), m257);
+        __m512i hi = _mm512_mulhi_epu16(_mm512_add_epi16(_mm512_mullo_epi16(_mm512_unpackhi_epi8(d, zero), inv), m128), m257);
+        _mm512_storeu_si512((void *)(dst + i), _mm512_adds_epu8(s, _mm512_packus_epi16(lo, hi)));
+    }
+    picasso__blend_span_solid_premul_avx2(dst + i, n - i, src);
+}
+
+PICASSO__TARGET("sse2")
+static void picasso__blend_span_premul_sse2(uint32_t *dst, const uint8_t *src, size_t n)
+{
+    size_t i = 0;
+    __m128i zero  = _mm_setzero_si128();
+    __m128i alpha = _mm_set1_epi32((int)0xFF000000u);
+    __m128i m255  = _mm_set1_epi16(255);
+    __m128i m128  = _mm_set1_epi16(128);
+    __m128i m257  = _mm_set1_epi16(257);
+    for (; i + 4 <= n; i += 4) {
+        __m128i s = _mm_loadu_si128((const __m128i *)(src + i * 4));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi32(_mm_and_si128(s, alpha), alpha)) == 0xFFFF) {
+            _mm_storeu_si128((__m128i *)(dst + i), s);
+            continue;
+        }
+        if (_mm_movemask_epi8(_mm_cmpeq_epi32(s, zero)) == 0xFFFF) continue;
+
+        __m128i d  = _mm_loadu_si128((const __m128i *)(dst + i));
+        __m128i alo = _mm_shufflehi_epi16(_mm_shufflelo_epi16(_mm_unpacklo_epi8(s, zero), 0xFF), 0xFF);
+        __m128i ahi = _mm_shufflehi_epi16(_mm_shufflelo_epi16(_mm_unpackhi_epi8(s, zero), 0xFF), 0xFF);
+        __m128i lo = _mm_mullo_epi16(_mm_unpacklo_epi8(d, zero), _mm_sub_epi16(m255, alo));
+        __m128i hi = _mm_mullo_epi16(_mm_unpackhi_epi8(d, zero), _mm_sub_epi16(m255, ahi));
+        lo = _mm_mulhi_epu16(_mm_add_epi16(lo, m128), m257);
+        hi = _mm_mulhi_epu16(_mm_add_epi16(hi, m128), m257);
+        _mm_storeu_si128((__m128i *)(dst + i), _mm_adds_epu8(s, _mm_packus_epi16(lo, hi)));
+    }
+    picasso__blend_span_premul_scalar(dst + i, src + i * 4, n - i);
+}
+
+PICASSO__TARGET("avx2")
+static void picasso__blend_span_premul_avx2(uint32_t *dst, const uint8_t *src, size_t n)
+{
+    size_t i = 0;
+    __m256i zero  = _mm256_setzero_si256();
+    __m256i alpha = _mm256_set1_epi32((int)0xFF000000u);
+    __m256i m255  = _mm256_set1_epi16(255);
+    __m256i m128  = _mm256_set1_epi16(128);
+    __m256i m257  = _mm256_set1_epi16(257);
+    for (; i + 8 <= n; i += 8) {
+        __m256i s = _mm256_loadu_si256((const __m256i *)(src + i * 4));
+        if (_mm256_movemask_epi8(_mm256_cmpeq_epi32(_mm256_and_si256(s, alpha), alpha)) == -1) {
+            _mm256_storeu_si256((__m256i *)(dst + i), s);
+            continue;
+        }
+        if (_mm256_testz_si256(s, s)) continue;
+
+        __m256i d  = _mm256_loadu_si256((const __m256i *)(dst + i));
+        __m256i alo = _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(_mm256_unpacklo_epi8(s, zero), 0xFF), 0xFF);
+        __m256i ahi = _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(_mm256_unpackhi_epi8(s, zero), 0xFF), 0xFF);
+        __m256i lo = _mm256_mullo_epi16(_mm256_unpacklo_epi8(d, zero), _mm256_sub_epi16(m255, alo));
+        __m256i hi = _mm256_mullo_epi16(_mm256_unpackhi_epi8(d, zero), _mm256_sub_epi16(m255, ahi));
+        lo = _mm256_mulhi_epu16(_mm256_add_epi16(lo, m128), m257);
+        hi = _mm256_mulhi_epu16(_mm256_add_epi16(hi, m128), m257);
+        _mm256_storeu_si256((__m256i *)(dst + i), _mm256_adds_epu8(s, _mm256_packus_epi16(lo, hi)));
+    }
+    picasso__blend_span_premul_sse2(dst + i, src + i * 4, n - i);
+}
+
+/* Color lanes are multiplied by alpha, the alpha lane by 255, which the
+ * division turns back into alpha */
+PICASSO__TARGET("sse2")
+static void picasso__premultiply_sse2(uint8_t *dst, const uint8_t *src, size_t count)
+{
+    size_t i = 0;
+    __m128i zero  = _mm_setzero_si128();
+    __m128i alpha = _mm_set1_epi32((int)0xFF000000u);
+    __m128i m128  = _mm_set1_epi16(128);
+    __m128i m257  = _mm_set1_epi16(257);
+    __m128i color = _mm_set_epi16(0, -1, -1, -1, 0, -1, -1, -1);
+    __m128i keep  = _mm_set_epi16(255, 0, 0, 0, 255, 0, 0, 0);
+    for (; i + 4 <= count; i += 4) {
+        __m128i s = _mm_loadu_si128((const __m128i *)(src + i * 4));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi32(_mm_and_si128(s, alpha), alpha)) != 0xFFFF) {
+            __m128i lo = _mm_unpacklo_epi8(s, zero);
+            __m128i hi = _mm_unpackhi_epi8(s, zero);
+            __m128i alo = _mm_or_si128(_mm_and_si128(_mm_shufflehi_epi16(_mm_shufflelo_epi16(lo, 0xFF), 0xFF), color), keep);
+            __m128i ahi = _mm_or_si128(_mm_and_si128(_mm_shufflehi_epi16(_mm_shufflelo_epi16(hi, 0xFF), 0xFF), color), keep);
+            lo = _mm_mulhi_epu16(_mm_add_epi16(_mm_mullo_epi16(lo, alo), m128), m257);
+            hi = _mm_mulhi_epu16(_mm_add_epi16(_mm_mullo_epi16(hi, ahi), m128), m257);
+            s = _mm_packus_epi16(lo, hi);
+        }
+        _mm_storeu_si128((__m128i *)(dst + i * 4), s);
+    }
+    picasso__premultiply_scalar(dst + i * 4, src + i * 4, count - i);
+}
+
+// Same rounding as picasso__lerp_pixel, on 16 bit lanes
+PICASSO__TARGET("sse2")
+static inline __m128i picasso__lerp_sse2(__m128i a, __m128i b, __m128i wa, __m128i wb)
+{
+    __m128i t = _mm_add_epi16(_mm_mullo_epi16(a, wa), _mm_mullo_epi16(b, wb));
+    return _mm_srli_epi16(_mm_add_epi16(t, _mm_set1_epi16(128)), 8);
+}
+
+// Pixels p and q of row mixed with their right neighbours, widened to 16 bits
+PICASSO__TARGET("sse2")
+static inline __m128i picasso__lerp_pair_sse2(const uint32_t *row, int32_t p, int32_t q,
+                                              __m128i wa, __m128i wb)
+{
+    // [p, p + 1, q, q + 1] -> [p, q, p + 1, q + 1]
+    __m128i v = _mm_unpacklo_epi64(_mm_loadl_epi64((const __m128i *)(row + p)),
+                                   _mm_loadl_epi64((const __m128i *)(row + q)));
+    v = _mm_shuffle_epi32(v, _MM_SHUFFLE(3, 1, 2, 0));
+    __m128i zero = _mm_setzero_si128();
+    return picasso__lerp_sse2(_mm_unpacklo_epi8(v, zero), _mm_unpackhi_epi8(v, zero), wa, wb);
+}
+
+// Weights of 4 pixels spread over the lanes of their pixels, two per register
+PICASSO__TARGET("sse2")
+static inline void picasso__spread_weights_sse2(const uint16_t *weights, __m128i *lo, __m128i *hi)
+{
+    __m128i w = _mm_loadl_epi64((const __m128i *)weights);
+    w = _mm_unpacklo_epi16(w, w);
+    *lo = _mm_unpacklo_epi32(w, w);
+    *hi = _mm_unpackhi_epi32(w, w);
+}
+
+/* The loads are a gather either way, what the vectors take over is the math,
+ * two pixels per register */
+PICASSO__TARGET("sse2")
+static void picasso__bilinear_row_sse2(uint32_t *dst, const uint32_t *row0, const uint32_t *row1,
+                                       const int32_t *cols, const uint16_t *weights, size_t n, uint32_t wy)
+{
+    size_t i = 0;
+    __m128i m256 = _mm_set1_epi16(256);
+    __m128i wb_y = _mm_set1_epi16((short)wy);
+    __m128i wa_y = _mm_sub_epi16(m256, wb_y);
+    for (; i + 4 <= n; i += 4) {
+        __m128i wb_lo, wb_hi;
+        picasso__spread_weights_sse2(weights + i, &wb_lo, &wb_hi);
+        __m128i wa_lo = _mm_sub_epi16(m256, wb_lo), wa_hi = _mm_sub_epi16(m256, wb_hi);
+        const int32_t *c = cols + i;
+
+        __m128i lo = picasso__lerp_sse2(picasso__lerp_pair_sse2(row0, c[0], c[1], wa_lo, wb_lo),
+                                        picasso__lerp_pair_sse2(row1, c[0], c[1], wa_lo, wb_lo), wa_y, wb_y);
+        __m128i hi = picasso__lerp_sse2(picasso__lerp_pair_sse2(row0, c[2], c[3], wa_hi, wb_hi),
+                                        picasso__lerp_pair_sse2(row1, c[2], c[3], wa_hi, wb_hi), wa_y, wb_y);
+        _mm_storeu_si128((__m128i *)(dst + i), _mm_packus_epi16(lo, hi));
+    }
+    picasso__bilinear_row_scalar(dst + i, row0, row1, cols + i, weights + i, n - i, wy);
+}
+
+PICASSO__TARGET("sse2")
+static void picasso__bilinear_gather_sse2(uint32_t *dst, const uint32_t *texels, size_t stride,
+                                          const int32_t *offsets, const uint16_t *wx,
+                                          const uint16_t *wy, size_t n)
+{
+    size_t i = 0;
+    __m128i m256 = _mm_set1_epi16(256);
+    const uint32_t *below = texels + stride;
+    for (; i + 4 <= n; i += 4) {
+        __m128i bx_lo, bx_hi, by_lo, by_hi;
+        picasso__spread_weights_sse2(wx + i, &bx_lo, &bx_hi);
+        picasso__spread_weights_sse2(wy + i, &by_lo, &by_hi);
+        __m128i ax_lo = _mm_sub_epi16(m256, bx_lo), ax_hi = _mm_sub_epi16(m256, bx_hi);
+        __m128i ay_lo = _mm_sub_epi16(m256, by_lo), ay_hi = _mm_sub_epi16(m256, by_hi);
+        const int32_t *o = offsets + i;
+
+        __m128i lo = picasso__lerp_sse2(picasso__lerp_pair_sse2(texels, o[0], o[1], ax_lo, bx_lo),
+                                        picasso__lerp_pair_sse2(below, o[0], o[1], ax_lo, bx_lo), ay_lo, by_lo);
+        __m128i hi = picasso__lerp_sse2(picasso__lerp_pair_sse2(texels, o[2], o[3], ax_hi, bx_hi),
+                                        picasso__lerp_pair_sse2(below, o[2], o[3], ax_hi, bx_hi), ay_hi, by_hi);
+        _mm_storeu_si128((__m128i *)(dst + i), _mm_packus_epi16(lo, hi));
+    }
+    picasso__bilinear_gather_scalar(dst + i, texels, stride, offsets + i, wx + i, wy + i, n - i);
+}
+
+/* 4 pixels per round from 16 bytes of input, so the loop stops while a full
+ * load still fits */
+PICASSO__TARGET("ssse3")
+static void picasso__rgb_to_rgba_ssse3(uint32_t *dst, const uint8_t *src, size_t n)
+{
+    size_t i = 0;
+    const __m128i expand = _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+    const __m128i alpha = _mm_set1_epi32((int)0xFF000000u);
+    for (; (i + 4) * 3 + 4 <= n * 3; i += 4) {
+        __m128i s = _mm_loadu_si128((const __m128i *)(src + i * 3));
+        _mm_storeu_si128((__m128i *)(dst + i), _mm_or_si128(_mm_shuffle_epi8(s, expand), alpha));
+    }
+    picasso__rgb_to_rgba_scalar(dst + i, src + i * 3, n - i);
+}
+
+/* Three channels go 5 pixels per 16 byte load. The last byte belongs to the
+ * next round and is written back as it was */
+PICASSO__TARGET("ssse3")
+static void picasso__swap_rb_ssse3(uint8_t *pixels, size_t count, int channels)
+{
+    size_t i = 0;
+    if (channels == 4) {
+        const __m128i swap = _mm_setr_epi8(2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15);
+        for (; i + 4 <= count; i += 4) {
+            __m128i *p = (__m128i *)(pixels + i * 4);
+            _mm_storeu_si128(p, _mm_shuffle_epi8(_mm_loadu_si128(p), swap));
+        }
+    } else {
+        const __m128i swap = _mm_setr_epi8(2, 1, 0, 5, 4, 3, 8, 7, 6, 11, 10, 9, 14, 13, 12, 15);
+        for (; i * 3 + 16 <= count * 3; i += 5) {
+            __m128i *p = (__m128i *)(pixels + i * 3);
+            _mm_storeu_si128(p, _mm_shuffle_epi8(_mm_loadu_si128(p), swap));
+        }
+    }
+    picasso__swap_rb_scalar(pixels + i * channels, count - i, channels);
+}
+
+PICASSO__TARGET("avx2")
+static void picasso__swap_rb_avx2(uint8_t *pixels, size_t count, int channels)
+{
+    size_t i = 0;
+    if (channels == 4) {
+        const __m256i swap = _mm256_setr_epi8(2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15,
+                                              2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15);
+        for (; i + 8 <= count; i += 8) {
+            __m256i *p = (__m256i *)(pixels + i * 4);
+            _mm256_storeu_si256(p, _mm256_shuffle_epi8(_mm256_loadu_si256(p), swap));
+        }
+    }
+    picasso__swap_rb_ssse3(pixels + i * channels, count - i, channels);
+}
+#endif // PICASSO__X86
+
+#if defined(__ARM_NEON)
+// No streaming store intrinsic, plain stores it is
+static void picasso__fill_span_neon(uint32_t *dst, size_t n, uint32_t value, bool stream)
+{
+    size_t i = 0;
+    uint32x4_t v = vdupq_n_u32(value);
+    for (; i + 4 <= n; i += 4) vst1q_u32(dst + i, v);
+    picasso__fill_span_scalar(dst + i, n - i, value, stream);
+}
+
+// vaddhn gives (t + (t >> 8)) >> 8, the same division as the x86 kernels
+static void picasso__blend_span_solid_neon(uint32_t *dst, size_t n, uint32_t src)
+{
+    uint32_t sa = src >> 24;
+    size_t i = 0;
+    uint8x16_t s8   = vreinterpretq_u8_u32(vdupq_n_u32(src));
+    uint8x8_t inv   = vdup_n_u8((uint8_t)(255 - sa));
+    uint16x8_t bias = vaddq_u16(vmull_u8(vget_low_u8(s8), vdup_n_u8((uint8_t)sa)), vdupq_n_u16(128));
+    uint32x4_t opaque = vdupq_n_u32(0xFF000000u);
+    for (; i + 4 <= n; i += 4) {
+        uint8x16_t d = vreinterpretq_u8_u32(vld1q_u32(dst + i));
+        uint16x8_t lo = vmlal_u8(bias, vget_low_u8(d), inv);
+        uint16x8_t hi = vmlal_u8(bias, vget_high_u8(d), inv);
+        uint8x16_t out = vcombine_u8(vaddhn_u16(lo, vshrq_n_u16(lo, 8)),
+                                     vaddhn_u16(hi, vshrq_n_u16(hi, 8)));
+        vst1q_u32(dst + i, vorrq_u32(vreinterpretq_u32_u8(out), opaque));
+    }
+    picasso__blend_span_solid_scalar(dst + i, n - i, src);
+}
+
+static void picasso__blend_span_solid_premul_neon(uint32_t *dst, size_t n, uint32_t src)
+{
+    uint32_t sa = src >> 24;
+    size_t i = 0;
+    uint8x16_t s   = vreinterpretq_u8_u32(vdupq_n_u32(src));
+    uint8x8_t inv  = vdup_n_u8((uint8_t)(255 - sa));
+    uint16x8_t m128 = vdupq_n_u16(128);
+    for (; i + 4 <= n; i += 4) {
+        uint8x16_t d = vreinterpretq_u8_u32(vld1q_u32(dst + i));
+        uint16x8_t lo = vmlal_u8(m128, vget_low_u8(d), inv);
+        uint16x8_t hi = vmlal_u8(m128, vget_high_u8(d), inv);
+        uint8x16_t out = vcombine_u8(vaddhn_u16(lo, vshrq_n_u16(lo, 8)), vaddhn_u16(hi, vshrq_n_u16(hi, 8)));
+        vst1q_u32(dst + i, vreinterpretq_u32_u8(vqaddq_u8(s, out)));
+    }
+    picasso__blend_span_solid_premul_scalar(dst + i, n - i, src);
+}
+
+static void picasso__swap_rb_neon(uint8_t *pixels, size_t count, int channels)
+{
+    size_t i = 0;
+    if (channels == 4) {
+        for (; i + 16 <= count; i += 16) {
+            uint8x16x4_t px = vld4q_u8(pixels + i * 4);
+            uint8x16_t r = px.val[0];
+            px.val[0] = px.val[2];
+            px.val[2] = r;
+            vst4q_u8(pixels + i * 4, px);
+        }
+    } else {
+        for (; i + 16 <= count; i += 16) {
+            uint8x16x3_t px = vld3q_u8(pixels + i * 3);
+            uint8x16_t r = px.val[0];
+            px.val[0] = px.val[2];
+            px.val[2] = r;
+            vst3q_u8(pixels + i * 3, px);
+        }
+    }
+    picasso__swap_rb_scalar(pixels + i * channels, count - i, channels);
+}
+
+#if defined(__aarch64__)
+// Per pixel alpha needs table lookups and across-vector reductions, aarch64 only
+static void picasso__blend_span_neon(uint32_t *dst, const uint8_t *src, size_t n)
+{
+    size_t i = 0;
+    uint32x4_t alpha = vdupq_n_u32(0xFF000000u);
+    uint16x8_t m128 = vdupq_n_u16(128);
+    uint8x8_t  idx_lo = { 3, 3, 3, 3, 7, 7, 7, 7 };
+    uint8x8_t  idx_hi = { 11, 11, 11, 11, 15, 15, 15, 15 };
+    for (; i + 4 <= n; i += 4) {
+        uint32x4_t s = vreinterpretq_u32_u8(vld1q_u8(src + i * 4));
+        uint32x4_t sa = vandq_u32(s, alpha);
+        uint32x4_t clear = vceqq_u32(sa, vdupq_n_u32(0));
+
+        if (vminvq_u32(vceqq_u32(sa, alpha))) {
+            vst1q_u32(dst + i, s);
+            continue;
+        }
+        if (vminvq_u32(clear)) continue;
+
+        uint32x4_t d32 = vld1q_u32(dst + i);
+        uint8x16_t s8 = vreinterpretq_u8_u32(s);
+        uint8x16_t d8 = vreinterpretq_u8_u32(d32);
+        uint8x8_t alo = vqtbl1_u8(s8, idx_lo);
+        uint8x8_t ahi = vqtbl1_u8(s8, idx_hi);
+        uint16x8_t lo = vmlal_u8(vmlal_u8(m128, vget_low_u8(s8), alo), vget_low_u8(d8), vmvn_u8(alo));
+        uint16x8_t hi = vmlal_u8(vmlal_u8(m128, vget_high_u8(s8), ahi), vget_high_u8(d8), vmvn_u8(ahi));
+        uint32x4_t out = vreinterpretq_u32_u8(vcombine_u8(vaddhn_u16(lo, vshrq_n_u16(lo, 8)),
+                                                          vaddhn_u16(hi, vshrq_n_u16(hi, 8))));
+        out = vbslq_u32(clear, d32, vorrq_u32(out, alpha));
+        vst1q_u32(dst + i, out);
+    }
+    picasso__blend_span_scalar(dst + i, src + i * 4, n - i);
+}
+
+static void picasso__blend_span_premul_neon(uint32_t *dst, const uint8_t *src, size_t n)
+{
+    size_t i = 0;
+    uint32x4_t alpha = vdupq_n_u32(0xFF000000u);
+    uint16x8_t m128 = vdupq_n_u16(128);
+    uint8x8_t  idx_lo = { 3, 3, 3, 3, 7, 7, 7, 7 };
+    uint8x8_t  idx_hi = { 11, 11, 11, 11, 15, 15, 15, 15 };
+    for (; i + 4 <= n; i += 4) {
+        uint8x16_t s8 = vld1q_u8(src + i * 4);
+        uint32x4_t s = vreinterpretq_u32_u8(s8);
+        if (vminvq_u32(vceqq_u32(vandq_u32(s, alpha), alpha))) {
+            vst1q_u32(dst + i, s);
+            continue;
+        }
+        if (vmaxvq_u32(s) == 0) continue;
+
+        uint8x16_t d8 = vreinterpretq_u8_u32(vld1q_u32(dst + i));
+        uint16x8_t lo = vmlal_u8(m128, vget_low_u8(d8), vmvn_u8(vqtbl1_u8(s8, idx_lo)));
+        uint16x8_t hi = vmlal_u8(m128, vget_high_u8(d8), vmvn_u8(vqtbl1_u8(s8, idx_hi)));
+        uint8x16_t out = vcombine_u8(vaddhn_u16(lo, vshrq_n_u16(lo, 8)), vaddhn_u16(hi, vshrq_n_u16(hi, 8)));
+        vst1q_u32(dst + i, vreinterpretq_u32_u8(vqaddq_u8(s8, out)));
+    }
+    picasso__blend_span_premul_scalar(dst + i, src + i * 4, n - i);
+}
+#endif // __aarch64__
+#endif // __ARM_NEON
+
+/* One table per instruction set. Each starts from the one below it and
+ * replaces only the kernels it has something better for */
+static const picasso__kernel_table picasso__kernels_scalar = {
+    .level                   = PICASSO_SIMD_SCALAR,
+    .fill_span               = picasso__fill_span_scalar,
+    .blend_span_solid        = picasso__blend_span_solid_scalar,
+    .blend_span              = picasso__blend_span_scalar,
+    .blend_span_solid_premul = picasso__blend_span_solid_premul_scalar,
+    .blend_span_premul       = picasso__blend_span_premul_scalar,
+    .premultiply             = picasso__premultiply_scalar,
+    .rgba_to_rgb             = picasso__rgba_to_rgb_scalar,
+    .rgb_to_rgba             = picasso__rgb_to_rgba_scalar,
+    .swap_rb                 = picasso__swap_rb_scalar,
+    .bilinear_row            = picasso__bilinear_row_scalar,
+    .bilinear_gather         = picasso__bilinear_gather_scalar,
+};
+
+#if PICASSO__X86
+static const picasso__kernel_table picasso__kernels_sse2 = {
+    .level                   = PICASSO_SIMD_SSE2,
+    .fill_span               = picasso__fill_span_sse2,
+    .blend_span_solid        = picasso__blend_span_solid_sse2,
+    .blend_span              = picasso__blend_span_sse2,
+    .blend_span_solid_premul = picasso__blend_span_solid_premul_sse2,
+    .blend_span_premul       = picasso__blend_span_premul_sse2,
+    .premultiply             = picasso__premultiply_sse2,
+    .rgba_to_rgb             = picasso__rgba_to_rgb_scalar,
+    .rgb_to_rgba             = picasso__rgb_to_rgba_scalar,
+    .swap_rb                 = picasso__swap_rb_scalar,
+    .bilinear_row            = picasso__bilinear_row_sse2,
+    .bilinear_gather         = picasso__bilinear_gather_sse2,
+};
+
+static const picasso__kernel_table picasso__kernels_ssse3 = {
+    .level                   = PICASSO_SIMD_SSSE3,
+    .fill_span               = picasso__fill_span_sse2,
+    .blend_span_solid        = picasso__blend_span_solid_sse2,
+    .blend_span              = picasso__blend_span_sse2,
+    .blend_span_solid_premul = picasso__blend_span_solid_premul_sse2,
+    .blend_span_premul       = picasso__blend_span_premul_sse2,
+    .premultiply             = picasso__premultiply_sse2,
+    .rgba_to_rgb             = picasso__rgba_to_rgb_ssse3,
+    .rgb_to_rgba             = picasso__rgb_to_rgba_ssse3,
+    .swap_rb                 = picasso__swap_rb_ssse3,
+    .bilinear_row            = picasso__bilinear_row_sse2,
+    .bilinear_gather         = picasso__bilinear_gather_sse2,
+};
+
+static const picasso__kernel_table picasso__kernels_avx2 = {
+    .level                   = PICASSO_SIMD_AVX2,
+    .fill_span               = picasso__fill_span_avx2,
+    .blend_span_solid        = picasso__blend_span_solid_avx2,
+    .blend_span              = picasso__blend_span_avx2,
+    .blend_span_solid_premul = picasso__blend_span_solid_premul_avx2,
+    .blend_span_premul       = picasso__blend_span_premul_avx2,
+    .premultiply             = picasso__premultiply_sse2,
+    .rgba_to_rgb             = picasso__rgba_to_rgb_ssse3,
+    .rgb_to_rgba             = picasso__rgb_to_rgba_ssse3,
+    .swap_rb                 = picasso__swap_rb_avx2,
+    .bilinear_row            = picasso__bilinear_row_sse2,
+    .bilinear_gather         = picasso__bilinear_gather_sse2,
+};
+
+static const picasso__kernel_table picasso__kernels_avx512 = {
+    .level                   = PICASSO_SIMD_AVX512,
+    .fill_span               = picasso__fill_span_avx512,
+    .blend_span_solid        = picasso__blend_span_solid_avx512,
+    .blend_span              = picasso__blend_span_avx2,
+    .blend_span_solid_premul = picasso__blend_span_solid_premul_avx512,
+    .blend_span_premul       = picasso__blend_span_premul_avx2,
+    .premultiply             = picasso__premultiply_sse2,
+    .rgba_to_rgb             = picasso__rgba_to_rgb_ssse3,
+    .rgb_to_rgba             = picasso__rgb_to_rgba_ssse3,
+    .swap_rb                 = picasso__swap_rb_avx2,
+    .bilinear_row            = picasso__bilinear_row_sse2,
+    .bilinear_gather         = picasso__bilinear_gather_sse2,
+};
+#endif
+
+#if defined(__ARM_NEON)
+static const picasso__kernel_table picasso__kernels_neon = {
+    .level                   = PICASSO_SIMD_NEON,
+    .fill_span               = picasso__fill_span_neon,
+    .blend_span_solid        = picasso__blend_span_solid_neon,
+    .blend_span_solid_premul = picasso__blend_span_solid_premul_neon,
+#if defined(__aarch64__)
+    .blend_span              = picasso__blend_span_neon,
+    .blend_span_premul       = picasso__blend_span_premul_neon,
+#else
+    .blend_span              = picasso__blend_span_scalar,
+    .blend_span_premul       = picasso__blend_span_premul_scalar,
+#endif
+    .premultiply             = picasso__premultiply_scalar,
+    .rgba_to_rgb             = picasso__rgba_to_rgb_neon,
+    .rgb_to_rgba             = picasso__rgb_to_rgba_scalar,
+    .swap_rb                 = picasso__swap_rb_neon,
+    .bilinear_row            = picasso__bilinear_row_scalar,
+    .bilinear_gather         = picasso__bilinear_gather_scalar,
+};
+#endif
+
+// NULL when this build has no kernels for level
+static const picasso__kernel_table *picasso__kernels_for(picasso_simd_level level)
+{
+    switch (level) {
+    case PICASSO_SIMD_SCALAR: return &picasso__kernels_scalar;
+#if PICASSO__X86
+    case PICASSO_SIMD_SSE2:   return &picasso__kernels_sse2;
+    case PICASSO_SIMD_SSSE3:  return &picasso__kernels_ssse3;
+    case PICASSO_SIMD_AVX2:   return &picasso__kernels_avx2;
+    case PICASSO_SIMD_AVX512: return &picasso__kernels_avx512;
+#endif
+#if defined(__ARM_NEON)
+    case PICASSO_SIMD_NEON:   return &picasso__kernels_neon;
+#endif
+    default: return NULL;
+    }
+}
+
+static bool picasso__cpu_supports(picasso_simd_level level)
+{
+    if (!picasso__kernels_for(level)) return false;
+#if PICASSO__X86
+    __builtin_cpu_init();
+    switch (level) {
+    case PICASSO_SIMD_SSE2:   return __builtin_cpu_supports("sse2");
+    case PICASSO_SIMD_SSSE3:  return __builtin_cpu_supports("ssse3");
+    case PICASSO_SIMD_AVX2:   return __builtin_cpu_supports("avx2");
+    case PICASSO_SIMD_AVX512: return __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw");
+    default: break;
+    }
+#elif defined(__ARM_NEON) && defined(__linux__) && defined(__aarch64__)
+    if (level == PICASSO_SIMD_NEON) return (getauxval(AT_HWCAP) & HWCAP_ASIMD) != 0;
+#elif defined(__ARM_NEON) && defined(__linux__) && defined(HWCAP_NEON)
+    if (level == PICASSO_SIMD_NEON) return (getauxval(AT_HWCAP) & HWCAP_NEON) != 0;
+#endif
+    return true;
+}
+
+static const char *const picasso__simd_names[PICASSO_SIMD_LEVEL_COUNT] = {
+    [PICASSO_SIMD_SCALAR] = "scalar",
+    [PICASSO_SIMD_SSE2]   = "sse2",
+    [PICASSO_SIMD_SSSE3]  = "ssse3",
+    [PICASSO_SIMD_AVX2]   = "avx2",
+    [PICASSO_SIMD_AVX512] = "avx512",
+    [PICASSO_SIMD_NEON]   = "neon",
+};
+
+const char *picasso_simd_level_name(picasso_simd_level level)
+{
+    if ((unsigned)level >= PICASSO_SIMD_LEVEL_COUNT) return "unknown";
+    return picasso__simd_names[level];
+}
+
+picasso_simd_level picasso_get_best_simd_level(void)
+{
+    for (int level = PICASSO_SIMD_LEVEL_COUNT - 1; level > PICASSO_SIMD_SCALAR; --level) {
+        if (picasso__cpu_supports((picasso_simd_level)level)) return (picasso_simd_level)level;
+    }
+    return PICASSO_SIMD_SCALAR;
+}
+
+/* Runs on first use. Racing threads all come to the same answer, so whoever
+ * stores last changes nothing */
+static const picasso__kernel_table *picasso__select_kernels(void)
+{
+    picasso_simd_level level = picasso_get_best_simd_level();
+    const char *env = getenv("PICASSO_SIMD");
+
+    if (env && *env) {
+        int wanted = -1;
+        for (int i = 0; i < PICASSO_SIMD_LEVEL_COUNT; ++i) {
+            if (strcmp(env, picasso__simd_names[i]) == 0) wanted = i;
+        }
+        if (wanted < 0) {
+            WARN("PICASSO_SIMD=%s is not a known kernel set, using %s", env, picasso__simd_names[level]);
+        } else if (!picasso__cpu_supports((picasso_simd_level)wanted)) {
+            WARN("PICASSO_SIMD=%s is not supported here, using %s", env, picasso__simd_names[level]);
+        } else {
+            level = (picasso_simd_level)wanted;
+        }
+    }
+
+    const picasso__kernel_table *k = picasso__kernels_for(level);
+    atomic_store_explicit(&picasso__active_kernels, k, memory_order_release);
+    INFO("Pixel kernels: %s", picasso__simd_names[level]);
+    return k;
+}
+
+picasso_simd_level picasso_get_simd_level(void)
+{
+    return picasso__kernels()->level;
+}
+
+bool picasso_set_simd_level(picasso_simd_level level)
+{
+    if ((unsigned)level >= PICASSO_SIMD_LEVEL_COUNT || !picasso__cpu_supports(level)) {
+        WARN("Kernel set %s is not supported here", picasso_simd_level_name(level));
+        return false;
+    }
+    atomic_store_explicit(&picasso__active_kernels, picasso__kernels_for(level), memory_order_release);
+    return true;
+}
+
+/* The entry points everything else uses. Cases that need no math at all are
+ * handled here once, instead of in every kernel */
+
+// memset when all four bytes are the same
+static void picasso__fill_span(uint32_t *dst, size_t n, uint32_t value, bool stream)
+{
+    uint8_t b = value & 0xFF;
+    if (value == 0x01010101u * b) {
+        memset(dst, b, n * sizeof(uint32_t));
+        return;
+    }
+    picasso__kernels()->fill_span(dst, n, value, stream);
+}
+
+// Once after the last streaming picasso__fill_span of a band
+static void picasso__stream_fence(void)
+{
+#if PICASSO__X86
+    picasso__stream_fence_sse2();
+#endif
+}
+
+/* Span blends. Every primitive ends up here with a run of pixels in one
+ * row, either under one color or under a row of source pixels */
+
+// Blends one color over n pixels
+static void picasso__blend_span_solid(uint32_t *dst, size_t n, uint32_t src)
+{
+    uint32_t sa = src >> 24;
+    if (sa == 0) return;
+    if (sa == 255) {
+        picasso__fill_span(dst, n, src, false);
+        return;
+    }
+    picasso__kernels()->blend_span_solid(dst, n, src);
+}
+
+// Blends n packed RGBA source pixels over dst, src does not need to be aligned
+static inline void picasso__blend_span(uint32_t *dst, const uint8_t *src, size_t n)
+{
+    picasso__kernels()->blend_span(dst, src, n);
+}
+
+// Blends one premultiplied color over n pixels
+static void picasso__blend_span_solid_premul(uint32_t *dst, size_t n, uint32_t src)
+{
+    if (src == 0) return;
+    if ((src >> 24) == 255) {
+        picasso__fill_span(dst, n, src, false);
+        return;
+    }
+    picasso__kernels()->blend_span_solid_premul(dst, n, src);
+}
+
+// Blends n premultiplied RGBA source pixels over dst
+static inline void picasso__blend_span_premul(uint32_t *dst, const uint8_t *src, size_t n)
+{
+    picasso__kernels()->blend_span_premul(dst, src, n);
+}
+
+static inline void picasso__copy_rgb_span(uint32_t *dst, const uint8_t *src, size_t n)
+{
+    picasso__kernels()->rgb_to_rgba(dst, src, n);
+}
+
+void picasso_premultiply_pixels(uint8_t *dst, const uint8_t *src, size_t count)
+{
+    picasso__kernels()->premultiply(dst, src, count);
+}
+
+void picasso_swap_rb(uint8_t *pixels, size_t count, int channels)
+{
+    if (channels != 3 && channels != 4) return;
+    picasso__kernels()->swap_rb(pixels, count, channels);
+}
+
+// Rounded back to nearest, clamped for pixels that were never valid premultiplied
+void picasso_unpremultiply_pixels(uint8_t *dst, const uint8_t *src, size_t count)
+{
+    for (size_t i = 0; i < count; ++i, src += 4, dst += 4) {
+        uint32_t a = src[3];
+        if (a == 255) {
+            memmove(dst, src, 4);
+            continue;
+        }
+        if (a == 0) {
+            memset(dst, 0, 4);
+            continue;
+        }
+        for (int c = 0; c < 3; ++c) {
+            uint32_t v = (src[c] * 255u + a / 2) / a;
+            dst[c] = (uint8_t)(v > 255 ? 255 : v);
+        }
+        dst[3] = (uint8_t)a;
+    }
+}
+
+// floor(sqrt(v)) for v >= 0, bit by bit, no libm
+static inline int picasso__isqrt(int v)
+{
+    uint32_t x = (uint32_t)v, r = 0, bit = 1u << 30;
+    while (bit > x) bit >>= 2;
+    while (bit) {
+        if (x >= r + bit) {
+            x -= r + bit;
+            r = (r >> 1) + bit;
+        } else {
+            r >>= 1;
+        }
+        bit >>= 2;
+    }
+    return (int)r;
+}
+
+/* Blend modes. Every mode works on premultiplied values and applies the same
+ * operator to all four channels, s and d are one channel of source and
+ * destination, sa and da their alphas. Straight inputs are premultiplied on
+ * load and a straight destination is converted back on store, so layers with
+ * real alpha compose correctly whichever way they are stored */
+#define PICASSO__MUL(a, b) picasso__div255((a) * (b))
+
+#define PICASSO__OP_ADD(s, d, sa, da)      ((s) + (d))
+#define PICASSO__OP_MULTIPLY(s, d, sa, da) (PICASSO__MUL(s, d) + PICASSO__MUL(s, 255 - (da)) + PICASSO__MUL(d, 255 - (sa)))
+#define PICASSO__OP_SCREEN(s, d, sa, da)   ((s) + (d) - PICASSO__MUL(s, d))
+#define PICASSO__OP_DARKEN(s, d, sa, da)   (PICASSO_MIN(PICASSO__MUL(s, da), PICASSO__MUL(d, sa)) + \
+                                            PICASSO__MUL(s, 255 - (da)) + PICASSO__MUL(d, 255 - (sa)))
+#define PICASSO__OP_LIGHTEN(s, d, sa, da)  (PICASSO_MAX(PICASSO__MUL(s, da), PICASSO__MUL(d, sa)) + \
+                                            PICASSO__MUL(s, 255 - (da)) + PICASSO__MUL(d, 255 - (sa)))
+#define PICASSO__OP_OVER(s, d, sa, da)     ((s) + PICASSO__MUL(d, 255 - (sa)))
+#define PICASSO__OP_IN(s, d, sa, da)       PICASSO__MUL(s, da)
+#define PICASSO__OP_OUT(s, d, sa, da)      PICASSO__MUL(s, 255 - (da))
+#define PICASSO__OP_XOR(s, d, sa, da)      (PICASSO__MUL(s, 255 - (da)) + PICASSO__MUL(d, 255 - (sa)))
+
+#define PICASSO__BLEND_CHANNEL(OP, s, d, sa, da, shift) \
+    PICASSO_MIN(OP(((s) >> (shift)) & 0xFF, ((d) >> (shift)) & 0xFF, sa, da), 255u) << (shift)
+
+/* n destination pixels against a source advancing step bytes per pixel,
+ * step 0 repeats one pixel for solid fills. One function is generated per
+ * mode and alpha kind, the mode never gets looked at inside the loop */
+typedef void (*picasso__blend_fn)(uint32_t *dst, const uint8_t *src, size_t step, size_t n);
+
+#define PICASSO__BLEND_KERNEL(NAME, OP, SRC_PREMUL, DST_PREMUL)                       \
+static void NAME(uint32_t *dst, const uint8_t *src, size_t step, size_t n)           \
+{                                                                                    \
+    for (size_t i = 0; i < n; ++i, src += step) {                                    \
+        uint32_t s, d = dst[i];                                                      \
+        memcpy(&s, src, 4);                                                          \
+        if (!(SRC_PREMUL)) s = picasso__premultiply(s);                              \
+        if (!(DST_PREMUL)) d = picasso__premultiply(d);                              \
+        uint32_t sa = s >> 24, da = d >> 24;                                         \
+        (void)sa; (void)da; /* not every operator looks at both */                 \
+        uint32_t out = PICASSO__BLEND_CHANNEL(OP, s, d, sa, da, 0)  |                \
+                       PICASSO__BLEND_CHANNEL(OP, s, d, sa, da, 8)  |                \
+                       PICASSO__BLEND_CHANNEL(OP, s, d, sa, da, 16) |                \
+                       PICASSO__BLEND_CHANNEL(OP, s, d, sa, da, 24);                 \
+        dst[i] = (DST_PREMUL) ? out : picasso__unpremultiply(out);                   \
+    }                                                                                \
+}
+
+#define PICASSO__BLEND_KERNELS(name, OP)                                              \
+    PICASSO__BLEND_KERNEL(picasso__blend_##name##_ss, OP, 0, 0)                      \
+    PICASSO__BLEND_KERNEL(picasso__blend_##name##_sp, OP, 0, 1)                      \
+    PICASSO__BLEND_KERNEL(picasso__blend_##name##_ps, OP, 1, 0)                      \
+    PICASSO__BLEND_KERNEL(picasso__blend_##name##_pp, OP, 1, 1)
+
+PICASSO__BLEND_KERNELS(add,      PICASSO__OP_ADD)
+PICASSO__BLEND_KERNELS(multiply, PICASSO__OP_MULTIPLY)
+PICASSO__BLEND_KERNELS(screen,   PICASSO__OP_SCREEN)
+PICASSO__BLEND_KERNELS(darken,   PICASSO__OP_DARKEN)
+PICASSO__BLEND_KERNELS(lighten,  PICASSO__OP_LIGHTEN)
+PICASSO__BLEND_KERNELS(over,     PICASSO__OP_OVER)
+PICASSO__BLEND_KERNELS(in,       PICASSO__OP_IN)
+PICASSO__BLEND_KERNELS(out,      PICASSO__OP_OUT)
+PICASSO__BLEND_KERNELS(xor,      PICASSO__OP_XOR)
+
+#define PICASSO__BLEND_ROW(name) \
+    { { picasso__blend_##name##_ss, picasso__blend_##name##_sp }, \
+      { picasso__blend_##name##_ps, picasso__blend_##name##_pp } }
+
+/* [mode][source premultiplied][destination premultiplied]. NORMAL keeps the
+ * fast paths and COPY is a plain copy, neither has a kernel here */
+static const picasso__blend_fn picasso__blend_kernels[PICASSO_BLEND_MODE_COUNT][2][2] = {
+    [PICASSO_BLEND_ADD]      = PICASSO__BLEND_ROW(add),
+    [PICASSO_BLEND_MULTIPLY] = PICASSO__BLEND_ROW(multiply),
+    [PICASSO_BLEND_SCREEN]   = PICASSO__BLEND_ROW(screen),
+    [PICASSO_BLEND_DARKEN]   = PICASSO__BLEND_ROW(darken),
+    [PICASSO_BLEND_LIGHTEN]  = PICASSO__BLEND_ROW(lighten),
+    [PICASSO_BLEND_OVER]     = PICASSO__BLEND_ROW(over),
+    [PICASSO_BLEND_IN]       = PICASSO__BLEND_ROW(in),
+    [PICASSO_BLEND_OUT]      = PICASSO__BLEND_ROW(out),
+    [PICASSO_BLEND_XOR]      = PICASSO__BLEND_ROW(xor),
+};
+
+/* Blends color over [x0, x1) of row, clipped to [lo, hi). With premul the
+ * color must already be premultiplied, see picasso__solid_pixel */
+static inline void picasso__blend_clipped(uint32_t *row, int x0, int x1, int lo, int hi,
+                                          uint32_t color, bool premul)
+{
+    x0 = PICASSO_MAX(x0, lo);
+    x1 = PICASSO_MIN(x1, hi);
+    if (x0 >= x1) return;
+    if (premul) picasso__blend_span_solid_premul(row + x0, (size_t)(x1 - x0), color);
+    else        picasso__blend_span_solid(row + x0, (size_t)(x1 - x0), color);
+}
+
+// A color ready for the solid kernels of bf
+static inline uint32_t picasso__solid_pixel(const picasso_backbuffer *bf, color c)
+{
+    uint32_t px = color_to_u32(c);
+    return bf->premultiplied ? picasso__premultiply(px) : px;
+}
+
+static inline bool picasso__valid_blend_mode(picasso_blend_mode mode)
+{
+    if ((unsigned)mode < PICASSO_BLEND_MODE_COUNT) return true;
+    WARN("Unknown blend mode %d", (int)mode);
+    return false;
+}
+
+/* Solid color and kernel for drawing c into bf with mode. The blend kernels
+ * always take a premultiplied color, the NORMAL paths follow bf */
+static inline void picasso__solid_blend(const picasso_backbuffer *bf, color c, picasso_blend_mode mode,
+                                        uint32_t *pixel, picasso__blend_fn *blend)
+{
+    *blend = picasso__blend_kernels[mode][1][bf->premultiplied];
+    *pixel = *blend ? picasso__premultiply(color_to_u32(c)) : picasso__solid_pixel(bf, c);
+}
+
+/* Where a scaled blit reads its source. Positions are 16.16 fixed point.
+ * Columns are worked out once per call for the visible part of the target,
+ * rows as the bands get to them */
+typedef struct {
+    int x, y;                 // top left corner of the whole target rect
+    int64_t step_x, step_y;   // source pixels per target pixel
+    bool bilinear;
+    const int32_t *cols;      // from bounds.x0 on: source byte offset, or left neighbour minus lo
+    const uint16_t *weights;  // bilinear share of the right neighbour, 0 to 256
+    int lo, hi;               // bilinear source columns in use
+} picasso__scale_map;
+
+/* Inverse of a blit_affine matrix in 16.16 fixed point: where in the source
+ * the center of each target pixel lands */
+typedef struct {
+    int64_t u0, v0;           // source position of target pixel 0, 0
+    int64_t du_dx, dv_dx;     // one pixel right
+    int64_t du_dy, dv_dy;     // one row down
+    const uint32_t *texels;   // bilinear: premultiplied source, last column and row repeated
+} picasso__affine_map;
+
+/* Big primitives are split into bands of rows and run on the thread pool.
+ * Rows never overlap, so bands need no locking. Everything a band needs is
+ * in one job, already clipped, damage is recorded before splitting */
+typedef struct {
+    picasso_backbuffer *bf;
+    picasso_draw_bounds bounds;
+    uint32_t pixel;
+    int cx, cy;               // circle center, or where the blit source starts
+    int min_d2, max_d2;       // circle pixels have a squared distance in this range
+    const picasso_view *src;
+    bool stream;
+    bool premul;              // bf holds premultiplied alpha, pixel is premultiplied too
+    picasso__blend_fn blend;  // NULL for PICASSO_BLEND_NORMAL, pixel is then premultiplied
+    const picasso_prepared_sprite *sprite;
+    bool copy;                // PICASSO_BLEND_COPY, pixel is in the format of bf
+    bool flip_x;              // blit source rows are read right to left
+    const color *tint;        // multiplies blit source pixels, NULL leaves them alone
+    const picasso_tilemap *tilemap; // map pixel 0, 0 lands on cx, cy
+    const picasso__scale_map *scale;
+    const picasso__affine_map *affine;
+} picasso__span_job;
+
+typedef void (*picasso__rows_fn)(const picasso__span_job *job, int y0, int y1);
+
+typedef struct {
+    picasso__rows_fn fn;
+    const picasso__span_job *job;
+    int rows_per_band;
+} picasso__band_task;
+
+static void picasso__run_band(void *user, int index)
+{
+    const picasso__band_task *task = user;
+    int y0 = task->job->bounds.y0 + index * task->rows_per_band;
+    int y1 = PICASSO_MIN(y0 + task->rows_per_band, task->job->bounds.y1);
+    task->fn(task->job, y0, y1);
+}
+
+static void picasso__for_each_band(picasso__rows_fn fn, const picasso__span_job *job)
+{
+    int rows = job->bounds.y1 - job->bounds.y0;
+    size_t pixels = (size_t)(job->bounds.x1 - job->bounds.x0) * rows;
+    int threads;
+
+    if (rows < 2 || pixels < picasso_get_parallel_threshold() ||
+        (threads = picasso_get_thread_count()) <= 1) {
+        fn(job, job->bounds.y0, job->bounds.y1);
+        return;
+    }
+
+    // A few bands per thread, so one slow band does not hold everyone up
+    int bands = PICASSO_MIN(rows, threads * 4);
+    picasso__band_task task = { fn, job, (rows + bands - 1) / bands };
+    bands = (rows + task.rows_per_band - 1) / task.rows_per_band;
+    picasso_parallel_for(bands, picasso__run_band, &task);
+}
+
+// One solid span of a job, clipped to its bounds
+static inline void picasso__job_span(const picasso__span_job *job, uint32_t *row, int x0, int x1)
+{
+    if (job->copy) {
+        x0 = PICASSO_MAX(x0, job->bounds.x0);
+        x1 = PICASSO_MIN(x1, job->bounds.x1);
+        if (x0 < x1) picasso__fill_span(row + x0, (size_t)(x1 - x0), job->pixel, false);
+        return;
+    }
+    if (!job->blend) {
+        picasso__blend_clipped(row, x0, x1, job->bounds.x0, job->bounds.x1, job->pixel, job->premul);
+        return;
+    }
+    x0 = PICASSO_MAX(x0, job->bounds.x0);
+    x1 = PICASSO_MIN(x1, job->bounds.x1);
+    if (x0 < x1) job->blend(row + x0, (const uint8_t *)&job->pixel, 0, (size_t)(x1 - x0));
+}
+
+static void picasso__fill_rows(const picasso__span_job *job, int y0, int y1)
+{
+    for (int y = y0; y < y1; ++y) {
+        picasso__job_span(job, picasso__row(job->bf, y), job->bounds.x0, job->bounds.x1);
+    }
+}
+
+static void picasso__clear_rows(const picasso__span_job *job, int y0, int y1)
+{
+    picasso_backbuffer *bf = job->bf;
+    size_t span = (size_t)(job->bounds.x1 - job->bounds.x0);
+
+    // Whole rows of an unpadded buffer are one contiguous run
+    if (span == bf->width && bf->pitch == span * sizeof(uint32_t)) {
+        picasso__fill_span(picasso__row(bf, y0), span * (size_t)(y1 - y0), job->pixel, job->stream);
+    } else {
+        for (int y = y0; y < y1; ++y) {
+            picasso__fill_span(picasso__row(bf, y) + job->bounds.x0, span, job->pixel, job->stream);
+        }
+    }
+    if (job->stream) picasso__stream_fence();
+}
+
+/* Each row of a circle or ring is at most two spans. Pixels with
+ * min_d2 <= dx^2 + dy^2 <= max_d2 are drawn, so the outer edge is at
+ * |dx| <= isqrt(max_d2 - dy^2) and the hole at |dx| <= isqrt(min_d2 - dy^2 - 1) */
+static void picasso__circle_rows(const picasso__span_job *job, int y0, int y1)
+{
+    for (int y = y0; y < y1; ++y) {
+        int dy2 = (y - job->cy) * (y - job->cy);
+        if (dy2 > job->max_d2) continue;
+
+        uint32_t *row = picasso__row(job->bf, y);
+        int outer = picasso__isqrt(job->max_d2 - dy2);
+        int hole = job->min_d2 > dy2 ? picasso__isqrt(job->min_d2 - dy2 - 1) : -1;
+
+        if (hole < 0) {
+            picasso__job_span(job, row, job->cx - outer, job->cx + outer + 1);
+        } else if (hole < outer) {
+            picasso__job_span(job, row, job->cx - outer, job->cx - hole);
+            picasso__job_span(job, row, job->cx + hole + 1, job->cx + outer + 1);
+        }
+    }
+}
+
+// RGBA source pixels over dst, whichever way either side stores alpha
+static void picasso__blend_rgba_span(uint32_t *dst, const uint8_t *src, size_t n,
+                                     bool src_premul, bool dst_premul)
+{
+    if (src_premul) {
+        picasso__blend_span_premul(dst, src, n);
+    } else if (!dst_premul) {
+        picasso__blend_span(dst, src, n);
+    } else {
+        // Straight source onto a premultiplied target, converted a chunk at a time
+        uint32_t chunk[256];
+        for (size_t x = 0; x < n; x += 256) {
+            size_t count = PICASSO_MIN(n - x, (size_t)256);
+            picasso_premultiply_pixels((uint8_t *)chunk, src + x * 4, count);
+            picasso__blend_span_premul(dst + x, (const uint8_t *)chunk, count);
+        }
+    }
+}
+
+/* Source pixels replace dst. Only a change of alpha kind needs any work,
+ * everything else is a memcpy */
+static void picasso__copy_span(uint32_t *dst, const uint8_t *src, size_t n,
+                               picasso_format format, bool dst_premul)
+{
+    if (format == PICASSO_FORMAT_RGB8) {
+        picasso__copy_rgb_span(dst, src, n);
+    } else if ((format == PICASSO_FORMAT_RGBA8_PREMUL) == dst_premul) {
+        memcpy(dst, src, n * sizeof(uint32_t));
+    } else if (dst_premul) {
+        picasso_premultiply_pixels((uint8_t *)dst, src, n);
+    } else {
+        picasso_unpremultiply_pixels((uint8_t *)dst, src, n);
+    }
+}
+
+// n source pixels of format onto dst, however the job combines them
+static void picasso__blit_span(const picasso__span_job *job, uint32_t *dst, const uint8_t *src,
+                               size_t n, picasso_format format)
+{
+    if (job->copy) {
+        picasso__copy_span(dst, src, n, format, job->premul);
+    } else if (job->blend && format == PICASSO_FORMAT_RGB8) {
+        // Opaque pixels still change the result of most modes, expand them first
+        uint32_t chunk[256];
+        for (size_t x = 0; x < n; x += 256) {
+            size_t count = PICASSO_MIN(n - x, (size_t)256);
+            picasso__copy_rgb_span(chunk, src + x * 3, count);
+            job->blend(dst + x, (const uint8_t *)chunk, 4, count);
+        }
+    } else if (job->blend) {
+        job->blend(dst, src, 4, n);
+    } else if (format == PICASSO_FORMAT_RGB8) {
+        picasso__copy_rgb_span(dst, src, n);
+    } else {
+        picasso__blend_rgba_span(dst, src, n, format == PICASSO_FORMAT_RGBA8_PREMUL, job->premul);
+    }
+}
+
+// n pixels read leftwards starting at src, RGB ones come out as opaque RGBA
+static void picasso__reverse_span(uint32_t *dst, const uint8_t *src, size_t n, int bpp)
+{
+    for (size_t i = 0; i < n; ++i, src -= bpp) {
+        if (bpp == 4) memcpy(&dst[i], src, 4);
+        else dst[i] = 0xFF000000u | ((uint32_t)src[2] << 16) | ((uint32_t)src[1] << 8) | src[0];
+    }
+}
+
+/* Every channel times tint / 255. Premultiplied pixels carry alpha in their
+ * color already, so their color is scaled by the tint's alpha as well */
+static void picasso__tint_span(uint32_t *px, size_t n, color tint, bool premul)
+{
+    uint32_t ta = tint.a;
+    uint32_t tr = premul ? picasso__div255(tint.r * ta) : tint.r;
+    uint32_t tg = premul ? picasso__div255(tint.g * ta) : tint.g;
+    uint32_t tb = premul ? picasso__div255(tint.b * ta) : tint.b;
+    for (size_t i = 0; i < n; ++i) {
+        uint32_t p = px[i];
+        px[i] = picasso__div255((p & 0xFF) * tr) |
+                picasso__div255(((p >> 8) & 0xFF) * tg) << 8 |
+                picasso__div255(((p >> 16) & 0xFF) * tb) << 16 |
+                picasso__div255((p >> 24) * ta) << 24;
+    }
+}
+
+static void picasso__blit_rows(const picasso__span_job *job, int y0, int y1)
+{
+    const picasso_view *src = job->src;
+    size_t span = (size_t)(job->bounds.x1 - job->bounds.x0);
+    int bpp = picasso_format_bytes(src->format);
+    int sx = job->bounds.x0 - job->cx; // source column of the first pixel drawn
+
+    for (int y = y0; y < y1; ++y) {
+        uint32_t *dst = picasso__row(job->bf, y) + job->bounds.x0;
+        const uint8_t *src_row = picasso__view_row(src, y - job->cy);
+
+        if (!job->flip_x && !job->tint) {
+            picasso__blit_span(job, dst, src_row + sx * bpp, span, src->format);
+            continue;
+        }
+
+        // Mirrored, the first pixel drawn comes from the far end of the row
+        const uint8_t *src_px = src_row + (job->flip_x ? src->width - 1 - sx : sx) * bpp;
+        picasso_format format = src->format == PICASSO_FORMAT_RGB8 ? PICASSO_FORMAT_RGBA8 : src->format;
+        uint32_t chunk[256];
+        for (size_t x = 0; x < span; x += 256) {
+            size_t n = PICASSO_MIN(span - x, (size_t)256);
+            if (job->flip_x) picasso__reverse_span(chunk, src_px - (ptrdiff_t)x * bpp, n, bpp);
+            else if (bpp == 4) memcpy(chunk, src_px + x * 4, n * sizeof(uint32_t));
+            else picasso__copy_rgb_span(chunk, src_px + x * 3, n);
+            if (job->tint) picasso__tint_span(chunk, n, *job->tint, format == PICASSO_FORMAT_RGBA8_PREMUL);
+            picasso__blit_span(job, dst + x, (const uint8_t *)chunk, n, format);
+        }
+    }
+}
+
+/* Pixel centers line up: target pixel i samples the source at
+ * (i + 0.5) * step, less half a pixel for bilinear, whose taps sit on centers */
+static inline int64_t picasso__scale_pos(int i, int64_t step, bool bilinear)
+{
+    return (int64_t)i * step + step / 2 - (bilinear ? 0x8000 : 0);
+}
+
+static inline int picasso__nearest_tap(int64_t pos, int size)
+{
+    return (int)PICASSO_MIN(pos >> 16, (int64_t)size - 1);
+}
+
+// Left (or upper) neighbour of pos and the share of the next one. Edges repeat
+static inline int picasso__bilinear_tap(int64_t pos, int size, uint32_t *weight)
+{
+    if (pos < 0) pos = 0;
+    int s = (int)PICASSO_MIN(pos >> 16, (int64_t)size - 1);
+    *weight = s == size - 1 ? 0 : (uint32_t)(pos >> 8) & 0xFF;
+    return s;
+}
+
+static void picasso__nearest_rows(const picasso__span_job *job, int y0, int y1)
+{
+    const picasso_view *src = job->src;
+    const picasso__scale_map *map = job->scale;
+    size_t span = (size_t)(job->bounds.x1 - job->bounds.x0);
+    int bpp = picasso_format_bytes(src->format);
+    picasso_format format = src->format == PICASSO_FORMAT_RGB8 ? PICASSO_FORMAT_RGBA8 : src->format;
+    uint32_t chunk[256];
+
+    for (int y = y0; y < y1; ++y) {
+        uint32_t *dst = picasso__row(job->bf, y) + job->bounds.x0;
+        int sy = picasso__nearest_tap(picasso__scale_pos(y - map->y, map->step_y, false), src->height);
+        const uint8_t *src_row = picasso__view_row(src, sy);
+
+        for (size_t x = 0; x < span; x += 256) {
+            size_t n = PICASSO_MIN(span - x, (size_t)256);
+            const int32_t *cols = map->cols + x;
+            if (bpp == 4) {
+                for (size_t i = 0; i < n; ++i) memcpy(&chunk[i], src_row + cols[i], 4);
+            } else {
+                for (size_t i = 0; i < n; ++i) {
+                    const uint8_t *p = src_row + cols[i];
+                    chunk[i] = 0xFF000000u | ((uint32_t)p[2] << 16) | ((uint32_t)p[1] << 8) | p[0];
+                }
+            }
+            picasso__blit_span(job, dst + x, (const uint8_t *)chunk, n, format);
+        }
+    }
+}
+
+/* Source row sy, columns lo to hi, premultiplied so transparent pixels weigh
+ * nothing. The last pixel is repeated once, every tap can read its right
+ * neighbour */
+static void picasso__load_scale_row(uint32_t *out, const picasso_view *src, int sy, int lo, int hi)
+{
+    size_t n = (size_t)(hi - lo + 1);
+    const uint8_t *row = picasso__view_row(src, sy) + (size_t)lo * picasso_format_bytes(src->format);
+    if (src->format == PICASSO_FORMAT_RGB8) picasso__copy_rgb_span(out, row, n);
+    else if (src->format == PICASSO_FORMAT_RGBA8) picasso_premultiply_pixels((uint8_t *)out, row, n);
+    else memcpy(out, row, n * sizeof(uint32_t));
+    out[n] = out[n - 1];
+}
+
+/* Each band keeps the last two source rows it converted. Going down the
+ * target the rows it needs only ever move forward, so most target rows reuse
+ * both when enlarging */
+typedef struct {
+    uint32_t *rows[2];
+    int key[2];
+} picasso__scale_cache;
+
+// Source row sy, evicting whichever cached row is not keep
+static const uint32_t *picasso__scale_fetch(picasso__scale_cache *cache, const picasso__span_job *job,
+                                            int sy, int keep)
+{
+    if (cache->key[0] == sy) return cache->rows[0];
+    if (cache->key[1] == sy) return cache->rows[1];
+    int k = cache->key[0] == keep ? 1 : 0;
+    picasso__load_scale_row(cache->rows[k], job->src, sy, job->scale->lo, job->scale->hi);
+    cache->key[k] = sy;
+    return cache->rows[k];
+}
+
+static void picasso__bilinear_rows(const picasso__span_job *job, int y0, int y1)
+{
+    const picasso__scale_map *map = job->scale;
+    size_t span = (size_t)(job->bounds.x1 - job->bounds.x0);
+    size_t width = (size_t)(map->hi - map->lo + 2);
+    uint32_t stack[2 * 512];
+    uint32_t *buf = width <= 512 ? stack : picasso_malloc(2 * width * sizeof(uint32_t));
+    if (!buf) {
+        ERROR("Failed to allocate %zu source rows for a scaled blit", width);
+        return;
+    }
+    picasso__scale_cache cache = { { buf, buf + width }, { -1, -1 } };
+    uint32_t chunk[256];
+
+    for (int y = y0; y < y1; ++y) {
+        uint32_t *dst = picasso__row(job->bf, y) + job->bounds.x0;
+        uint32_t wy;
+        int sy = picasso__bilinear_tap(picasso__scale_pos(y - map->y, map->step_y, true),
+                                       job->src->height, &wy);
+        int next = wy ? sy + 1 : sy;
+        const uint32_t *row0 = picasso__scale_fetch(&cache, job, sy, next);
+        const uint32_t *row1 = picasso__scale_fetch(&cache, job, next, sy);
+
+        for (size_t x = 0; x < span; x += 256) {
+            size_t n = PICASSO_MIN(span - x, (size_t)256);
+            picasso__kernels()->bilinear_row(chunk, row0, row1, map->cols + x, map->weights + x, n, wy);
+            picasso__blit_span(job, dst + x, (const uint8_t *)chunk, n, PICASSO_FORMAT_RGBA8_PREMUL);
+        }
+    }
+    if (buf != stack) picasso_free(buf);
+}
+
+static inline int64_t picasso__floor_div(int64_t a, int64_t b)
+{
+    int64_t q = a / b;
+    return (a % b != 0 && (a < 0) != (b < 0)) ? q - 1 : q;
+}
+
+// Narrows [*lo, *hi] to the k where 0 <= p + k * dp <= max, no pixel tests
+static void picasso__affine_clip(int64_t p, int64_t dp, int64_t max, int64_t *lo, int64_t *hi)
+{
+    if (dp == 0) {
+        if (p < 0 || p > max) *hi = *lo - 1;
+    } else if (dp > 0) {
+        *lo = PICASSO_MAX(*lo, -picasso__floor_div(p, dp));
+        *hi = PICASSO_MIN(*hi, picasso__floor_div(max - p, dp));
+    } else {
+        *lo = PICASSO_MAX(*lo, -picasso__floor_div(max - p, -dp));
+        *hi = PICASSO_MIN(*hi, picasso__floor_div(p, -dp));
+    }
+}
+
+/* Each row walks the source along a straight line. Where that line enters and
+ * leaves the source is solved once per row, the pixels in between step the
+ * position along, with every sample inside by construction */
+static void picasso__affine_rows(const picasso__span_job *job, int y0, int y1)
+{
+    const picasso__affine_map *map = job->affine;
+    const picasso_view *src = job->src;
+    int bpp = picasso_format_bytes(src->format);
+    picasso_format format = src->format == PICASSO_FORMAT_RGB8 ? PICASSO_FORMAT_RGBA8 : src->format;
+    int32_t umax = (src->width - 1) << 16, vmax = (src->height - 1) << 16;
+    size_t stride = (size_t)src->width + 1;
+    uint32_t chunk[256];
+    int32_t offsets[256];
+    uint16_t wx[256], wy[256];
+
+    for (int y = y0; y < y1; ++y) {
+        int64_t u = map->u0 + map->du_dy * y + map->du_dx * job->bounds.x0;
+        int64_t v = map->v0 + map->dv_dy * y + map->dv_dx * job->bounds.x0;
+        int64_t lo = 0, hi = job->bounds.x1 - job->bounds.x0 - 1;
+        picasso__affine_clip(u, map->du_dx, ((int64_t)src->width << 16) - 1, &lo, &hi);
+        picasso__affine_clip(v, map->dv_dx, ((int64_t)src->height << 16) - 1, &lo, &hi);
+        if (lo > hi) continue;
+
+        uint32_t *dst = picasso__row(job->bf, y) + job->bounds.x0 + lo;
+        size_t span = (size_t)(hi - lo + 1);
+        int64_t su = u + map->du_dx * lo, sv = v + map->dv_dx * lo;
+
+        for (size_t x = 0; x < span; x += 256) {
+            size_t n = PICASSO_MIN(span - x, (size_t)256);
+            if (!map->texels) {
+                for (size_t i = 0; i < n; ++i, su += map->du_dx, sv += map->dv_dx) {
+                    const uint8_t *p = picasso__view_row(src, sv >> 16) + (size_t)(su >> 16) * bpp;
+                    if (bpp == 4) memcpy(&chunk[i], p, 4);
+                    else chunk[i] = 0xFF000000u | ((uint32_t)p[2] << 16) | ((uint32_t)p[1] << 8) | p[0];
+                }
+                picasso__blit_span(job, dst + x, (const uint8_t *)chunk, n, format);
+                continue;
+            }
+            // Taps sit on texel centers, half a pixel back, edges repeat
+            for (size_t i = 0; i < n; ++i, su += map->du_dx, sv += map->dv_dx) {
+                int32_t tu = (int32_t)PICASSO_MIN(PICASSO_MAX(su - 0x8000, (int64_t)0), (int64_t)umax);
+                int32_t tv = (int32_t)PICASSO_MIN(PICASSO_MAX(sv - 0x8000, (int64_t)0), (int64_t)vmax);
+                offsets[i] = (tv >> 16) * (int32_t)stride + (tu >> 16);
+                wx[i] = (tu >> 8) & 0xFF;
+                wy[i] = (tv >> 8) & 0xFF;
+            }
+            picasso__kernels()->bilinear_gather(chunk, map->texels, stride, offsets, wx, wy, n);
+            picasso__blit_span(job, dst + x, (const uint8_t *)chunk, n, PICASSO_FORMAT_RGBA8_PREMUL);
+        }
+    }
+}
+
+// --------------------------------------------------------
+// Backbuffer operations
+// --------------------------------------------------------
+
+
+picasso_backbuffer* picasso_create_backbuffer(int width, int height)
+{
+    return picasso_create_backbuffer_ex(width, height, PICASSO_ALLOC_DEFAULT);
+}
+
+picasso_backbuffer* picasso_create_backbuffer_ex(int width, int height, uint32_t flags)
+{
+    size_t pitch, bytes;
+    if (!picasso__storage_size(width, height, sizeof(uint32_t), flags, &pitch, &bytes)) {
+        return NULL;
+    }
+
+    picasso_backbuffer* bf = picasso_calloc(1, sizeof(picasso_backbuffer));
+    if (!bf) return NULL;
+
+    bf->width = width;
+    bf->height = height;
+    bf->pitch = (uint32_t)pitch; // 4 bytes per pixel, plus padding if asked for
+    bf->premultiplied = (flags & PICASSO_ALLOC_PREMULTIPLIED) != 0;
+
+    bf->page_mode = PICASSO_PAGES_DEFAULT;
+    bf->pixels = NULL;
+    if (flags & PICASSO_ALLOC_HUGE_PAGES) {
+        bf->pixels = picasso__alloc_pages(bytes, &bf->page_mode);
+        if (!bf->pixels) WARN("Could not map pages for %dx%d backbuffer, using the allocator", width, height);
+    }
+    if (!bf->pixels) {
+        picasso_allocator a = picasso_get_allocator();
+        bf->pixels = picasso__alloc_with(&a, bytes, PICASSO_ALIGNMENT, true);
+    }
+    TRACE("Backbuffer %dx%d, page mode %d", width, height, bf->page_mode);
+
+    if (!bf->pixels) {
+        picasso_free(bf);
+        return NULL;
+    }
+
+    return bf;
+}
+
+void picasso_destroy_backbuffer(picasso_backbuffer* bf)
+{
+    if (!bf) return;
+    if (bf->pixels) {
+        picasso_free(bf->pixels);
+        bf->pixels = NULL;
+    }
+    picasso_free(bf);
+}
+
+void picasso_blit_bitmap(picasso_backbuffer* dst,
+                         void* src_pixels, int src_w, int src_h,
+                         int x, int y)
+{
+    picasso_view src = picasso_view_from_pixels(src_pixels, src_w, src_h,
+                                                (ptrdiff_t)src_w * 4, PICASSO_FORMAT_RGBA8);
+    picasso_blit_view(dst, &src, x, y);
+}
+
+void picasso_blit_bitmap_blend(picasso_backbuffer *dst, void *src_pixels, int src_w, int src_h,
+                               int x, int y, picasso_blend_mode mode)
+{
+    picasso_view src = picasso_view_from_pixels(src_pixels, src_w, src_h,
+                                                (ptrdiff_t)src_w * 4, PICASSO_FORMAT_RGBA8);
+    picasso_blit_view_blend(dst, &src, x, y, mode);
+}
+
+void picasso_blit_view(picasso_backbuffer *dst, const picasso_view *src, int x, int y)
+{
+    picasso_blit_view_blend(dst, src, x, y, PICASSO_BLEND_NORMAL);
+}
+
+static void picasso__blit(picasso_backbuffer *dst, const picasso_view *src, int x, int y,
+                          picasso_blend_mode mode, bool flip_x)
+{
+    if (!dst || !src || !src->pixels || !dst->pixels) return;
+    if (!picasso__valid_blend_mode(mode)) return;
+
+    picasso_draw_bounds bounds;
+    if (!picasso__clip_rect_to_bounds(dst, &(picasso_rect){ x, y, src->width, src->height }, &bounds)) return;
+    picasso__damage(dst, bounds);
+
+    picasso__span_job job = {
+        .bf = dst, .bounds = bounds, .cx = x, .cy = y, .src = src, .premul = dst->premultiplied,
+        .blend = picasso__blend_kernels[mode][src->format == PICASSO_FORMAT_RGBA8_PREMUL][dst->premultiplied],
+        .copy = mode == PICASSO_BLEND_COPY, .flip_x = flip_x,
+    };
+    picasso__for_each_band(picasso__blit_rows, &job);
+}
+
+void picasso_blit_view_blend(picasso_backbuffer *dst, const picasso_view *src, int x, int y,
+                             picasso_blend_mode mode)
+{
+    picasso__blit(dst, src, x, y, mode, false);
+}
+
+/* Blits part of a larger image. Both sides keep their own stride, so this is
+ * the same span loop as a whole view, just starting further in */
+void picasso_blit_view_rect(picasso_backbuffer *dst, const picasso_view *src, picasso_rect src_rect,
+                            int x, int y, picasso_blend_mode mode)
+{
+    if (!src) return;
+    picasso__normalize_rect(&src_rect);
+    picasso_view sub = picasso_subview(src, src_rect);
+    if (!sub.pixels) return;
+
+    // Whatever the subview cut off on the top or left moves the target along
+    x += PICASSO_MAX(src_rect.x, 0) - src_rect.x;
+    y += PICASSO_MAX(src_rect.y, 0) - src_rect.y;
+    picasso_blit_view_blend(dst, &sub, x, y, mode);
+}
+
+/* Frames are drawn straight out of the sheet, using its width as stride.
+ * Flipping only changes the order rows and pixels are read in */
+void picasso_blit_sprite(picasso_backbuffer *dst, const picasso_sprite_sheet *sheet, int frame,
+                         int x, int y, uint32_t flags)
+{
+    picasso_view src = picasso_view_from_sprite(sheet, frame);
+    if (!src.pixels) return;
+
+    if (flags & PICASSO_SPRITE_FLIP_Y) {
+        src.pixels += (ptrdiff_t)(src.height - 1) * src.stride;
+        src.stride = -src.stride;
+    }
+    picasso__blit(dst, &src, x, y, PICASSO_BLEND_NORMAL, (flags & PICASSO_SPRITE_FLIP_X) != 0);
+}
+
+/* The column table is the only allocation, and only for targets wider than
+ * 512 visible pixels. Rows are looked up per band as they go */
+void picasso_blit_scaled(picasso_backbuffer *dst, const picasso_view *src, picasso_rect dst_rect,
+                         picasso_filter filter)
+{
+    if (!dst || !src || !src->pixels || !dst->pixels) return;
+    if (src->width <= 0 || src->height <= 0) return;
+    if (filter != PICASSO_FILTER_NEAREST && filter != PICASSO_FILTER_BILINEAR) {
+        WARN("Unknown scale filter %d", (int)filter);
+        return;
+    }
+
+    picasso__normalize_rect(&dst_rect);
+    picasso_draw_bounds bounds;
+    if (!picasso__clip_rect_to_bounds(dst, &dst_rect, &bounds)) return;
+
+    picasso__scale_map map = {
+        .x = dst_rect.x, .y = dst_rect.y,
+        .step_x = ((int64_t)src->width << 16) / dst_rect.width,
+        .step_y = ((int64_t)src->height << 16) / dst_rect.height,
+        .bilinear = filter == PICASSO_FILTER_BILINEAR,
+    };
+
+    size_t span = (size_t)(bounds.x1 - bounds.x0);
+    int32_t cols_stack[512];
+    uint16_t weights_stack[512];
+    int32_t *cols = cols_stack;
+    uint16_t *weights = weights_stack;
+    if (span > 512) {
+        cols = picasso_malloc(span * (sizeof(int32_t) + sizeof(uint16_t)));
+        if (!cols) {
+            ERROR("Failed to allocate the column table for a scaled blit");
+            return;
+        }
+        weights = (uint16_t *)(cols + span);
+    }
+
+    int bpp = picasso_format_bytes(src->format);
+    for (size_t i = 0; i < span; ++i) {
+        int64_t pos = picasso__scale_pos(bounds.x0 - dst_rect.x + (int)i, map.step_x, map.bilinear);
+        if (!map.bilinear) {
+            cols[i] = picasso__nearest_tap(pos, src->width) * bpp;
+            continue;
+        }
+        uint32_t w;
+        cols[i] = picasso__bilinear_tap(pos, src->width, &w);
+        weights[i] = (uint16_t)w;
+    }
+    if (map.bilinear) {
+        // Columns only move right, so the first and last tap bound the range
+        map.lo = cols[0];
+        map.hi = PICASSO_MIN(cols[span - 1] + 1, src->width - 1);
+        for (size_t i = 0; i < span; ++i) cols[i] -= map.lo;
+    }
+    map.cols = cols;
+    map.weights = weights;
+
+    picasso__damage(dst, bounds);
+    picasso__span_job job = {
+        .bf = dst, .bounds = bounds, .src = src, .premul = dst->premultiplied, .scale = &map,
+    };
+    picasso__for_each_band(map.bilinear ? picasso__bilinear_rows : picasso__nearest_rows, &job);
+    if (cols != cols_stack) picasso_free(cols);
+}
+
+static inline int64_t picasso__to_fixed(double v)
+{
+    return (int64_t)(v * 65536.0 + (v < 0 ? -0.5 : 0.5));
+}
+
+static inline int picasso__floor_to_int(double v)
+{
+    int i = (int)v;
+    return i > v ? i - 1 : i;
+}
+
+/* Matrix setup and the bounding box of the quad are the only floating point,
+ * everything per pixel is fixed point. Bilinear samples a premultiplied copy
+ * of the source, made once per call */
+void picasso_blit_affine(picasso_backbuffer *dst, const picasso_view *src, const picasso_affine *matrix,
+                         picasso_filter filter)
+{
+    if (!dst || !src || !matrix || !src->pixels || !dst->pixels) return;
+    if (src->width <= 0 || src->height <= 0) return;
+    if (filter != PICASSO_FILTER_NEAREST && filter != PICASSO_FILTER_BILINEAR) {
+        WARN("Unknown scale filter %d", (int)filter);
+        return;
+    }
+    if (src->width > PICASSO_MAX_DIM || src->height > PICASSO_MAX_DIM) {
+        ERROR("Source %dx%d is over the %d pixel limit", src->width, src->height, PICASSO_MAX_DIM);
+        return;
+    }
+
+    double a = matrix->a, b = matrix->b, c = matrix->c, d = matrix->d;
+    double tx = matrix->tx, ty = matrix->ty;
+    double det = a * d - b * c;
+    double ia = d / det, ib = -b / det, ic = -c / det, id = a / det;
+    // Also false for NaN, which covers det == 0
+    bool sane = ia > -65536.0 && ia < 65536.0 && ib > -65536.0 && ib < 65536.0 &&
+                ic > -65536.0 && ic < 65536.0 && id > -65536.0 && id < 65536.0 &&
+                tx > -1e8 && tx < 1e8 && ty > -1e8 && ty < 1e8;
+    if (!sane) {
+        WARN("Affine matrix is degenerate or out of range, nothing drawn");
+        return;
+    }
+
+    // Where the corners land, the quad never leaves their box
+    double w = src->width, h = src->height;
+    double xs[4] = { tx, a * w + tx, c * h + tx, a * w + c * h + tx };
+    double ys[4] = { ty, b * w + ty, d * h + ty, b * w + d * h + ty };
+    double min_x = xs[0], max_x = xs[0], min_y = ys[0], max_y = ys[0];
+    for (int i = 1; i < 4; ++i) {
+        min_x = xs[i] < min_x ? xs[i] : min_x;
+        max_x = xs[i] > max_x ? xs[i] : max_x;
+        min_y = ys[i] < min_y ? ys[i] : min_y;
+        max_y = ys[i] > max_y ? ys[i] : max_y;
+    }
+    if (max_x < 0 || max_y < 0 || min_x > dst->width || min_y > dst->height) return;
+
+    int x0 = picasso__floor_to_int(PICASSO_MAX(min_x, -1.0));
+    int y0 = picasso__floor_to_int(PICASSO_MAX(min_y, -1.0));
+    int x1 = picasso__floor_to_int(PICASSO_MIN(max_x, (double)dst->width)) + 1;
+    int y1 = picasso__floor_to_int(PICASSO_MIN(max_y, (double)dst->height)) + 1;
+    picasso_draw_bounds bounds;
+    if (!picasso__clip_rect_to_bounds(dst, &(picasso_rect){ x0, y0, x1 - x0, y1 - y0 }, &bounds)) return;
+
+    // Source position of the center of target pixel 0, 0
+    picasso__affine_map map = {
+        .u0 = picasso__to_fixed(ia * (0.5 - tx) + ic * (0.5 - ty)),
+        .v0 = picasso__to_fixed(ib * (0.5 - tx) + id * (0.5 - ty)),
+        .du_dx = picasso__to_fixed(ia), .dv_dx = picasso__to_fixed(ib),
+        .du_dy = picasso__to_fixed(ic), .dv_dy = picasso__to_fixed(id),
+    };
+
+    uint32_t *texels = NULL;
+    if (filter == PICASSO_FILTER_BILINEAR) {
+        size_t stride = (size_t)src->width + 1;
+        texels = picasso_malloc(stride * ((size_t)src->height + 1) * sizeof(uint32_t));
+        if (!texels) {
+            ERROR("Failed to allocate texels for an affine blit");
+            return;
+        }
+        for (int y = 0; y < src->height; ++y) {
+            picasso__load_scale_row(texels + y * stride, src, y, 0, src->width - 1);
+        }
+        memcpy(texels + (size_t)src->height * stride, texels + (size_t)(src->height - 1) * stride,
+               stride * sizeof(uint32_t));
+        map.texels = texels;
+    }
+
+    // Damage is the box, a few pixels outside the quad are harmless
+    picasso__damage(dst, bounds);
+    picasso__span_job job = {
+        .bf = dst, .bounds = bounds, .src = src, .premul = dst->premultiplied, .affine = &map,
+    };
+    picasso__for_each_band(picasso__affine_rows, &job);
+    picasso_free(texels);
+}
+
+void* picasso_backbuffer_pixels(picasso_backbuffer* bf)
+{
+    if (!bf) return NULL;
+    return (void*)bf->pixels;
+}
+
+/* Backbuffer pixels are packed uint32 with red in the low byte,
+ * which in memory is the same RGBA byte order as a 4 channel image */
+int picasso_save_backbuffer_to_ppm(const picasso_backbuffer *bf, const char *file_path)
+{
+    if (!bf || !bf->pixels) return -1;
+    picasso_view v = picasso_view_from_backbuffer(bf);
+    return picasso_save_view_to_ppm(&v, file_path);
+}
+
+void picasso_clear_backbuffer(picasso_backbuffer* bf)
+{
+    picasso_clear_backbuffer_color(bf, CLEAR_BACKGROUND);
+}
+
+void picasso_clear_backbuffer_color(picasso_backbuffer *bf, color c)
+{
+    if (!bf || !bf->pixels) {
+        WARN("Attempted to clear NULL backbuffer");
+        return;
+    }
+    picasso_clear_rect(bf, &(picasso_rect){ 0, 0, (int)bf->width, (int)bf->height }, c);
+}
+
+/* Overwrites, no blending. Alpha is written as given */
+void picasso_clear_rect(picasso_backbuffer *bf, const picasso_rect *rect, color c)
+{
+    if (!bf || !bf->pixels || !rect) return;
+
+    picasso_rect r = *rect;
+    picasso_draw_bounds bounds = {0};
+    picasso__normalize_rect(&r);
+    if (!picasso__clip_rect_to_bounds(bf, &r, &bounds)) return;
+
+    picasso__damage(bf, bounds);
+
+    size_t span = (size_t)(bounds.x1 - bounds.x0);
+    size_t rows = (size_t)(bounds.y1 - bounds.y0);
+    picasso__span_job job = {
+        .bf = bf,
+        .bounds = bounds,
+        .pixel = picasso__solid_pixel(bf, c),
+        .stream = span * rows * sizeof(uint32_t) >= PICASSO_STREAM_THRESHOLD,
+    };
+    picasso__for_each_band(picasso__clear_rows, &job);
+}
+
+/* Clears only what was drawn since the last reset, the usual way to wipe a
+ * frame when most of the screen did not change */
+void picasso_clear_damage(picasso_backbuffer *bf, color c)
+{
+    if (!bf) return;
+    for (int i = 0; i < bf->damage.count; ++i) {
+        picasso_draw_bounds b = bf->damage.rects[i];
+        picasso_clear_rect(bf, &(picasso_rect){ b.x0, b.y0, b.x1 - b.x0, b.y1 - b.y0 }, c);
+    }
+}
+
+// --------------------------------------------------------
+// Image views
+// --------------------------------------------------------
+/* Views never own their pixels, they are just a window into memory owned by
+ * an image, backbuffer or sprite sheet. Cropping is pointer arithmetic */
+
+int picasso_format_bytes(picasso_format format)
+{
+    switch (format) {
+        case PICASSO_FORMAT_RGB8:  return 3;
+        case PICASSO_FORMAT_RGBA8: return 4;
+        case PICASSO_FORMAT_RGBA8_PREMUL: return 4;
+        default:                   return 0;
+    }
+}
+
+picasso_view picasso_view_from_pixels(void *pixels, int width, int height,
+                                      ptrdiff_t stride, picasso_format format)
+{
+    if (!pixels || width <= 0 || height <= 0 || !picasso_format_bytes(format)) {
+        return (picasso_view){0};
+    }
+    return (picasso_view){
+        .pixels = pixels,
+        .width  = width,
+        .height = height,
+        .stride = stride,
+        .format = format,
+    };
+}
+
+picasso_view picasso_view_from_image(const picasso_image *img)
+{
+    if (!img) return (picasso_view){0};
+    picasso_format format = img->channels == 3 ? PICASSO_FORMAT_RGB8
+                          : img->premultiplied ? PICASSO_FORMAT_RGBA8_PREMUL : PICASSO_FORMAT_RGBA8;
+    return picasso_view_from_pixels(img->pixels, img->width, img->height, img->row_stride, format);
+}
+
+picasso_view picasso_view_from_backbuffer(const picasso_backbuffer *bf)
+{
+    if (!bf) return (picasso_view){0};
+    return picasso_view_from_pixels(bf->pixels, bf->width, bf->height, bf->pitch,
+                                    bf->premultiplied ? PICASSO_FORMAT_RGBA8_PREMUL : PICASSO_FORMAT_RGBA8);
+}
+
+picasso_view picasso_view_from_sprite(const picasso_sprite_sheet *sheet, int frame)
+{
+    if (!sheet || frame < 0 || frame >= sheet->frame_count) return (picasso_view){0};
+
+    picasso_view whole = picasso_view_from_pixels(sheet->pixels, sheet->sheet_width, sheet->sheet_height,
+                                                  (ptrdiff_t)sheet->sheet_width * 4,
+                                                  sheet->premultiplied ? PICASSO_FORMAT_RGBA8_PREMUL
+                                                                       : PICASSO_FORMAT_RGBA8);
+    picasso_sprite f = sheet->frames[frame];
+    return picasso_subview(&whole, (picasso_rect){ f.x, f.y, f.width, f.height });
+}
+
+/* The region is clipped to the view, an empty view comes back if nothing is left */
+picasso_view picasso_subview(const picasso_view *v, picasso_rect r)
+{
+    if (!v || !v->pixels) return (picasso_view){0};
+
+    picasso__normalize_rect(&r);
+    int x0 = PICASSO_MAX(r.x, 0);
+    int y0 = PICASSO_MAX(r.y, 0);
+    int x1 = PICASSO_MIN(r.x + r.width,  v->width);
+    int y1 = PICASSO_MIN(r.y + r.height, v->height);
+    if (x0 >= x1 || y0 >= y1) return (picasso_view){0};
+
+    picasso_view sub = *v;
+    sub.pixels = v->pixels + (ptrdiff_t)y0 * v->stride + x0 * picasso_format_bytes(v->format);
+    sub.width  = x1 - x0;
+    sub.height = y1 - y0;
+    return sub;
+}
+
+/* A backbuffer header over an RGBA view, so every primitive can draw into
+ * a sub-region in place. Nothing is allocated, nothing needs destroying */
+picasso_backbuffer picasso_backbuffer_from_view(const picasso_view *v)
+{
+    if (!v || !v->pixels || picasso_format_bytes(v->format) != 4 || v->stride <= 0) {
+        WARN("Only RGBA views with a positive stride can be drawn into");
+        return (picasso_backbuffer){0};
+    }
+    return (picasso_backbuffer){
+        .pixels = (uint32_t *)v->pixels,
+        .width  = (uint32_t)v->width,
+        .height = (uint32_t)v->height,
+        .pitch  = (uint32_t)v->stride,
+        .premultiplied = v->format == PICASSO_FORMAT_RGBA8_PREMUL,
+    };
+}
+
+int picasso_save_view_to_ppm(const picasso_view *v, const char *file_path)
+{
+    if (!v || !v->pixels) return -1;
+    if (v->stride <= 0) {
+        ERROR("Saving views with a negative stride is not supported");
+        return -1;
+    }
+    // PPM has no alpha, but premultiplied color still has to come back out to straight
+    return picasso__save_ppm(file_path, v->pixels, v->width, v->height, picasso_format_bytes(v->format),
+                             (size_t)v->stride, v->format == PICASSO_FORMAT_RGBA8_PREMUL);
+}
+
+// --------------------------------------------------------
+// Tiled images
+// --------------------------------------------------------
+
+/* Huge or sparse canvases are split into square tiles, each allocated the
+ * first time something writes to it. Untouched tiles read as transparent,
+ * the unwritten rest of a touched tile as zero, which RGB has no alpha for */
+picasso_tiled_image *picasso_tiled_image_create(int width, int height, int channels)
+{
+    size_t tiles_x, tiles_y, count;
+    if (width <= 0 || height <= 0 || (channels != 3 && channels != 4)) return NULL;
+
+    tiles_x = ((size_t)width  + PICASSO_TILE_SIZE - 1) / PICASSO_TILE_SIZE;
+    tiles_y = ((size_t)height + PICASSO_TILE_SIZE - 1) / PICASSO_TILE_SIZE;
+    if (__builtin_mul_overflow(tiles_x, tiles_y, &count)) return NULL;
+
+    picasso_tiled_image *ti = picasso_malloc(sizeof(picasso_tiled_image));
+    if (!ti) return NULL;
+
+    ti->width       = width;
+    ti->height      = height;
+    ti->channels    = channels;
+    ti->tiles_x     = (int)tiles_x;
+    ti->tiles_y     = (int)tiles_y;
+    ti->tile_stride = PICASSO_TILE_SIZE * channels;
+    ti->tiles_used  = 0;
+    ti->tiles       = picasso_calloc(count, sizeof(uint8_t *));
+    if (!ti->tiles) {
+        picasso_free(ti);
+        return NULL;
+    }
+
+    TRACE("Tiled image %dx%d as %zux%zu tiles", width, height, tiles_x, tiles_y);
+    return ti;
+}
+
+void picasso_tiled_image_destroy(picasso_tiled_image *ti)
+{
+    if (!ti) return;
+    size_t count = (size_t)ti->tiles_x * ti->tiles_y;
+    for (size_t i = 0; i < count; ++i) {
+        picasso_free(ti->tiles[i]);
+    }
+    picasso_free(ti->tiles);
+    picasso_free(ti);
+}
+
+uint8_t *picasso_tiled_image_tile(picasso_tiled_image *ti, int tx, int ty, bool create)
+{
+    if (!ti || tx < 0 || ty < 0 || tx >= ti->tiles_x || ty >= ti->tiles_y) return NULL;
+
+    uint8_t **tile = &ti->tiles[(size_t)ty * ti->tiles_x + tx];
+    if (!*tile && create) {
+        picasso_allocator a = picasso_get_allocator();
+        *tile = picasso__alloc_with(&a, (size_t)ti->tile_stride * PICASSO_TILE_SIZE,
+                                    PICASSO_ALIGNMENT, true);
+        if (*tile) ti->tiles_used++;
+    }
+    return *tile;
+}
+
+/* Edge tiles are cut down to the part that lies inside the image */
+picasso_view picasso_tiled_image_tile_view(picasso_tiled_image *ti, int tx, int ty, bool create)
+{
+    uint8_t *pixels = picasso_tiled_image_tile(ti, tx, ty, create);
+    if (!pixels) return (picasso_view){0};
+
+    int w = PICASSO_MIN(PICASSO_TILE_SIZE, ti->width  - tx * PICASSO_TILE_SIZE);
+    int h = PICASSO_MIN(PICASSO_TILE_SIZE, ti->height - ty * PICASSO_TILE_SIZE);
+    return picasso_view_from_pixels(pixels, w, h, ti->tile_stride,
+                                    ti->channels == 3 ? PICASSO_FORMAT_RGB8 : PICASSO_FORMAT_RGBA8);
+}
+
+size_t picasso_tiled_image_bytes(const picasso_tiled_image *ti)
+{
+    if (!ti) return 0;
+    return ti->tiles_used * (size_t)ti->tile_stride * PICASSO_TILE_SIZE;
+}
+
+/* Walks every tile overlapping region r (in image coordinates, clipped) and
+ * hands over the tile and the overlapping part in both coordinate spaces */
+#define picasso__foreach_tile(ti, r, body) do {                                         \
+    int _x0 = PICASSO_MAX((r).x, 0), _y0 = PICASSO_MAX((r).y, 0);                        \
+    int _x1 = PICASSO_MIN((r).x + (r).width, (ti)->width);                               \
+    int _y1 = PICASSO_MIN((r).y + (r).height, (ti)->height);                             \
+    for (int ty = _y0 / PICASSO_TILE_SIZE; _y0 < _y1 && ty <= (_y1 - 1) / PICASSO_TILE_SIZE; ++ty) \
+    for (int tx = _x0 / PICASSO_TILE_SIZE; _x0 < _x1 && tx <= (_x1 - 1) / PICASSO_TILE_SIZE; ++tx) { \
+        int ox = tx * PICASSO_TILE_SIZE, oy = ty * PICASSO_TILE_SIZE;                    \
+        picasso_rect part = {                                                           \
+            .x = PICASSO_MAX(_x0, ox), .y = PICASSO_MAX(_y0, oy) };                     \
+        part.width  = PICASSO_MIN(_x1, ox + PICASSO_TILE_SIZE) - part.x;                \
+        part.height = PICASSO_MIN(_y1, oy + PICASSO_TILE_SIZE) - part.y;                \
+        do { body } while (0);                                                          \
+    }} while (0)
+
+/* Copies a view of the same format into the canvas at (x, y), only the
+ * tiles that are touched get allocated */
+int picasso_tiled_image_write(picasso_tiled_image *ti, const picasso_view *src, int x, int y)
+{
+    if (!ti || !src || !src->pixels) return -1;
+    if (picasso_format_bytes(src->format) != ti->channels) {
+        ERROR("View format does not match the %d channel tiled image", ti->channels);
+        return -1;
+    }
+
+    picasso_rect region = { x, y, src->width, src->height };
+    int result = 0;
+    picasso__foreach_tile(ti, region, {
+        picasso_view tile = picasso_tiled_image_tile_view(ti, tx, ty, true);
+        if (!tile.pixels) { result = -1; continue; }
+
+        size_t bytes = (size_t)part.width * ti->channels;
+        for (int row = 0; row < part.height; ++row) {
+            uint8_t *dst = tile.pixels + (ptrdiff_t)(part.y - oy + row) * tile.stride
+                                       + (part.x - ox) * ti->channels;
+            const uint8_t *s = src->pixels + (ptrdiff_t)(part.y - y + row) * src->stride
+                                           + (part.x - x) * ti->channels;
+            memcpy(dst, s, bytes);
+        }
+    });
+    return result;
+}
+
+/* Blits region src of the canvas with its top left corner at (x, y).
+ * Tiles that were never written are skipped, they are fully transparent.
+ * Touched RGB tiles are opaque all over, black where nothing was written */
+void picasso_blit_tiled_image(picasso_backbuffer *dst, picasso_tiled_image *ti,
+                              picasso_rect src, int x, int y)
+{
+    if (!dst || !ti) return;
+    picasso__normalize_rect(&src);
+
+    picasso__foreach_tile(ti, src, {
+        picasso_view tile = picasso_tiled_image_tile_view(ti, tx, ty, false);
+        if (!tile.pixels) continue;
+
+        picasso_view sub = picasso_subview(&tile, (picasso_rect){
+            part.x - ox, part.y - oy, part.width, part.height });
+        picasso_blit_view(dst, &sub, x + part.x - src.x, y + part.y - src.y);
+    });
+}
+
+// --------------------------------------------------------
+// Prepared sprites
+// --------------------------------------------------------
+enum {
+    PICASSO__RUN_TRANSPARENT, // never stored, the gaps between runs
+    PICASSO__RUN_OPAQUE,
+    PICASSO__RUN_BLEND,
+};
+
+// Width is capped at PICASSO_MAX_DIM, so 16 bits hold any position or length
+typedef struct {
+    uint16_t x, len;
+    uint8_t kind;
+} picasso__alpha_run;
+
+struct picasso_prepared_sprite {
+    int width, height;
+    bool premultiplied;
+    uint32_t *pixels;          // width * height, rows packed
+    uint32_t *row_start;       // runs of row y are [row_start[y], row_start[y + 1])
+    picasso__alpha_run *runs;
+    size_t run_count;
+};
+
+/* A few opaque pixels in the middle of blended ones are cheaper to blend
+ * along with them than to copy with a call of their own. Blending an opaque
+ * pixel gives that pixel, so the result is the same */
+#define PICASSO__MIN_OPAQUE_RUN 8
+
+static inline int picasso__alpha_kind(uint32_t px, bool premul)
 {
-    if(!r) {WARN("Tried to normalize a NULL object");return;}
-    if (r->width < 0) {
-        r->x += r->width;
-        r->width = -r->width;
+    uint32_t a = px >> 24;
+    if (a == 255) return PICASSO__RUN_OPAQUE;
+    // Premultiplied pixels with zero alpha but some color still add light
+    if (premul ? px == 0 : a == 0) return PICASSO__RUN_TRANSPARENT;
+    return PICASSO__RUN_BLEND;
+}
+
+// Splits one row into runs, out needs room for width of them
+static size_t picasso__encode_row(const uint32_t *px, int width, bool premul, picasso__alpha_run *out)
+{
+    size_t count = 0;
+    for (int x = 0; x < width;) {
+        int start = x, kind = picasso__alpha_kind(px[x], premul);
+        while (x < width && picasso__alpha_kind(px[x], premul) == kind) ++x;
+        if (kind == PICASSO__RUN_TRANSPARENT) continue;
+
+        int len = x - start;
+        picasso__alpha_run *last = count ? &out[count - 1] : NULL;
+        if (last && last->x + last->len == start) {
+            if (last->kind == PICASSO__RUN_BLEND && (kind == PICASSO__RUN_BLEND || len < PICASSO__MIN_OPAQUE_RUN)) {
+                last->len += len;
+                continue;
+            }
+            if (kind == PICASSO__RUN_BLEND && last->len < PICASSO__MIN_OPAQUE_RUN) {
+                last->kind = PICASSO__RUN_BLEND;
+                last->len += len;
+                continue;
+            }
+        }
+        out[count++] = (picasso__alpha_run){ (uint16_t)start, (uint16_t)len, (uint8_t)kind };
     }
-    if (r->height < 0) {
-        r->y += r->height;
-        r->height = -r->height;
+    return count;
+}
+
+picasso_prepared_sprite *picasso_prepare_sprite(const picasso_view *src)
+{
+    if (!src || !src->pixels || src->width <= 0 || src->height <= 0) return NULL;
+    if (src->width > PICASSO_MAX_DIM || src->height > PICASSO_MAX_DIM) {
+        ERROR("Sprite %dx%d is over the %d pixel limit", src->width, src->height, PICASSO_MAX_DIM);
+        return NULL;
+    }
+
+    int w = src->width, h = src->height;
+    bool premul = src->format == PICASSO_FORMAT_RGBA8_PREMUL;
+    picasso_prepared_sprite *ps = picasso_calloc(1, sizeof(picasso_prepared_sprite));
+    picasso__alpha_run *scratch = picasso_malloc(sizeof(picasso__alpha_run) * w);
+    size_t capacity = 0;
+    if (!ps || !scratch) goto fail;
+
+    ps->width = w;
+    ps->height = h;
+    ps->premultiplied = premul;
+    ps->pixels = picasso_malloc((size_t)w * h * sizeof(uint32_t));
+    ps->row_start = picasso_malloc(sizeof(uint32_t) * ((size_t)h + 1));
+    if (!ps->pixels || !ps->row_start) goto fail;
+
+    for (int y = 0; y < h; ++y) {
+        uint32_t *row = ps->pixels + (size_t)y * w;
+        if (src->format == PICASSO_FORMAT_RGB8) picasso__copy_rgb_span(row, picasso__view_row(src, y), w);
+        else                                    memcpy(row, picasso__view_row(src, y), (size_t)w * 4);
+
+        size_t n = picasso__encode_row(row, w, premul, scratch);
+        if (ps->run_count + n > capacity) {
+            size_t grown = PICASSO_MAX(capacity * 2, ps->run_count + n);
+            picasso__alpha_run *runs = picasso_realloc(ps->runs, grown * sizeof(picasso__alpha_run));
+            if (!runs) goto fail;
+            ps->runs = runs;
+            capacity = grown;
+        }
+        ps->row_start[y] = (uint32_t)ps->run_count;
+        if (n) memcpy(ps->runs + ps->run_count, scratch, n * sizeof(picasso__alpha_run));
+        ps->run_count += n;
     }
+    ps->row_start[h] = (uint32_t)ps->run_count;
+
+    picasso_free(scratch);
+    TRACE("Prepared sprite %dx%d, %zu runs", w, h, ps->run_count);
+    return ps;
+
+fail:
+    ERROR("Out of memory preparing %dx%d sprite", w, h);
+    picasso_free(scratch);
+    picasso_destroy_prepared_sprite(ps);
+    return NULL;
 }
-/* Creating the bounds for looping over, removing the logic from the draw functions */
-static bool picasso__clip_rect_to_bounds(picasso_backbuffer *bf, const picasso_rect *r,
-                                 picasso_draw_bounds *db)
+
+void picasso_destroy_prepared_sprite(picasso_prepared_sprite *ps)
 {
-    if (!r || r->width == 0 || r->height == 0)
-        return false;
+    if (!ps) return;
+    picasso_free(ps->pixels);
+    picasso_free(ps->row_start);
+    picasso_free(ps->runs);
+    picasso_free(ps);
+}
 
-    if (r->x >= (int)bf->width || r->y >= (int)bf->height ||
-        r->x + r->width <= 0 || r->y + r->height <= 0)
+picasso_view picasso_view_from_prepared_sprite(const picasso_prepared_sprite *ps)
+{
+    if (!ps) return (picasso_view){0};
+    return picasso_view_from_pixels(ps->pixels, ps->width, ps->height, (ptrdiff_t)ps->width * 4,
+                                    ps->premultiplied ? PICASSO_FORMAT_RGBA8_PREMUL : PICASSO_FORMAT_RGBA8);
+}
+
+// cx, cy is where the sprite's top left corner lands
+static void picasso__sprite_rows(const picasso__span_job *job, int y0, int y1)
+{
+    const picasso_prepared_sprite *ps = job->sprite;
+    int lo = job->bounds.x0 - job->cx, hi = job->bounds.x1 - job->cx; // visible sprite columns
+
+    for (int y = y0; y < y1; ++y) {
+        int sy = y - job->cy;
+        uint32_t *row = picasso__row(job->bf, y);
+        const uint32_t *src = ps->pixels + (size_t)sy * ps->width;
+
+        for (uint32_t r = ps->row_start[sy]; r < ps->row_start[sy + 1]; ++r) {
+            const picasso__alpha_run *run = &ps->runs[r];
+            if (run->x >= hi) break;
+            int x0 = PICASSO_MAX((int)run->x, lo);
+            int x1 = PICASSO_MIN(run->x + run->len, hi);
+            if (x0 >= x1) continue;
+
+            if (run->kind == PICASSO__RUN_OPAQUE) {
+                memcpy(row + (job->cx + x0), src + x0, (size_t)(x1 - x0) * sizeof(uint32_t));
+            } else if (x1 - x0 < 4) {
+                // Antialiased edges are mostly a pixel or two, not worth a kernel call
+                for (int x = x0; x < x1; ++x) {
+                    uint32_t *d = row + (job->cx + x);
+                    if (ps->premultiplied)  *d = picasso__blend_pixel_premul(*d, src[x]);
+                    else if (!job->premul) *d = picasso__blend_pixel(*d, src[x]);
+                    else                   *d = picasso__blend_pixel_premul(*d, picasso__premultiply(src[x]));
+                }
+            } else {
+                picasso__blend_rgba_span(row + (job->cx + x0), (const uint8_t *)(src + x0), (size_t)(x1 - x0),
+                                         ps->premultiplied, job->premul);
+            }
+        }
+    }
+}
+
+void picasso_blit_prepared_sprite(picasso_backbuffer *dst, const picasso_prepared_sprite *ps, int x, int y)
+{
+    if (!dst || !dst->pixels || !ps) return;
+
+    picasso_draw_bounds bounds;
+    if (!picasso__clip_rect_to_bounds(dst, &(picasso_rect){ x, y, ps->width, ps->height }, &bounds)) return;
+    picasso__damage(dst, bounds);
+
+    picasso__span_job job = {
+        .bf = dst, .bounds = bounds, .cx = x, .cy = y, .sprite = ps, .premul = dst->premultiplied,
+    };
+    picasso__for_each_band(picasso__sprite_rows, &job);
+}
+
+// --------------------------------------------------------
+// Sprite batches
+// --------------------------------------------------------
+
+// An entry that survived culling, with where it lands already clipped
+typedef struct {
+    const picasso_sprite_batch_entry *entry;
+    size_t index;             // submission order, keeps the sort stable
+    picasso_draw_bounds bounds;
+} picasso__batch_item;
+
+static int picasso__compare_batch_items(const void *a, const void *b)
+{
+    const picasso__batch_item *x = a, *y = b;
+    if (x->entry->layer != y->entry->layer) return x->entry->layer < y->entry->layer ? -1 : 1;
+    uintptr_t sx = (uintptr_t)x->entry->sheet, sy = (uintptr_t)y->entry->sheet;
+    if (sx != sy) return sx < sy ? -1 : 1;
+    return x->index < y->index ? -1 : x->index > y->index;
+}
+
+// Rows y0 to y1 of one item, on whatever thread the caller is
+static void picasso__draw_batch_item(picasso_backbuffer *dst, const picasso__batch_item *item, int y0, int y1)
+{
+    const picasso_sprite_batch_entry *e = item->entry;
+    picasso_view src = picasso_view_from_sprite(e->sheet, e->frame);
+    if (e->flags & PICASSO_SPRITE_FLIP_Y) {
+        src.pixels += (ptrdiff_t)(src.height - 1) * src.stride;
+        src.stride = -src.stride;
+    }
+    picasso__span_job job = {
+        .bf = dst, .bounds = item->bounds, .cx = e->x, .cy = e->y, .src = &src,
+        .premul = dst->premultiplied, .flip_x = (e->flags & PICASSO_SPRITE_FLIP_X) != 0,
+        .tint = (e->flags & PICASSO_SPRITE_TINT) ? &e->tint : NULL,
+    };
+    y0 = PICASSO_MAX(y0, item->bounds.y0);
+    y1 = PICASSO_MIN(y1, item->bounds.y1);
+    if (y0 < y1) picasso__blit_rows(&job, y0, y1);
+}
+
+/* Bands of rows, each with the list of items that touch it in draw order.
+ * A band draws its items clipped to its own rows, so bands never overlap */
+typedef struct {
+    picasso_backbuffer *dst;
+    const picasso__batch_item *items;
+    const size_t *bin_start;  // band b draws bin_items[bin_start[b]] up to bin_start[b + 1]
+    const size_t *bin_items;
+    int rows_per_band;
+} picasso__batch_task;
+
+static void picasso__run_batch_band(void *user, int band)
+{
+    const picasso__batch_task *task = user;
+    int y0 = band * task->rows_per_band, y1 = y0 + task->rows_per_band;
+    for (size_t i = task->bin_start[band]; i < task->bin_start[band + 1]; ++i) {
+        picasso__draw_batch_item(task->dst, &task->items[task->bin_items[i]], y0, y1);
+    }
+}
+
+// Sorting and binning happen on the caller, false when it ran out of memory
+static bool picasso__draw_batch_parallel(picasso_backbuffer *dst, const picasso__batch_item *items,
+                                         size_t count, int threads)
+{
+    int height = (int)dst->height;
+    int bands = PICASSO_MIN(height, threads * 4);
+    int rows_per_band = (height + bands - 1) / bands;
+    bands = (height + rows_per_band - 1) / rows_per_band;
+
+    size_t entries = 0;
+    for (size_t i = 0; i < count; ++i) {
+        entries += (size_t)((items[i].bounds.y1 - 1) / rows_per_band - items[i].bounds.y0 / rows_per_band + 1);
+    }
+    size_t *bin_start = picasso_calloc((size_t)bands + 1, sizeof(size_t));
+    size_t *bin_items = picasso_malloc(entries * sizeof(size_t));
+    size_t *fill = picasso_malloc((size_t)bands * sizeof(size_t));
+    if (!bin_start || !bin_items || !fill) {
+        picasso_free(bin_start);
+        picasso_free(bin_items);
+        picasso_free(fill);
         return false;
+    }
 
-    db->x0 = (r->x > 0) ? r->x : 0;
-    db->y0 = (r->y > 0) ? r->y : 0;
-    db->x1 = (r->x + r->width < (int)bf->width) ? r->x + r->width : (int)bf->width;
-    db->y1 = (r->y + r->height < (int)bf->height) ? r->y + r->height : (int)bf->height;
+    for (size_t i = 0; i < count; ++i) {
+        for (int b = items[i].bounds.y0 / rows_per_band; b <= (items[i].bounds.y1 - 1) / rows_per_band; ++b) {
+            bin_start[b + 1]++;
+        }
+    }
+    for (int b = 0; b < bands; ++b) {
+        bin_start[b + 1] += bin_start[b];
+        fill[b] = bin_start[b];
+    }
+    for (size_t i = 0; i < count; ++i) {
+        for (int b = items[i].bounds.y0 / rows_per_band; b <= (items[i].bounds.y1 - 1) / rows_per_band; ++b) {
+            bin_items[fill[b]++] = i;
+        }
+    }
 
+    picasso__batch_task task = { dst, items, bin_start, bin_items, rows_per_band };
+    picasso_parallel_for(bands, picasso__run_batch_band, &task);
+    picasso_free(bin_start);
+    picasso_free(bin_items);
+    picasso_free(fill);
     return true;
 }
 
-static inline uint32_t picasso__blend_pixel(uint32_t dst, uint32_t src)
+/* Entries are checked and culled once, up front, then drawn straight through
+ * the blit rows without going back through the public entry points */
+void picasso_draw_sprite_batch(picasso_backbuffer *dst, const picasso_sprite_batch_entry *entries,
+                               size_t count, bool parallel)
 {
-    uint8_t sa = (src >> 24) & 0xFF;
-    if (sa == 255) return src;
-    if (sa == 0) return dst;
-
-    uint8_t sr = src & 0xFF;
-    uint8_t sg = (src >> 8) & 0xFF;
-    uint8_t sb = (src >> 16) & 0xFF;
+    if (!dst || !dst->pixels || !entries || count == 0) return;
 
-    uint8_t dr = dst & 0xFF;
-    uint8_t dg = (dst >> 8) & 0xFF;
-    uint8_t db = (dst >> 16) & 0xFF;
+    picasso__batch_item *items = picasso_malloc(count * sizeof(picasso__batch_item));
+    if (!items) {
+        ERROR("Failed to allocate a batch of %zu sprites", count);
+        return;
+    }
 
-    uint8_t r = (sr * sa + dr * (255 - sa)) / 255;
-    uint8_t g = (sg * sa + dg * (255 - sa)) / 255;
-    uint8_t b = (sb * sa + db * (255 - sa)) / 255;
+    size_t visible = 0, pixels = 0;
+    for (size_t i = 0; i < count; ++i) {
+        const picasso_sprite_batch_entry *e = &entries[i];
+        if (!e->sheet || !e->sheet->pixels || e->frame < 0 || e->frame >= e->sheet->frame_count) continue;
+        const picasso_sprite *f = &e->sheet->frames[e->frame];
+        picasso_draw_bounds bounds;
+        if (!picasso__clip_rect_to_bounds(dst, &(picasso_rect){ e->x, e->y, f->width, f->height }, &bounds)) continue;
+        if ((e->flags & PICASSO_SPRITE_TINT) && e->tint.a == 0) continue;
+        items[visible++] = (picasso__batch_item){ e, i, bounds };
+        pixels += (size_t)(bounds.x1 - bounds.x0) * (size_t)(bounds.y1 - bounds.y0);
+    }
+    qsort(items, visible, sizeof(picasso__batch_item), picasso__compare_batch_items);
+    for (size_t i = 0; i < visible; ++i) picasso__damage(dst, items[i].bounds);
 
-    return (0xFF << 24) | (b << 16) | (g << 8) | r;
+    int threads;
+    if (parallel && visible > 1 && pixels >= picasso_get_parallel_threshold() &&
+        (threads = picasso_get_thread_count()) > 1 &&
+        picasso__draw_batch_parallel(dst, items, visible, threads)) {
+        picasso_free(items);
+        return;
+    }
+    for (size_t i = 0; i < visible; ++i) {
+        picasso__draw_batch_item(dst, &items[i], items[i].bounds.y0, items[i].bounds.y1);
+    }
+    picasso_free(items);
 }
+
 // --------------------------------------------------------
-// Backbuffer operations
+// Nine patches
 // --------------------------------------------------------
 
+/* Regions are numbered row by row, 0 to 2 the top corners and edge, 4 the
+ * center. One that is a single color is drawn as a fill */
+struct picasso_nine_patch {
+    int width, height;
+    int left, top, right, bottom;
+    picasso_nine_patch_mode mode;
+    uint32_t *pixels;          // width * height, rows packed
+    picasso_format format;     // RGBA8 or RGBA8_PREMUL, RGB sources are widened
+    bool solid[9];
+    color solid_color[9];
+};
 
-picasso_backbuffer* picasso_create_backbuffer(int width, int height)
+/* A fill has to give the same pixels a blit would. Straight colors always
+ * do, premultiplied ones only when they survive the trip to straight and back,
+ * and then only onto premultiplied targets */
+static bool picasso__solid_region(const picasso_nine_patch *np, int x0, int y0, int x1, int y1, color *out)
+{
+    if (x0 >= x1 || y0 >= y1) return false;
+    uint32_t first = np->pixels[(size_t)y0 * np->width + x0];
+    for (int y = y0; y < y1; ++y) {
+        const uint32_t *row = np->pixels + (size_t)y * np->width;
+        for (int x = x0; x < x1; ++x) {
+            if (row[x] != first) return false;
+        }
+    }
+    if (np->format == PICASSO_FORMAT_RGBA8_PREMUL) {
+        uint32_t straight = picasso__unpremultiply(first);
+        if (picasso__premultiply(straight) != first) return false;
+        first = straight;
+    }
+    *out = u32_to_color(first);
+    return true;
+}
+
+picasso_nine_patch *picasso_nine_patch_create(const picasso_view *src, int left, int top, int right,
+                                              int bottom, picasso_nine_patch_mode mode)
 {
-    if (width <= 0 || height <= 0) {
+    if (!src || !src->pixels || src->width <= 0 || src->height <= 0) return NULL;
+    if (left < 0 || top < 0 || right < 0 || bottom < 0 ||
+        left + right > src->width || top + bottom > src->height) {
+        ERROR("Nine patch margins %d %d %d %d do not fit %dx%d", left, top, right, bottom,
+              src->width, src->height);
+        return NULL;
+    }
+    if (mode != PICASSO_NINE_PATCH_STRETCH && mode != PICASSO_NINE_PATCH_TILE) {
+        WARN("Unknown nine patch mode %d", (int)mode);
         return NULL;
     }
 
-    picasso_backbuffer* bf = picasso_malloc(sizeof(picasso_backbuffer));
-    if (!bf) return NULL;
+    int w = src->width, h = src->height;
+    picasso_nine_patch *np = picasso_calloc(1, sizeof(picasso_nine_patch));
+    if (!np || !(np->pixels = picasso_malloc((size_t)w * h * sizeof(uint32_t)))) {
+        ERROR("Out of memory building %dx%d nine patch", w, h);
+        picasso_free(np);
+        return NULL;
+    }
+    np->width = w;
+    np->height = h;
+    np->left = left;
+    np->top = top;
+    np->right = right;
+    np->bottom = bottom;
+    np->mode = mode;
+    np->format = src->format == PICASSO_FORMAT_RGBA8_PREMUL ? PICASSO_FORMAT_RGBA8_PREMUL : PICASSO_FORMAT_RGBA8;
+    for (int y = 0; y < h; ++y) {
+        uint32_t *row = np->pixels + (size_t)y * w;
+        if (src->format == PICASSO_FORMAT_RGB8) picasso__copy_rgb_span(row, picasso__view_row(src, y), w);
+        else                                    memcpy(row, picasso__view_row(src, y), (size_t)w * 4);
+    }
 
-    bf->width = width;
-    bf->height = height;
-    bf->pitch = width * sizeof(uint32_t); // 4 bytes per pixel
-    bf->pixels = picasso_calloc(width * height, sizeof(uint32_t));
+    int xs[4] = { 0, left, w - right, w };
+    int ys[4] = { 0, top, h - bottom, h };
+    for (int i = 0; i < 9; ++i) {
+        int c = i % 3, r = i / 3;
+        np->solid[i] = picasso__solid_region(np, xs[c], ys[r], xs[c + 1], ys[r + 1], &np->solid_color[i]);
+    }
+    TRACE("Nine patch %dx%d, center %s", w, h, np->solid[4] ? "solid" : "image");
+    return np;
+}
 
-    if (!bf->pixels) {
-        picasso_free(bf);
+void picasso_nine_patch_destroy(picasso_nine_patch *np)
+{
+    if (!np) return;
+    picasso_free(np->pixels);
+    picasso_free(np);
+}
+
+/* Source repeated from cx, cy on, clipped to bounds. Narrow sources are laid
+ * out several times over in a chunk first, so each blit covers a decent
+ * stretch of the row instead of a few pixels */
+static void picasso__tile_rows(const picasso__span_job *job, int y0, int y1)
+{
+    const picasso_view *src = job->src;
+    int w = src->width;
+    uint32_t chunk[256];
+    int repeat = w < 64 ? 256 / w * w : 0;
+
+    for (int y = y0; y < y1; ++y) {
+        uint32_t *dst = picasso__row(job->bf, y);
+        const uint32_t *src_row = (const uint32_t *)picasso__view_row(src, (y - job->cy) % src->height);
+        int period = w;
+        if (repeat) {
+            for (int x = 0; x < repeat; x += w) memcpy(chunk + x, src_row, (size_t)w * sizeof(uint32_t));
+            src_row = chunk;
+            period = repeat;
+        }
+
+        int sx = (job->bounds.x0 - job->cx) % period;
+        for (int x = job->bounds.x0; x < job->bounds.x1; sx = 0) {
+            int n = PICASSO_MIN(period - sx, job->bounds.x1 - x);
+            picasso__blit_span(job, dst + x, (const uint8_t *)(src_row + sx), (size_t)n, src->format);
+            x += n;
+        }
+    }
+}
+
+static void picasso__tile_view(picasso_backbuffer *bf, const picasso_view *src, picasso_rect r)
+{
+    picasso_draw_bounds bounds;
+    if (!picasso__clip_rect_to_bounds(bf, &r, &bounds)) return;
+    picasso__damage(bf, bounds);
+
+    picasso__span_job job = { .bf = bf, .bounds = bounds, .cx = r.x, .cy = r.y, .src = src,
+                              .premul = bf->premultiplied };
+    picasso__for_each_band(picasso__tile_rows, &job);
+}
+
+/* A rect smaller than the margins shares it out between them, corners are
+ * then cut rather than squeezed */
+void picasso_draw_nine_patch(picasso_backbuffer *bf, const picasso_nine_patch *np, picasso_rect rect)
+{
+    if (!bf || !bf->pixels || !np) return;
+    picasso__normalize_rect(&rect);
+    if (rect.width <= 0 || rect.height <= 0) return;
+
+    int l = np->left, r = np->right, t = np->top, b = np->bottom;
+    if (l + r > rect.width) {
+        l = (int)((long long)rect.width * l / (l + r));
+        r = rect.width - l;
+    }
+    if (t + b > rect.height) {
+        t = (int)((long long)rect.height * t / (t + b));
+        b = rect.height - t;
+    }
+
+    // Column and row edges on either side, source corners cut the same way
+    int sx[4] = { 0, np->left, np->width - np->right, np->width };
+    int sy[4] = { 0, np->top, np->height - np->bottom, np->height };
+    int s0x[3] = { 0, sx[1], np->width - r }, s1x[3] = { l, sx[2], np->width };
+    int s0y[3] = { 0, sy[1], np->height - b }, s1y[3] = { t, sy[2], np->height };
+    int dx[4] = { rect.x, rect.x + l, rect.x + rect.width - r, rect.x + rect.width };
+    int dy[4] = { rect.y, rect.y + t, rect.y + rect.height - b, rect.y + rect.height };
+
+    picasso_view view = picasso_view_from_pixels(np->pixels, np->width, np->height,
+                                                 (ptrdiff_t)np->width * 4, np->format);
+    // Premultiplied blits onto straight targets round differently from a fill
+    bool fills = np->format != PICASSO_FORMAT_RGBA8_PREMUL || bf->premultiplied;
+    for (int i = 0; i < 9; ++i) {
+        int c = i % 3, row = i / 3;
+        picasso_rect to = { dx[c], dy[row], dx[c + 1] - dx[c], dy[row + 1] - dy[row] };
+        picasso_rect from = { s0x[c], s0y[row], s1x[c] - s0x[c], s1y[row] - s0y[row] };
+        if (to.width <= 0 || to.height <= 0 || from.width <= 0 || from.height <= 0) continue;
+
+        if (np->solid[i] && fills) {
+            picasso_fill_rect(bf, &to, np->solid_color[i]);
+        } else if (c != 1 && row != 1) {
+            picasso_blit_view_rect(bf, &view, from, to.x, to.y, PICASSO_BLEND_NORMAL);
+        } else {
+            picasso_view part = picasso_subview(&view, from);
+            if (np->mode == PICASSO_NINE_PATCH_TILE) picasso__tile_view(bf, &part, to);
+            else picasso_blit_scaled(bf, &part, to, PICASSO_FILTER_NEAREST);
+        }
+    }
+}
+
+// --------------------------------------------------------
+// Tilemaps
+// --------------------------------------------------------
+
+#define PICASSO__TILEMAP_CHUNK 16 // tiles per side of a cached chunk, fewer for big tiles
+
+struct picasso_tilemap {
+    const picasso_sprite_sheet *sheet;
+    int columns, rows;
+    int32_t *tiles;            // frame per cell, row by row
+    bool *opaque;              // per sheet frame, every pixel has alpha 255
+    bool cache;
+    int chunk_tiles_x, chunk_tiles_y; // tiles per chunk, 0 when one tile is already too big to cache
+    int chunk_columns, chunk_rows;
+    picasso_prepared_sprite **chunks; // NULL until first drawn, and again once a tile in it changes
+};
+
+picasso_tilemap *picasso_tilemap_create(const picasso_sprite_sheet *sheet, int columns, int rows)
+{
+    if (!sheet || !sheet->pixels || !sheet->frames || columns <= 0 || rows <= 0) return NULL;
+    if ((long long)columns * sheet->frame_width > INT32_MAX || (long long)rows * sheet->frame_height > INT32_MAX) {
+        ERROR("Tilemap of %dx%d tiles is too large", columns, rows);
         return NULL;
     }
 
-    return bf;
+    picasso_tilemap *map = picasso_calloc(1, sizeof(picasso_tilemap));
+    if (!map) goto fail;
+    map->sheet = sheet;
+    map->columns = columns;
+    map->rows = rows;
+    // Chunks become prepared sprites, which stop at PICASSO_MAX_DIM
+    map->chunk_tiles_x = PICASSO_MIN(PICASSO__TILEMAP_CHUNK, PICASSO_MAX_DIM / sheet->frame_width);
+    map->chunk_tiles_y = PICASSO_MIN(PICASSO__TILEMAP_CHUNK, PICASSO_MAX_DIM / sheet->frame_height);
+    if (map->chunk_tiles_x && map->chunk_tiles_y) {
+        map->chunk_columns = (columns + map->chunk_tiles_x - 1) / map->chunk_tiles_x;
+        map->chunk_rows = (rows + map->chunk_tiles_y - 1) / map->chunk_tiles_y;
+    }
+    map->tiles = picasso_malloc((size_t)columns * rows * sizeof(int32_t));
+    map->opaque = picasso_calloc((size_t)sheet->frame_count, sizeof(bool));
+    if (!map->tiles || !map->opaque) goto fail;
+
+    for (size_t i = 0; i < (size_t)columns * rows; ++i) map->tiles[i] = PICASSO_TILE_NONE;
+    for (int f = 0; f < sheet->frame_count; ++f) {
+        const picasso_sprite *fr = &sheet->frames[f];
+        bool opaque = true;
+        for (int y = 0; y < fr->height && opaque; ++y) {
+            const uint32_t *row = sheet->pixels + (size_t)(fr->y + y) * sheet->sheet_width + fr->x;
+            for (int x = 0; x < fr->width && opaque; ++x) opaque = (row[x] >> 24) == 255;
+        }
+        map->opaque[f] = opaque;
+    }
+    TRACE("Tilemap %dx%d of %dx%d tiles", columns, rows, sheet->frame_width, sheet->frame_height);
+    return map;
+
+fail:
+    ERROR("Out of memory creating %dx%d tilemap", columns, rows);
+    picasso_tilemap_destroy(map);
+    return NULL;
 }
 
-void picasso_destroy_backbuffer(picasso_backbuffer* bf)
+static void picasso__tilemap_drop_chunks(picasso_tilemap *map)
 {
-    if (!bf) return;
-    if (bf->pixels) {
-        picasso_free(bf->pixels);
-        bf->pixels = NULL;
+    if (!map->chunks) return;
+    for (int i = 0; i < map->chunk_columns * map->chunk_rows; ++i) {
+        picasso_destroy_prepared_sprite(map->chunks[i]);
     }
-    picasso_free(bf);
+    picasso_free(map->chunks);
+    map->chunks = NULL;
 }
 
-void picasso_blit_bitmap(picasso_backbuffer* dst,
-                         void* src_pixels, int src_w, int src_h,
-                         int x, int y)
+void picasso_tilemap_destroy(picasso_tilemap *map)
+{
+    if (!map) return;
+    picasso__tilemap_drop_chunks(map);
+    picasso_free(map->tiles);
+    picasso_free(map->opaque);
+    picasso_free(map);
+}
+
+void picasso_tilemap_set_tile(picasso_tilemap *map, int column, int row, int frame)
 {
-    if (!dst || !src_pixels || !dst->pixels) return;
+    if (!map || column < 0 || row < 0 || column >= map->columns || row >= map->rows) return;
+    if (frame != PICASSO_TILE_NONE && (frame < 0 || frame >= map->sheet->frame_count)) {
+        WARN("Frame %d is not in the sheet, tile left as it was", frame);
+        return;
+    }
+
+    int32_t *cell = &map->tiles[(size_t)row * map->columns + column];
+    if (*cell == frame) return;
+    *cell = frame;
+    if (map->chunks) {
+        int i = row / map->chunk_tiles_y * map->chunk_columns + column / map->chunk_tiles_x;
+        picasso_destroy_prepared_sprite(map->chunks[i]);
+        map->chunks[i] = NULL;
+    }
+}
+
+int picasso_tilemap_get_tile(const picasso_tilemap *map, int column, int row)
+{
+    if (!map || column < 0 || row < 0 || column >= map->columns || row >= map->rows) return PICASSO_TILE_NONE;
+    return map->tiles[(size_t)row * map->columns + column];
+}
 
-    int dst_w = dst->width;
-    int dst_h = dst->height;
+void picasso_tilemap_set_cache(picasso_tilemap *map, bool enable)
+{
+    if (!map) return;
+    if (enable && (!map->chunk_tiles_x || !map->chunk_tiles_y)) {
+        WARN("Tiles of %dx%d are over the %d pixel sprite limit, not caching them",
+             map->sheet->frame_width, map->sheet->frame_height, PICASSO_MAX_DIM);
+        return;
+    }
+    map->cache = enable;
+    if (!enable) picasso__tilemap_drop_chunks(map);
+}
+
+/* n pixels of a pattern period pixels long, starting phase pixels into it.
+ * Past the first period the span copies itself, twice as much each time */
+static void picasso__repeat_span(uint32_t *dst, const uint32_t *pattern, int period, int phase, int n)
+{
+    int first = PICASSO_MIN(period - phase, n);
+    memcpy(dst, pattern + phase, (size_t)first * sizeof(uint32_t));
+    dst += first;
+    n -= first;
+    if (n == 0) return;
+
+    int done = PICASSO_MIN(period, n);
+    memcpy(dst, pattern, (size_t)done * sizeof(uint32_t));
+    while (done < n) {
+        int count = PICASSO_MIN(done, n - done);
+        memcpy(dst + done, dst, (size_t)count * sizeof(uint32_t));
+        done += count;
+    }
+}
 
-    for (int row = 0; row < src_h; ++row)
-    {
-        int dst_y = y + row;
-        if (dst_y < 0 || dst_y >= dst_h) continue;
+/* Bounds never leave the map. Neighbouring cells with the same tile are
+ * taken as one run: opaque runs are copied, tile row after tile row, the
+ * rest is blended a tile at a time */
+static void picasso__tilemap_rows(const picasso__span_job *job, int y0, int y1)
+{
+    const picasso_tilemap *map = job->tilemap;
+    const picasso_sprite_sheet *sheet = map->sheet;
+    int tw = sheet->frame_width, th = sheet->frame_height;
+    picasso_format format = sheet->premultiplied ? PICASSO_FORMAT_RGBA8_PREMUL : PICASSO_FORMAT_RGBA8;
+    int c0 = (job->bounds.x0 - job->cx) / tw, c1 = (job->bounds.x1 - 1 - job->cx) / tw;
 
-        for (int col = 0; col < src_w; ++col)
-        {
-            int dst_x = x + col;
-            if (dst_x < 0 || dst_x >= dst_w) continue;
+    for (int y = y0; y < y1; ++y) {
+        int my = y - job->cy;
+        const int32_t *tiles = map->tiles + (size_t)(my / th) * map->columns;
+        uint32_t *row = picasso__row(job->bf, y);
 
-            uint32_t* src = (uint32_t*)src_pixels;
-            uint32_t* dst_pixel = &dst->pixels[dst_y * dst->width + dst_x];
-            uint32_t  src_pixel = src[row * src_w + col];
+        for (int c = c0; c <= c1;) {
+            int32_t f = tiles[c];
+            int run = 1;
+            while (c + run <= c1 && tiles[c + run] == f) run++;
+            int x0 = PICASSO_MAX(job->cx + c * tw, job->bounds.x0);
+            int x1 = PICASSO_MIN(job->cx + (c + run) * tw, job->bounds.x1);
+            c += run;
+            if (f == PICASSO_TILE_NONE) continue;
 
-            *dst_pixel = picasso__blend_pixel(*dst_pixel, src_pixel);
+            const picasso_sprite *fr = &sheet->frames[f];
+            const uint32_t *src = sheet->pixels + (size_t)(fr->y + my % th) * sheet->sheet_width + fr->x;
+            int phase = (x0 - job->cx) % tw;
+            if (map->opaque[f]) {
+                picasso__repeat_span(row + x0, src, tw, phase, x1 - x0);
+                continue;
+            }
+            for (int x = x0; x < x1; phase = 0) {
+                int n = PICASSO_MIN(tw - phase, x1 - x);
+                picasso__blit_span(job, row + x, (const uint8_t *)(src + phase), (size_t)n, format);
+                x += n;
+            }
         }
     }
 }
 
-void* picasso_backbuffer_pixels(picasso_backbuffer* bf)
+/* Chunks are the tiles' own pixels laid out side by side, in the sheet's
+ * format and with empty cells left transparent, kept as prepared sprites so
+ * gaps are skipped and opaque stretches copied. Nothing is blended until the
+ * chunk is drawn, so it comes out exactly like the tiles drawn one by one */
+static picasso_prepared_sprite *picasso__tilemap_chunk(picasso_tilemap *map, int cx, int cy)
 {
-    if (!bf) return NULL;
-    return (void*)bf->pixels;
+    picasso_prepared_sprite **slot = &map->chunks[cy * map->chunk_columns + cx];
+    if (*slot) return *slot;
+
+    const picasso_sprite_sheet *sheet = map->sheet;
+    int tw = sheet->frame_width, th = sheet->frame_height;
+    int c0 = cx * map->chunk_tiles_x, r0 = cy * map->chunk_tiles_y;
+    int columns = PICASSO_MIN(map->chunk_tiles_x, map->columns - c0);
+    int rows = PICASSO_MIN(map->chunk_tiles_y, map->rows - r0);
+    int w = columns * tw, h = rows * th;
+    uint32_t *pixels = picasso_calloc((size_t)w * h, sizeof(uint32_t));
+    if (!pixels) return NULL;
+
+    for (int r = 0; r < rows; ++r) {
+        for (int c = 0; c < columns; ++c) {
+            int32_t f = map->tiles[(size_t)(r0 + r) * map->columns + c0 + c];
+            if (f == PICASSO_TILE_NONE) continue;
+
+            const picasso_sprite *fr = &sheet->frames[f];
+            for (int y = 0; y < th; ++y) {
+                memcpy(pixels + (size_t)(r * th + y) * w + (size_t)c * tw,
+                       sheet->pixels + (size_t)(fr->y + y) * sheet->sheet_width + fr->x,
+                       (size_t)tw * sizeof(uint32_t));
+            }
+        }
+    }
+
+    picasso_view view = picasso_view_from_pixels(pixels, w, h, (ptrdiff_t)w * 4,
+                                                 sheet->premultiplied ? PICASSO_FORMAT_RGBA8_PREMUL
+                                                                      : PICASSO_FORMAT_RGBA8);
+    *slot = picasso_prepare_sprite(&view);
+    picasso_free(pixels);
+    return *slot;
 }
 
-void picasso_clear_backbuffer(picasso_backbuffer* bf)
+void picasso_draw_tilemap(picasso_backbuffer *bf, picasso_tilemap *map, picasso_rect viewport,
+                          int scroll_x, int scroll_y)
 {
-    if (!bf || !bf->pixels) {
-        WARN("Attempted to clear NULL backbuffer");
+    if (!bf || !bf->pixels || !map) return;
+    picasso__normalize_rect(&viewport);
+
+    // Only what is inside the viewport, the target and the map all at once
+    int tw = map->sheet->frame_width, th = map->sheet->frame_height;
+    int ox = viewport.x - scroll_x, oy = viewport.y - scroll_y;
+    picasso_draw_bounds bounds, area;
+    if (!picasso__clip_rect_to_bounds(bf, &viewport, &bounds)) return;
+    if (!picasso__clip_rect_to_bounds(bf, &(picasso_rect){ ox, oy, map->columns * tw, map->rows * th }, &area)) return;
+    bounds.x0 = PICASSO_MAX(bounds.x0, area.x0);
+    bounds.y0 = PICASSO_MAX(bounds.y0, area.y0);
+    bounds.x1 = PICASSO_MIN(bounds.x1, area.x1);
+    bounds.y1 = PICASSO_MIN(bounds.y1, area.y1);
+    if (bounds.x0 >= bounds.x1 || bounds.y0 >= bounds.y1) return;
+    picasso__damage(bf, bounds);
+
+    if (map->cache && !map->chunks) {
+        map->chunks = picasso_calloc((size_t)map->chunk_columns * map->chunk_rows, sizeof(picasso_prepared_sprite *));
+        if (!map->chunks) WARN("Out of memory for the tilemap chunk cache, drawing tiles directly");
+    }
+    if (!map->cache || !map->chunks) {
+        picasso__span_job job = { .bf = bf, .bounds = bounds, .cx = ox, .cy = oy, .tilemap = map,
+                                  .premul = bf->premultiplied };
+        picasso__for_each_band(picasso__tilemap_rows, &job);
         return;
     }
 
-    for (size_t i = 0; i <  bf->width * bf->height; ++i) {
-        bf->pixels[i] = color_to_u32(CLEAR_BACKGROUND);
+    int cw = map->chunk_tiles_x * tw, ch = map->chunk_tiles_y * th;
+    for (int cy = (bounds.y0 - oy) / ch; cy <= (bounds.y1 - 1 - oy) / ch; ++cy) {
+        for (int cx = (bounds.x0 - ox) / cw; cx <= (bounds.x1 - 1 - ox) / cw; ++cx) {
+            picasso_prepared_sprite *chunk = picasso__tilemap_chunk(map, cx, cy);
+            picasso__span_job job = { .bf = bf, .cx = ox + cx * cw, .cy = oy + cy * ch,
+                                      .premul = bf->premultiplied };
+            job.bounds.x0 = PICASSO_MAX(bounds.x0, job.cx);
+            job.bounds.y0 = PICASSO_MAX(bounds.y0, job.cy);
+            job.bounds.x1 = PICASSO_MIN(bounds.x1, job.cx + cw);
+            job.bounds.y1 = PICASSO_MIN(bounds.y1, job.cy + ch);
+            if (chunk) {
+                job.sprite = chunk;
+                picasso__for_each_band(picasso__sprite_rows, &job);
+            } else {
+                // No memory for this chunk, its tiles are drawn as they are
+                job.tilemap = map;
+                job.cx = ox;
+                job.cy = oy;
+                picasso__for_each_band(picasso__tilemap_rows, &job);
+            }
+        }
     }
 }
 
@@ -477,19 +4304,25 @@ void picasso_clear_backbuffer(picasso_backbuffer* bf)
 // --------------------------------------------------------
 
 void picasso_fill_rect(picasso_backbuffer *bf, picasso_rect *r, color c)
+{
+    picasso_fill_rect_blend(bf, r, c, PICASSO_BLEND_NORMAL);
+}
+
+void picasso_fill_rect_blend(picasso_backbuffer *bf, picasso_rect *r, color c, picasso_blend_mode mode)
 {
     picasso_draw_bounds bounds = {0};
+    if (!picasso__valid_blend_mode(mode)) return;
     picasso__normalize_rect(r);
+    if (mode == PICASSO_BLEND_COPY) {
+        picasso_clear_rect(bf, r, c);
+        return;
+    }
     if(!picasso__clip_rect_to_bounds(bf, r, &bounds)) return;
+    picasso__damage(bf, bounds);
 
-    uint32_t new_pixel = color_to_u32(c);
-
-    for (int y = bounds.y0; y < bounds.y1; ++y) {
-        for (int x = bounds.x0; x < bounds.x1; ++x) {
-            uint32_t *cur_pixel = &bf->pixels[y * bf->width + x];
-            *cur_pixel = picasso__blend_pixel(*cur_pixel, new_pixel);
-        }
-    }
+    picasso__span_job job = { .bf = bf, .bounds = bounds, .premul = bf->premultiplied };
+    picasso__solid_blend(bf, c, mode, &job.pixel, &job.blend);
+    picasso__for_each_band(picasso__fill_rows, &job);
 }
 
 /* This approach might be slightly wasteful, but it works! */
@@ -513,26 +4346,25 @@ void picasso_draw_rect(picasso_backbuffer *bf, picasso_rect *outer, int thicknes
 
     // Clip to draw bounds
     if (!picasso__clip_rect_to_bounds(bf, outer, &outer_bounds)) return;
+    picasso__damage(bf, outer_bounds);
 
-    if (!picasso__clip_rect_to_bounds(bf, &inner, &inner_bounds)) {
+    if (!picasso__clip_rect_to_bounds(bf, &inner, &inner_bounds) ||
+        inner_bounds.x0 >= inner_bounds.x1 || inner_bounds.y0 >= inner_bounds.y1) {
         inner_bounds = (picasso_draw_bounds){0};
     }
 
-    uint32_t new_pixel = color_to_u32(c);
+    uint32_t new_pixel = picasso__solid_pixel(bf, c);
+    bool premul = bf->premultiplied;
+    int x0 = outer_bounds.x0, x1 = outer_bounds.x1;
 
+    // Full rows above and below the hole, the two sides next to it
     for (int y = outer_bounds.y0; y < outer_bounds.y1; ++y) {
-        for (int x = outer_bounds.x0; x < outer_bounds.x1; ++x) {
-
-            bool inside_inner = (
-                    y >= inner_bounds.y0 && y < inner_bounds.y1 &&
-                    x >= inner_bounds.x0 && x < inner_bounds.x1
-                    );
-
-            if (inside_inner) continue;
-            else {
-                uint32_t *cur_pixel = &bf->pixels[y * bf->width + x];
-                *cur_pixel = picasso__blend_pixel(*cur_pixel, new_pixel);
-            }
+        uint32_t *row = picasso__row(bf, y);
+        if (y >= inner_bounds.y0 && y < inner_bounds.y1) {
+            picasso__blend_clipped(row, x0, inner_bounds.x0, x0, x1, new_pixel, premul);
+            picasso__blend_clipped(row, inner_bounds.x1, x1, x0, x1, new_pixel, premul);
+        } else {
+            picasso__blend_clipped(row, x0, x1, x0, x1, new_pixel, premul);
         }
     }
 }
@@ -553,53 +4385,53 @@ static inline picasso_rect picasso__make_circle_bounds(int x0, int y0, int radiu
 
 void picasso_fill_circle(picasso_backbuffer *bf, int x0, int y0, int radius, color c)
 {
+    picasso_fill_circle_blend(bf, x0, y0, radius, c, PICASSO_BLEND_NORMAL);
+}
+
+void picasso_fill_circle_blend(picasso_backbuffer *bf, int x0, int y0, int radius, color c,
+                               picasso_blend_mode mode)
+{
+    if (!picasso__valid_blend_mode(mode)) return;
     // create a box around the circle that is slightly larger then the radius
     // that is all we loop over, we clip to bounds
     picasso_draw_bounds bounds = {0};
     picasso_rect circle_box = picasso__make_circle_bounds(x0, y0, radius);
     if(!picasso__clip_rect_to_bounds(bf, &circle_box, &bounds)) return;
-
-    uint32_t new_pixel = color_to_u32(c);
+    picasso__damage(bf, bounds);
 
     // a^2 + b^2 = c^2
-    for (int y = bounds.y0; y < bounds.y1; ++y) {
-        for (int x = bounds.x0; x < bounds.x1; ++x) {
-            int dx = x - x0;
-            int dy = y - y0;
-            if((dx*dx + dy*dy <= radius*radius + radius)){
-                uint32_t *cur_pixel = &bf->pixels[y * bf->width + x];
-                *cur_pixel = picasso__blend_pixel(*cur_pixel, new_pixel);
-            }
-        }
-    }
+    picasso__span_job job = {
+        .bf = bf, .bounds = bounds, .premul = bf->premultiplied, .copy = mode == PICASSO_BLEND_COPY,
+        .cx = x0, .cy = y0, .min_d2 = 0, .max_d2 = radius * radius + radius,
+    };
+    picasso__solid_blend(bf, c, mode, &job.pixel, &job.blend);
+    picasso__for_each_band(picasso__circle_rows, &job);
 }
 void picasso_draw_circle(picasso_backbuffer *bf, int x0, int y0, int radius,int thickness, color c)
 {
     picasso_draw_bounds bounds = {0};
     picasso_rect circle_box = picasso__make_circle_bounds(x0, y0, radius);
     if (!picasso__clip_rect_to_bounds(bf, &circle_box, &bounds)) return;
-
-    uint32_t new_pixel = color_to_u32(c);
+    picasso__damage(bf, bounds);
 
     int outer = radius * radius;
     int inner = (radius - thickness) * (radius - thickness);
 
-    for (int y = bounds.y0; y < bounds.y1; ++y) {
-        for (int x = bounds.x0; x < bounds.x1; ++x) {
-            int dx = x - x0;
-            int dy = y - y0;
-            int dist2 = dx * dx + dy * dy;
-
-            if (dist2 >= inner+radius && dist2 <= outer+radius) {
-                uint32_t *cur_pixel = &bf->pixels[y * bf->width + x];
-                *cur_pixel = picasso__blend_pixel(*cur_pixel, new_pixel);
-            }
-        }
-    }
+    picasso__span_job job = {
+        .bf = bf, .bounds = bounds, .pixel = picasso__solid_pixel(bf, c), .premul = bf->premultiplied,
+        .cx = x0, .cy = y0, .min_d2 = inner + radius, .max_d2 = outer + radius,
+    };
+    picasso__for_each_band(picasso__circle_rows, &job);
 }
 void picasso_draw_line(picasso_backbuffer *bf, int x0, int y0, int x1, int y1, color c)
 {
-    uint32_t new_pixel = color_to_u32(c);
+    // y only ever steps down from y0, and never past y1
+    picasso_draw_bounds bounds;
+    picasso_rect line_box = { x0, y0, x1 - x0, PICASSO_MAX(y1 - y0, 0) + 1 };
+    if (x1 <= x0 || !picasso__clip_rect_to_bounds(bf, &line_box, &bounds)) return;
+    picasso__damage(bf, bounds);
+
+    uint32_t new_pixel = picasso__solid_pixel(bf, c);
 
     /* Bresenhams lines algorithm
      * */
@@ -608,7 +4440,8 @@ void picasso_draw_line(picasso_backbuffer *bf, int x0, int y0, int x1, int y1, c
     int D = 2*dy-dx;
     int y = y0;
     for(int i = x0; i < x1; ++i){
-        bf->pixels[y*bf->width + i] = new_pixel;
+        if (i >= 0 && i < (int)bf->width && y >= 0 && y < (int)bf->height)
+            picasso__row(bf, y)[i] = new_pixel;
         if (D > 0) {
             y++;
             D -= 2*dx;
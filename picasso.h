@@ -3,8 +3,10 @@
 /* Will support BMP, PPM, PNG and eventually JPG
  * */
 #include <stdint.h>
+#include <stddef.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <stdbool.h>
 
 /* -------------------- Image Object -------------------- */
 typedef struct {
@@ -13,13 +15,63 @@ typedef struct {
     int channels; // 3 = RGB, 4 = RGBA
     int row_stride;
     uint8_t *pixels;
+    bool premultiplied; // 4 channel pixels hold color already multiplied by alpha
 } picasso_image;
 
 /* -------------------- Custom Allocators -------------------- */
+/* Every allocation Picasso makes goes through the active allocator. Free is
+ * handed back the same size and alignment that alloc was asked for, and a
+ * block is always returned to the allocator that made it. Defaults to libc */
+typedef struct {
+    void *(*alloc)(void *user, size_t size, size_t alignment);
+    void  (*free)(void *user, void *ptr, size_t size, size_t alignment);
+    void *user;
+} picasso_allocator;
+
+// Install before other threads use Picasso. NULL restores libc
+void picasso_set_allocator(const picasso_allocator *allocator);
+// Overrides the global allocator on the calling thread only. NULL clears it
+void picasso_set_thread_allocator(const picasso_allocator *allocator);
+picasso_allocator picasso_get_allocator(void);
+
 void* picasso_calloc(size_t count, size_t size);
 void picasso_free(void *ptr);
 void *picasso_malloc(size_t size);
 void * picasso_realloc(void *ptr, size_t size);
+void *picasso_malloc_aligned(size_t size, size_t alignment);
+
+// Bytes Picasso keeps in front of each allocation (for alignments up to 64)
+#define PICASSO_ALLOC_OVERHEAD 64
+
+/// @brief Bump arena over a user supplied buffer. Freeing is a no-op (except
+/// for the most recent block), picasso_arena_reset() releases everything in O(1)
+typedef struct {
+    uint8_t *base;
+    size_t capacity;
+    size_t offset;   ///< Bytes currently in use
+    size_t peak;     ///< High water mark since init
+} picasso_arena;
+
+void picasso_arena_init(picasso_arena *arena, void *buffer, size_t capacity);
+void picasso_arena_reset(picasso_arena *arena);
+picasso_allocator picasso_arena_allocator(picasso_arena *arena);
+
+#define PICASSO_POOL_ALIGN 64
+
+/// @brief Fixed-size block pool over a user supplied buffer. Any request up
+/// to block_size bytes gets one block, picasso_pool_reset() is O(1)
+typedef struct {
+    uint8_t *base;
+    size_t block_size;   ///< Block stride, including PICASSO_ALLOC_OVERHEAD
+    size_t block_count;
+    size_t next;         ///< First block never handed out
+    size_t used;         ///< Blocks currently handed out
+    void *free_list;
+} picasso_pool;
+
+void picasso_pool_init(picasso_pool *pool, void *buffer, size_t buffer_size, size_t block_size);
+void picasso_pool_reset(picasso_pool *pool);
+picasso_allocator picasso_pool_allocator(picasso_pool *pool);
 
 /* --------- Binary Readers little endian utilities ----------- */
 uint8_t picasso_read_u8(const uint8_t *p);
@@ -31,8 +83,37 @@ int32_t  picasso_read_s32_le(const uint8_t *p);
 void *picasso_read_entire_file(const char *path, size_t *out_size);
 int picasso_write_file(const char *path, const void *data, size_t size);
 
+/* Image and backbuffer storage always starts on a cache line boundary */
+#define PICASSO_ALIGNMENT 64
+
+typedef enum {
+    PICASSO_ALLOC_DEFAULT  = 0,
+    PICASSO_ALLOC_PAD_ROWS = 1 << 0, // Pad each row to a multiple of PICASSO_ALIGNMENT bytes
+    PICASSO_ALLOC_HUGE_PAGES = 1 << 1, // Map pixels in 2 MB pages, pre-faulted. For 4K/8K sized buffers
+    PICASSO_ALLOC_PREMULTIPLIED = 1 << 2, // Backbuffer or RGBA image holding premultiplied alpha
+} picasso_alloc_flags;
+
+/* What kind of memory backs a buffer created with PICASSO_ALLOC_HUGE_PAGES */
+typedef enum {
+    PICASSO_PAGES_DEFAULT = 0,       // From the active allocator (not requested, or mapping failed)
+    PICASSO_PAGES_HUGE,              // Explicit 2 MB pages (MAP_HUGETLB, or superpages on macOS)
+    PICASSO_PAGES_TRANSPARENT_HUGE,  // Regular mapping advised as huge (MADV_HUGEPAGE)
+    PICASSO_PAGES_MAPPED,            // Regular pre-faulted mapping, huge pages refused
+} picasso_page_mode;
+
 void picasso_free_image(picasso_image *img);
 picasso_image *picasso_alloc_image(int width, int height, int channels);
+picasso_image *picasso_alloc_image_ex(int width, int height, int channels, uint32_t flags);
+
+/* Premultiplied alpha stores r*a, g*a, b*a. Blending it onto anything is a
+ * single multiply per channel, and filtering it does not bleed the color of
+ * transparent pixels into the edges. Conversions work in place when dst == src */
+void picasso_premultiply_pixels(uint8_t *dst, const uint8_t *src, size_t count);
+void picasso_unpremultiply_pixels(uint8_t *dst, const uint8_t *src, size_t count);
+void picasso_premultiply_image(picasso_image *img);
+void picasso_unpremultiply_image(picasso_image *img);
+// RGB <-> BGR, or RGBA <-> BGRA with channels = 4, in place
+void picasso_swap_rb(uint8_t *pixels, size_t count, int channels);
 
 /* -------------------- ICC Profile Support -------------------- */
 typedef enum {
@@ -126,7 +207,7 @@ const char* color_to_string(color c);
 
 /* -------------------- Format Section -------------------- */
 
-#define PICASSO_MAX_DIM 1<<14 // 16,384X16,384 *4 is over 1GB - that is enough
+#define PICASSO_MAX_DIM (1<<14) // 16,384X16,384 *4 is over 1GB - that is enough
 
 // Define BMP file header structures
 #pragma pack(push,1) //https://www.ibm.com/docs/no/zos/2.4.0?topic=descriptions-pragma-pack
@@ -194,8 +275,14 @@ typedef struct {
 #pragma pack(pop)
 
 
+typedef enum {
+    PICASSO_LOAD_DEFAULT     = 0,
+    PICASSO_LOAD_PREMULTIPLY = 1 << 0, // Premultiply RGBA images while loading
+} picasso_load_flags;
+
 /// @brief BMP functions
 picasso_image *picasso_load_bmp(const char *filename);
+picasso_image *picasso_load_bmp_ex(const char *filename, uint32_t flags);
 int picasso_save_to_bmp(bmp *image, const char *file_path, picasso_icc_profile profile);
 bmp *picasso_create_bmp_from_rgba(int width, int height, int channels, const uint8_t *pixel_data);
 int picasso_save_rgba_to_bmp(const char *file_path, int width, int height, int channels, const uint8_t *pixels, picasso_icc_profile profile);
@@ -203,6 +290,11 @@ int picasso_save_rgba_to_bmp(const char *file_path, int width, int height, int c
 /// @brief PPM functions
 picasso_image *picasso_load_ppm(const char *filename);
 int picasso_save_to_ppm(ppm *image, const char *file_path);
+int picasso_save_image_to_ppm(const picasso_image *img, const char *file_path);
+/* Writes 3 (RGB) or 4 (RGBA) channel pixels with any row stride in bytes,
+ * alpha is dropped in small chunks while streaming, no full copy is made */
+int picasso_save_pixels_to_ppm(const char *file_path, const uint8_t *pixels,
+                               int width, int height, int channels, size_t stride);
 
 
 /* ------------------- SpriteSheet Section -------------------- */
@@ -231,43 +323,409 @@ typedef struct {
     int frame_count;          ///< Total number of frames
 
     picasso_sprite* frames;   ///< Array of sprite metadata (x, y, width, height)
+    bool premultiplied;       ///< Pixels hold premultiplied alpha, false when created
 } picasso_sprite_sheet;
 
-void free_sprite_sheet(picasso_sprite_sheet* sheet);
+void picasso_destroy_sprite_sheet(picasso_sprite_sheet* sheet);
 picasso_sprite_sheet* picasso_create_sprite_sheet( uint32_t* pixels, int sheet_width, int sheet_height,
                                                     int frame_width, int frame_height,
                                                     int margin_x, int margin_y,
                                                     int spacing_x, int spacing_y);
 
 /* -------------------- Backbuffer Section -------------------- */
+typedef struct {
+    int x, y, width, height; // supporting negative values
+} picasso_rect;
+
+
+typedef struct {
+    int x0, y0, x1, y1;
+} picasso_draw_bounds;
+
+#define PICASSO_MAX_DAMAGE_RECTS 16
+
+/// @brief Areas drawn to since the last reset, merged into a bounded list
+typedef struct {
+    bool enabled;
+    int count;
+    picasso_draw_bounds rects[PICASSO_MAX_DAMAGE_RECTS];
+} picasso_damage;
 
 typedef struct {
     uint32_t* pixels;
-    uint32_t width, height, pitch;
+    uint32_t width, height, pitch; // pitch is in bytes, and can be more than width * 4
+    picasso_page_mode page_mode;   // what was granted for pixels
+    picasso_damage damage;         // off unless enabled with picasso_backbuffer_track_damage
+    bool premultiplied;            // pixels hold premultiplied alpha, see PICASSO_ALLOC_PREMULTIPLIED
 } picasso_backbuffer;
 
+/* How fills and blits combine with what is already there. NORMAL is the plain
+ * source over of picasso_fill_rect and friends, COPY just replaces. The others
+ * are computed on premultiplied color with the destination's own alpha, so
+ * they also work on transparent offscreen layers, straight or premultiplied */
+typedef enum {
+    PICASSO_BLEND_NORMAL,
+    PICASSO_BLEND_ADD,      // src + dst, saturated
+    PICASSO_BLEND_MULTIPLY, // src * dst
+    PICASSO_BLEND_SCREEN,   // src + dst - src * dst
+    PICASSO_BLEND_DARKEN,   // the darker of the two per channel
+    PICASSO_BLEND_LIGHTEN,  // the lighter of the two per channel
+    PICASSO_BLEND_OVER,     // Porter-Duff src over dst, alpha included
+    PICASSO_BLEND_IN,       // src where dst is opaque
+    PICASSO_BLEND_OUT,      // src where dst is transparent
+    PICASSO_BLEND_XOR,      // src where dst is not and the other way round
+    PICASSO_BLEND_COPY,     // src replaces dst, alpha included. A memcpy per row where formats match
+    PICASSO_BLEND_MODE_COUNT
+} picasso_blend_mode;
+
 picasso_backbuffer* picasso_create_backbuffer(int width, int height);
+picasso_backbuffer* picasso_create_backbuffer_ex(int width, int height, uint32_t flags);
 void picasso_destroy_backbuffer(picasso_backbuffer *bf);
 void picasso_clear_backbuffer(picasso_backbuffer *bf);
+void picasso_clear_backbuffer_color(picasso_backbuffer *bf, color c);
 void picasso_blit_bitmap(picasso_backbuffer *dst, void *src_pixels, int src_w, int src_h, int x, int y);
+void picasso_blit_bitmap_blend(picasso_backbuffer *dst, void *src_pixels, int src_w, int src_h,
+                               int x, int y, picasso_blend_mode mode);
 void* picasso_backbuffer_pixels(picasso_backbuffer *bf);
+int picasso_save_backbuffer_to_ppm(const picasso_backbuffer *bf, const char *file_path);
+
+/* Damage tracking. Enabling (or disabling) starts from an empty list.
+ * get_damage copies up to max rects and returns how many there are */
+void picasso_backbuffer_track_damage(picasso_backbuffer *bf, bool enable);
+void picasso_backbuffer_reset_damage(picasso_backbuffer *bf);
+void picasso_backbuffer_add_damage(picasso_backbuffer *bf, const picasso_rect *r);
+int picasso_backbuffer_get_damage(const picasso_backbuffer *bf, picasso_rect *out, int max);
+void picasso_clear_damage(picasso_backbuffer *bf, color c);
+
+/* -------------------- Image Pool -------------------- */
+/* Recycles image and backbuffer allocations keyed by size, channels and row
+ * stride. Released buffers stay warm (already faulted in) until the byte
+ * budget forces the least recently released ones out. Acquired buffers come
+ * back with whatever pixels they held, pooled pixels are not zeroed. Damage
+ * tracking starts off, as on a new backbuffer. PICASSO_ALLOC_HUGE_PAGES is best
+ * effort here as everywhere else: it is not part of the key, a recycled
+ * buffer keeps whatever page_mode it was granted. Not thread safe, use one
+ * per thread */
+typedef struct picasso_image_pool picasso_image_pool;
 
-/* -------------------- Graphical Raster Section -------------------- */
 typedef struct {
-    int x, y, width, height; // supporting negative values
-} picasso_rect;
+    size_t hits;           ///< Acquires served from the pool
+    size_t misses;         ///< Acquires that had to allocate
+    size_t evictions;      ///< Buffers freed to stay within budget
+    size_t bytes_cached;   ///< Bytes held by idle buffers
+    size_t buffers_cached; ///< Number of idle buffers
+} picasso_image_pool_stats;
+
+picasso_image_pool *picasso_image_pool_create(size_t byte_budget);
+void picasso_image_pool_destroy(picasso_image_pool *pool);
+void picasso_image_pool_set_budget(picasso_image_pool *pool, size_t byte_budget);
+void picasso_image_pool_trim(picasso_image_pool *pool, size_t target_bytes);
+picasso_image_pool_stats picasso_image_pool_get_stats(const picasso_image_pool *pool);
+
+picasso_image *picasso_image_pool_acquire(picasso_image_pool *pool, int width, int height,
+                                          int channels, uint32_t flags);
+void picasso_image_pool_release(picasso_image_pool *pool, picasso_image *img);
+picasso_backbuffer *picasso_image_pool_acquire_backbuffer(picasso_image_pool *pool,
+                                                          int width, int height, uint32_t flags);
+void picasso_image_pool_release_backbuffer(picasso_image_pool *pool, picasso_backbuffer *bf);
 
-
-typedef struct {
-    int x0, y0, x1, y1;
-} picasso_draw_bounds;
+/* -------------------- Graphical Raster Section -------------------- */
 
 void picasso_fill_rect(picasso_backbuffer *bf, picasso_rect *r, color c);
+void picasso_fill_rect_blend(picasso_backbuffer *bf, picasso_rect *r, color c, picasso_blend_mode mode);
+void picasso_clear_rect(picasso_backbuffer *bf, const picasso_rect *r, color c);
 void picasso_draw_rect(picasso_backbuffer *bf, picasso_rect *outer, int thickness, color c);
 
 void picasso_draw_line(picasso_backbuffer *bf, int x0, int y0, int x1, int y1, color c);
 
 void picasso_draw_circle(picasso_backbuffer *bf, int x0, int y0, int radius,int thickness, color c);
 void picasso_fill_circle(picasso_backbuffer *bf, int x0, int y0, int radius, color c);
+void picasso_fill_circle_blend(picasso_backbuffer *bf, int x0, int y0, int radius, color c,
+                               picasso_blend_mode mode);
+
+/* -------------------- Image Views -------------------- */
+/* A view is a non-owning window into pixels: an image, a backbuffer, a sprite
+ * frame or any sub-rectangle of those. Creating one never allocates, and
+ * nothing needs to be freed. Stride is in bytes */
+typedef enum {
+    PICASSO_FORMAT_RGB8,   // 3 bytes per pixel, R G B
+    PICASSO_FORMAT_RGBA8,  // 4 bytes per pixel, R G B A (same as backbuffer pixels)
+    PICASSO_FORMAT_RGBA8_PREMUL, // RGBA8 with color premultiplied by alpha
+} picasso_format;
+
+typedef struct {
+    uint8_t *pixels;      ///< First pixel of the region, not owned
+    int width;
+    int height;
+    ptrdiff_t stride;     ///< Bytes from one row to the next
+    picasso_format format;
+} picasso_view;
+
+int picasso_format_bytes(picasso_format format);
+
+picasso_view picasso_view_from_pixels(void *pixels, int width, int height,
+                                      ptrdiff_t stride, picasso_format format);
+picasso_view picasso_view_from_image(const picasso_image *img);
+picasso_view picasso_view_from_backbuffer(const picasso_backbuffer *bf);
+picasso_view picasso_view_from_sprite(const picasso_sprite_sheet *sheet, int frame);
+picasso_view picasso_subview(const picasso_view *v, picasso_rect r);
+picasso_backbuffer picasso_backbuffer_from_view(const picasso_view *v);
+
+void picasso_blit_view(picasso_backbuffer *dst, const picasso_view *src, int x, int y);
+void picasso_blit_view_blend(picasso_backbuffer *dst, const picasso_view *src, int x, int y,
+                             picasso_blend_mode mode);
+// Only src_rect of src, clipped to it, lands with its top left corner at x, y
+void picasso_blit_view_rect(picasso_backbuffer *dst, const picasso_view *src, picasso_rect src_rect,
+                            int x, int y, picasso_blend_mode mode);
+
+typedef enum {
+    PICASSO_SPRITE_DEFAULT = 0,
+    PICASSO_SPRITE_FLIP_X  = 1 << 0, // mirrored left to right
+    PICASSO_SPRITE_FLIP_Y  = 1 << 1, // upside down
+    PICASSO_SPRITE_TINT    = 1 << 2, // multiplied by the entry's tint, sprite batches only
+} picasso_sprite_flags;
+
+// Draws frame of sheet with its top left corner at x, y, flags from picasso_sprite_flags
+void picasso_blit_sprite(picasso_backbuffer *dst, const picasso_sprite_sheet *sheet, int frame,
+                         int x, int y, uint32_t flags);
+
+typedef enum {
+    PICASSO_FILTER_NEAREST,  // blocky, each target pixel is one source pixel
+    PICASSO_FILTER_BILINEAR, // smooth, mixes the four source pixels around it
+} picasso_filter;
+
+/* Stretches all of src over dst_rect, up or down in either direction.
+ * Bilinear mixes premultiplied colors, so transparent pixels never bleed
+ * into the edges */
+void picasso_blit_scaled(picasso_backbuffer *dst, const picasso_view *src, picasso_rect dst_rect,
+                         picasso_filter filter);
+
+/* Source pixel x, y lands at x * a + y * c + tx, x * b + y * d + ty, the
+ * order canvas setTransform uses. Rotating by t about the source's top left
+ * corner is a = cos t, b = sin t, c = -sin t, d = cos t */
+typedef struct {
+    float a, b, c, d;
+    float tx, ty;
+} picasso_affine;
+
+// Draws src through matrix. Target pixels whose centers fall inside are drawn, edges are hard
+void picasso_blit_affine(picasso_backbuffer *dst, const picasso_view *src, const picasso_affine *matrix,
+                         picasso_filter filter);
+int picasso_save_view_to_ppm(const picasso_view *v, const char *file_path);
+int picasso_save_view_to_bmp(const picasso_view *v, const char *file_path, picasso_icc_profile profile);
+bmp *picasso_create_bmp_from_view(const picasso_view *v);
+void picasso_free_bmp(bmp *image);
+
+/* -------------------- Prepared Sprites -------------------- */
+/* A sprite analysed once at load time for blitting many times. Each row is
+ * kept as runs of opaque and of translucent pixels, fully transparent ones
+ * are left out. Blits skip the gaps, copy the opaque runs and only blend the
+ * rest. The pixels are copied, the source view is not needed afterwards */
+typedef struct picasso_prepared_sprite picasso_prepared_sprite;
+
+picasso_prepared_sprite *picasso_prepare_sprite(const picasso_view *src);
+void picasso_destroy_prepared_sprite(picasso_prepared_sprite *ps);
+picasso_view picasso_view_from_prepared_sprite(const picasso_prepared_sprite *ps);
+void picasso_blit_prepared_sprite(picasso_backbuffer *dst, const picasso_prepared_sprite *ps, int x, int y);
+
+/* -------------------- Sprite Batches -------------------- */
+/* Many sprites in one call. Entries that land off screen are dropped first,
+ * the rest are drawn by layer, and within a layer grouped by sheet so its
+ * pixels stay in cache. Entries of one sheet keep their order, entries of
+ * different sheets on the same layer may not: give sprites that overlap
+ * their own layers when it matters which one ends up on top */
+typedef struct {
+    const picasso_sprite_sheet *sheet;
+    int frame;
+    int x, y;         // top left corner
+    uint32_t flags;   // picasso_sprite_flags
+    color tint;       // with PICASSO_SPRITE_TINT
+    int layer;        // lower layers are drawn first
+} picasso_sprite_batch_entry;
+
+/* parallel splits the target into bands of rows, each band draws only the
+ * entries that touch it, on the thread pool */
+void picasso_draw_sprite_batch(picasso_backbuffer *dst, const picasso_sprite_batch_entry *entries,
+                               size_t count, bool parallel);
+
+/* -------------------- Nine Patches -------------------- */
+/* A resizable frame cut from an image or sprite frame by four margins. The
+ * corners are drawn as they are, the edges and center stretch or repeat to
+ * fill the rest. Regions of one flat color are found when the patch is
+ * built and drawn as fills. The pixels are copied, the source view is not
+ * needed afterwards */
+typedef enum {
+    PICASSO_NINE_PATCH_STRETCH, // edges and center scaled to size
+    PICASSO_NINE_PATCH_TILE,    // edges and center repeated from their top left corner
+} picasso_nine_patch_mode;
+
+typedef struct picasso_nine_patch picasso_nine_patch;
+
+picasso_nine_patch *picasso_nine_patch_create(const picasso_view *src, int left, int top, int right,
+                                              int bottom, picasso_nine_patch_mode mode);
+void picasso_nine_patch_destroy(picasso_nine_patch *np);
+void picasso_draw_nine_patch(picasso_backbuffer *bf, const picasso_nine_patch *np, picasso_rect rect);
+
+/* -------------------- Tilemaps -------------------- */
+/* A grid of frames of one sprite sheet, every cell one frame_width x
+ * frame_height tile. Drawing only touches the cells in view, and copies
+ * fully opaque tiles instead of blending them. Which frames are opaque is
+ * worked out once, at create, from the sheet's pixels.
+ *
+ * With the cache on, blocks of up to 16x16 tiles are gathered once and reused
+ * until one of their tiles changes. Worth it for layers that rarely change;
+ * costs a copy of their pixels. Blocks are kept under PICASSO_MAX_DIM, tiles
+ * bigger than that are never cached */
+#define PICASSO_TILE_NONE (-1) // empty cell, nothing drawn
+
+typedef struct picasso_tilemap picasso_tilemap;
+
+// All cells start out PICASSO_TILE_NONE. The sheet must outlive the map
+picasso_tilemap *picasso_tilemap_create(const picasso_sprite_sheet *sheet, int columns, int rows);
+void picasso_tilemap_destroy(picasso_tilemap *map);
+void picasso_tilemap_set_tile(picasso_tilemap *map, int column, int row, int frame);
+int picasso_tilemap_get_tile(const picasso_tilemap *map, int column, int row);
+void picasso_tilemap_set_cache(picasso_tilemap *map, bool enable);
+
+/* Draws into viewport only, with map pixel scroll_x, scroll_y in its top left
+ * corner. Scrolling by any number of pixels, not just whole tiles */
+void picasso_draw_tilemap(picasso_backbuffer *bf, picasso_tilemap *map, picasso_rect viewport,
+                          int scroll_x, int scroll_y);
+
+/* -------------------- Tiled Images -------------------- */
+/* For canvases too big (or too empty) to allocate in one piece. Storage is
+ * split in PICASSO_TILE_SIZE square tiles which are only allocated once
+ * something is written to them. Only tiles never written to are skipped as
+ * transparent: a new tile starts out zeroed, so pixels of it nothing was
+ * written to are transparent in RGBA images but opaque black in RGB ones */
+#define PICASSO_TILE_SIZE 256
+
+typedef struct {
+    int width;
+    int height;
+    int channels;      ///< 3 = RGB, 4 = RGBA
+    int tiles_x;       ///< Tiles per row
+    int tiles_y;       ///< Tiles per column
+    int tile_stride;   ///< Bytes per tile row
+    size_t tiles_used; ///< Tiles allocated so far
+    uint8_t **tiles;   ///< tiles_x * tiles_y, NULL until first touched
+} picasso_tiled_image;
+
+picasso_tiled_image *picasso_tiled_image_create(int width, int height, int channels);
+void picasso_tiled_image_destroy(picasso_tiled_image *ti);
+uint8_t *picasso_tiled_image_tile(picasso_tiled_image *ti, int tx, int ty, bool create);
+picasso_view picasso_tiled_image_tile_view(picasso_tiled_image *ti, int tx, int ty, bool create);
+size_t picasso_tiled_image_bytes(const picasso_tiled_image *ti);
+int picasso_tiled_image_write(picasso_tiled_image *ti, const picasso_view *src, int x, int y);
+void picasso_blit_tiled_image(picasso_backbuffer *dst, picasso_tiled_image *ti,
+                              picasso_rect src, int x, int y);
+
+/* -------------------- Swap Chain -------------------- */
+/* N backbuffers (2 = double, 3 = triple buffering) and a present thread.
+ * Render into an acquired buffer and submit it; the present thread calls
+ * present() for each submitted buffer in order, while the next frame is
+ * being drawn. Acquire and submit from one render thread only.
+ *
+ * With copy_forward, acquire hands back a buffer already holding the
+ * previous frame (only regions it missed are copied), damage tracking is on,
+ * and present() gets just the rects drawn that frame. Without it, buffers
+ * hold stale content and present() gets one full-frame rect */
+typedef void (*picasso_present_fn)(picasso_backbuffer *bf, const picasso_rect *damage,
+                                   int damage_count, void *user);
+
+typedef struct {
+    int width;
+    int height;
+    int buffer_count;          ///< At least 2
+    uint32_t alloc_flags;      ///< picasso_alloc_flags for every buffer
+    bool copy_forward;         ///< Carry the previous frame into each acquired buffer
+    picasso_present_fn present;
+    void *user;                ///< Passed to present
+} picasso_swapchain_desc;
+
+typedef struct picasso_swapchain picasso_swapchain;
+
+picasso_swapchain *picasso_swapchain_create(const picasso_swapchain_desc *desc);
+void picasso_swapchain_destroy(picasso_swapchain *sc);
+picasso_backbuffer *picasso_swapchain_acquire(picasso_swapchain *sc);
+void picasso_swapchain_submit(picasso_swapchain *sc, picasso_backbuffer *bf);
+void picasso_swapchain_wait_idle(picasso_swapchain *sc);
+
+/* -------------------- Threading -------------------- */
+/* A shared worker pool. parallel_for calls fn(user, i) for every i in
+ * [0, count) across the pool and the calling thread, and returns once all
+ * have run. Calls made from inside a task run inline */
+typedef void (*picasso_task_fn)(void *user, int index);
+
+// Threads used including the caller: 0 = one per core, 1 = calling thread only
+void picasso_set_thread_count(int count);
+int picasso_get_thread_count(void);
+void picasso_parallel_for(int count, picasso_task_fn fn, void *user);
+
+/* Fills, clears, circles and blits covering at least this many pixels are
+ * split into bands of rows and drawn on the pool. SIZE_MAX turns it off */
+#define PICASSO_PARALLEL_THRESHOLD ((size_t)1 << 16)
+
+void picasso_set_parallel_threshold(size_t pixels);
+size_t picasso_get_parallel_threshold(void);
+
+/* -------------------- CPU Dispatch -------------------- */
+/* Pixel kernels for blending, filling, clearing and converting are built for
+ * several instruction sets, the best one the CPU has is picked on first use.
+ * PICASSO_SIMD=<name> in the environment asks for another one, which is how
+ * to compare them or rule one out when chasing a bug */
+typedef enum {
+    PICASSO_SIMD_SCALAR, // plain C, always available
+    PICASSO_SIMD_SSE2,
+    PICASSO_SIMD_SSSE3,
+    PICASSO_SIMD_AVX2,
+    PICASSO_SIMD_AVX512, // AVX-512 F and BW
+    PICASSO_SIMD_NEON,
+    PICASSO_SIMD_LEVEL_COUNT
+} picasso_simd_level;
+
+picasso_simd_level picasso_get_simd_level(void);
+picasso_simd_level picasso_get_best_simd_level(void);
+// false, changing nothing, if the CPU or this build lacks level. Not while drawing
+bool picasso_set_simd_level(picasso_simd_level level);
+const char *picasso_simd_level_name(picasso_simd_level level);
+
+/* -------------------- Draw Lists -------------------- */
+/* Records draw calls instead of running them. Executing a list bins every
+ * command into PICASSO_DRAW_TILE_SIZE square tiles by its bounds, then
+ * renders the tiles in parallel, each one replaying its commands in the
+ * order they were recorded. The result is the same as drawing immediately.
+ * Blits only keep the view, its pixels must live until the list runs */
+#define PICASSO_DRAW_TILE_SIZE 64
+
+typedef struct picasso_draw_list picasso_draw_list;
+
+picasso_draw_list *picasso_draw_list_create(void);
+void picasso_draw_list_destroy(picasso_draw_list *dl);
+void picasso_draw_list_reset(picasso_draw_list *dl);
+int picasso_draw_list_count(const picasso_draw_list *dl);
+
+void picasso_draw_list_fill_rect(picasso_draw_list *dl, picasso_rect r, color c);
+void picasso_draw_list_clear_rect(picasso_draw_list *dl, picasso_rect r, color c);
+void picasso_draw_list_draw_rect(picasso_draw_list *dl, picasso_rect r, int thickness, color c);
+void picasso_draw_list_draw_line(picasso_draw_list *dl, int x0, int y0, int x1, int y1, color c);
+void picasso_draw_list_fill_circle(picasso_draw_list *dl, int x0, int y0, int radius, color c);
+void picasso_draw_list_draw_circle(picasso_draw_list *dl, int x0, int y0, int radius, int thickness, color c);
+void picasso_draw_list_blit_view(picasso_draw_list *dl, const picasso_view *src, int x, int y);
+void picasso_draw_list_blit_bitmap(picasso_draw_list *dl, void *src_pixels, int src_w, int src_h, int x, int y);
+
+// Bounding box of everything the list draws, kept up to date while recording
+picasso_rect picasso_draw_list_bounds(const picasso_draw_list *dl);
+
+void picasso_draw_list_execute(picasso_draw_list *dl, picasso_backbuffer *bf);
+// Draws the list on the calling thread, moved by (dx, dy). A list can be replayed any number of times
+void picasso_draw_list_replay(const picasso_draw_list *dl, picasso_backbuffer *bf, int dx, int dy);
+
+/* Serialized lists carry a copy of every blitted pixel, so they can be
+ * stored and replayed later without the original images */
+size_t picasso_draw_list_serialize(const picasso_draw_list *dl, void *buffer, size_t capacity);
+picasso_draw_list *picasso_draw_list_deserialize(const void *data, size_t size);
+int picasso_draw_list_save(const picasso_draw_list *dl, const char *file_path);
+picasso_draw_list *picasso_draw_list_load(const char *file_path);
 
 #endif // PICASSO_H
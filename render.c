@@ -0,0 +1,647 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "picasso.h"
+#include "logger.h"
+
+/* Commands are recorded into one flat array. Each one keeps the bounds of
+ * everything it could touch, so binning never has to look at the geometry
+ * again. Blit views live in their own array, most commands don't need one */
+typedef enum {
+    PICASSO__CMD_FILL_RECT,
+    PICASSO__CMD_CLEAR_RECT,
+    PICASSO__CMD_DRAW_RECT,
+    PICASSO__CMD_LINE,
+    PICASSO__CMD_FILL_CIRCLE,
+    PICASSO__CMD_DRAW_CIRCLE,
+    PICASSO__CMD_BLIT,
+} picasso__cmd_kind;
+
+typedef struct {
+    picasso_draw_bounds bounds;  // unclipped, in backbuffer coordinates
+    int32_t args[4];             // rect, line end points, or center and radius
+    int32_t extra;               // thickness, or view index for blits
+    color c;
+    uint8_t kind;
+} picasso__draw_cmd;
+
+struct picasso_draw_list {
+    picasso__draw_cmd *cmds;
+    int count, capacity;
+
+    picasso_view *views;
+    int view_count, view_capacity;
+    uint8_t *owned_pixels;   // blit pixels, for lists that were deserialized
+
+    picasso_draw_bounds bounds;  // union of every command's bounds
+    bool empty;
+
+    // Bins from the last execute, kept to avoid reallocating every frame
+    int *bin_start;          // tile i owns bin_items[bin_start[i] .. bin_start[i+1])
+    int bin_capacity;
+    int *bin_items;
+    size_t item_capacity;
+};
+
+picasso_draw_list *picasso_draw_list_create(void)
+{
+    picasso_draw_list *dl = picasso_calloc(1, sizeof(picasso_draw_list));
+    if (!dl) {
+        ERROR("Failed to allocate draw list");
+        return NULL;
+    }
+    dl->empty = true;
+    return dl;
+}
+
+void picasso_draw_list_destroy(picasso_draw_list *dl)
+{
+    if (!dl) return;
+    picasso_free(dl->cmds);
+    picasso_free(dl->views);
+    picasso_free(dl->owned_pixels);
+    picasso_free(dl->bin_start);
+    picasso_free(dl->bin_items);
+    picasso_free(dl);
+}
+
+void picasso_draw_list_reset(picasso_draw_list *dl)
+{
+    if (!dl) return;
+    dl->count = 0;
+    dl->view_count = 0;
+    dl->empty = true;
+    picasso_free(dl->owned_pixels);
+    dl->owned_pixels = NULL;
+}
+
+int picasso_draw_list_count(const picasso_draw_list *dl)
+{
+    return dl ? dl->count : 0;
+}
+
+// Zero sized rect for an empty list
+picasso_rect picasso_draw_list_bounds(const picasso_draw_list *dl)
+{
+    if (!dl || dl->empty) return (picasso_rect){0};
+    picasso_draw_bounds b = dl->bounds;
+    return (picasso_rect){ b.x0, b.y0, b.x1 - b.x0, b.y1 - b.y0 };
+}
+
+static bool picasso__grow(void **array, int *capacity, int needed, size_t elem_size)
+{
+    if (needed <= *capacity) return true;
+    int cap = *capacity ? *capacity : 64;
+    while (cap < needed) cap *= 2;
+
+    void *tmp = picasso_realloc(*array, (size_t)cap * elem_size);
+    if (!tmp) return false;
+    *array = tmp;
+    *capacity = cap;
+    return true;
+}
+
+static picasso__draw_cmd *picasso__push_cmd(picasso_draw_list *dl, picasso__cmd_kind kind, color c)
+{
+    if (!dl) return NULL;
+    if (!picasso__grow((void **)&dl->cmds, &dl->capacity, dl->count + 1, sizeof(picasso__draw_cmd))) {
+        ERROR("Failed to grow draw list, dropping command");
+        return NULL;
+    }
+    picasso__draw_cmd *cmd = &dl->cmds[dl->count++];
+    *cmd = (picasso__draw_cmd){ .kind = (uint8_t)kind, .c = c };
+    return cmd;
+}
+
+// Called once a command's bounds are final
+static void picasso__grow_bounds(picasso_draw_list *dl, picasso_draw_bounds b)
+{
+    if (b.x1 <= b.x0 || b.y1 <= b.y0) return;
+    if (dl->empty) {
+        dl->bounds = b;
+        dl->empty = false;
+        return;
+    }
+    dl->bounds.x0 = PICASSO_MIN(dl->bounds.x0, b.x0);
+    dl->bounds.y0 = PICASSO_MIN(dl->bounds.y0, b.y0);
+    dl->bounds.x1 = PICASSO_MAX(dl->bounds.x1, b.x1);
+    dl->bounds.y1 = PICASSO_MAX(dl->bounds.y1, b.y1);
+}
+
+static picasso_rect picasso__normalized(picasso_rect r)
+{
+    if (r.width < 0)  { r.x += r.width;  r.width  = -r.width;  }
+    if (r.height < 0) { r.y += r.height; r.height = -r.height; }
+    return r;
+}
+
+static picasso_draw_bounds picasso__rect_bounds(picasso_rect r)
+{
+    return (picasso_draw_bounds){ r.x, r.y, r.x + r.width, r.y + r.height };
+}
+
+// Same box the circle primitives clip against
+static picasso_draw_bounds picasso__circle_bounds(int x0, int y0, int radius)
+{
+    int reach = radius + PICASSO_CIRCLE_DEFAULT_TOLERANCE + 1;
+    return (picasso_draw_bounds){ x0 - reach, y0 - reach, x0 + reach + 1, y0 + reach + 1 };
+}
+
+static void picasso__push_rect(picasso_draw_list *dl, picasso__cmd_kind kind,
+                               picasso_rect r, int extra, color c)
+{
+    picasso__draw_cmd *cmd = picasso__push_cmd(dl, kind, c);
+    if (!cmd) return;
+    r = picasso__normalized(r);
+    cmd->args[0] = r.x;
+    cmd->args[1] = r.y;
+    cmd->args[2] = r.width;
+    cmd->args[3] = r.height;
+    cmd->extra = extra;
+    cmd->bounds = picasso__rect_bounds(r);
+    picasso__grow_bounds(dl, cmd->bounds);
+}
+
+void picasso_draw_list_fill_rect(picasso_draw_list *dl, picasso_rect r, color c)
+{
+    picasso__push_rect(dl, PICASSO__CMD_FILL_RECT, r, 0, c);
+}
+
+void picasso_draw_list_clear_rect(picasso_draw_list *dl, picasso_rect r, color c)
+{
+    picasso__push_rect(dl, PICASSO__CMD_CLEAR_RECT, r, 0, c);
+}
+
+void picasso_draw_list_draw_rect(picasso_draw_list *dl, picasso_rect r, int thickness, color c)
+{
+    if (thickness <= 0) return;
+    picasso__push_rect(dl, PICASSO__CMD_DRAW_RECT, r, thickness, c);
+}
+
+void picasso_draw_list_draw_line(picasso_draw_list *dl, int x0, int y0, int x1, int y1, color c)
+{
+    picasso__draw_cmd *cmd = picasso__push_cmd(dl, PICASSO__CMD_LINE, c);
+    if (!cmd) return;
+    cmd->args[0] = x0;
+    cmd->args[1] = y0;
+    cmd->args[2] = x1;
+    cmd->args[3] = y1;
+    // The line only steps right and down, and draws nothing unless x1 > x0
+    cmd->bounds = (picasso_draw_bounds){ x0, y0, PICASSO_MAX(x1, x0), y0 + PICASSO_MAX(y1 - y0, 0) + 1 };
+    picasso__grow_bounds(dl, cmd->bounds);
+}
+
+void picasso_draw_list_fill_circle(picasso_draw_list *dl, int x0, int y0, int radius, color c)
+{
+    picasso__draw_cmd *cmd = picasso__push_cmd(dl, PICASSO__CMD_FILL_CIRCLE, c);
+    if (!cmd) return;
+    cmd->args[0] = x0;
+    cmd->args[1] = y0;
+    cmd->args[2] = radius;
+    cmd->bounds = picasso__circle_bounds(x0, y0, radius);
+    picasso__grow_bounds(dl, cmd->bounds);
+}
+
+void picasso_draw_list_draw_circle(picasso_draw_list *dl, int x0, int y0, int radius, int thickness, color c)
+{
+    picasso__draw_cmd *cmd = picasso__push_cmd(dl, PICASSO__CMD_DRAW_CIRCLE, c);
+    if (!cmd) return;
+    cmd->args[0] = x0;
+    cmd->args[1] = y0;
+    cmd->args[2] = radius;
+    cmd->extra = thickness;
+    cmd->bounds = picasso__circle_bounds(x0, y0, radius);
+    picasso__grow_bounds(dl, cmd->bounds);
+}
+
+void picasso_draw_list_blit_view(picasso_draw_list *dl, const picasso_view *src, int x, int y)
+{
+    if (!dl || !src || !src->pixels) return;
+
+    // Back to back blits of the same view share it, and serialize its pixels once
+    const picasso_view *last = dl->view_count ? &dl->views[dl->view_count - 1] : NULL;
+    bool shared = last && last->pixels == src->pixels && last->width == src->width &&
+                  last->height == src->height && last->stride == src->stride && last->format == src->format;
+
+    if (!shared && !picasso__grow((void **)&dl->views, &dl->view_capacity, dl->view_count + 1, sizeof(picasso_view))) {
+        ERROR("Failed to grow draw list views, dropping blit");
+        return;
+    }
+    picasso__draw_cmd *cmd = picasso__push_cmd(dl, PICASSO__CMD_BLIT, (color){0});
+    if (!cmd) return;
+
+    if (!shared) dl->views[dl->view_count++] = *src;
+    cmd->args[0] = x;
+    cmd->args[1] = y;
+    cmd->extra = dl->view_count - 1;
+    cmd->bounds = (picasso_draw_bounds){ x, y, x + src->width, y + src->height };
+    picasso__grow_bounds(dl, cmd->bounds);
+}
+
+void picasso_draw_list_blit_bitmap(picasso_draw_list *dl, void *src_pixels, int src_w, int src_h, int x, int y)
+{
+    picasso_view v = picasso_view_from_pixels(src_pixels, src_w, src_h,
+                                              (ptrdiff_t)src_w * 4, PICASSO_FORMAT_RGBA8);
+    picasso_draw_list_blit_view(dl, &v, x, y);
+}
+
+/* Runs one command on bf, whose top left pixel is (ox, oy) in the
+ * coordinates the command was recorded in. clip is the part of bf the
+ * command may touch, also in recorded coordinates */
+static void picasso__run_cmd(const picasso_draw_list *dl, const picasso__draw_cmd *cmd,
+                             picasso_backbuffer *bf, int ox, int oy, picasso_draw_bounds clip)
+{
+    const int32_t *a = cmd->args;
+    switch (cmd->kind) {
+    case PICASSO__CMD_FILL_RECT:
+        picasso_fill_rect(bf, &(picasso_rect){ a[0] - ox, a[1] - oy, a[2], a[3] }, cmd->c);
+        break;
+    case PICASSO__CMD_CLEAR_RECT:
+        picasso_clear_rect(bf, &(picasso_rect){ a[0] - ox, a[1] - oy, a[2], a[3] }, cmd->c);
+        break;
+    case PICASSO__CMD_DRAW_RECT:
+        picasso_draw_rect(bf, &(picasso_rect){ a[0] - ox, a[1] - oy, a[2], a[3] }, cmd->extra, cmd->c);
+        break;
+    case PICASSO__CMD_LINE:
+        picasso_draw_line(bf, a[0] - ox, a[1] - oy, a[2] - ox, a[3] - oy, cmd->c);
+        break;
+    case PICASSO__CMD_FILL_CIRCLE:
+        picasso_fill_circle(bf, a[0] - ox, a[1] - oy, a[2], cmd->c);
+        break;
+    case PICASSO__CMD_DRAW_CIRCLE:
+        picasso_draw_circle(bf, a[0] - ox, a[1] - oy, a[2], cmd->extra, cmd->c);
+        break;
+    case PICASSO__CMD_BLIT: {
+        // Cut the source down to the clip first, so a big blit costs each tile only its share
+        const picasso_view *src = &dl->views[cmd->extra];
+        picasso_rect part = {
+            clip.x0 - a[0], clip.y0 - a[1], clip.x1 - clip.x0, clip.y1 - clip.y0
+        };
+        picasso_view sub = picasso_subview(src, part);
+        if (sub.width > 0 && sub.height > 0) {
+            picasso_blit_view(bf, &sub, clip.x0 - ox, clip.y0 - oy);
+        }
+        break;
+    }
+    }
+}
+
+static bool picasso__intersect(picasso_draw_bounds a, picasso_draw_bounds b, picasso_draw_bounds *out)
+{
+    out->x0 = PICASSO_MAX(a.x0, b.x0);
+    out->y0 = PICASSO_MAX(a.y0, b.y0);
+    out->x1 = PICASSO_MIN(a.x1, b.x1);
+    out->y1 = PICASSO_MIN(a.y1, b.y1);
+    return out->x0 < out->x1 && out->y0 < out->y1;
+}
+
+typedef struct {
+    const picasso_draw_list *dl;
+    picasso_view target;
+    int tiles_x;
+} picasso__tile_job;
+
+static void picasso__render_tile(void *user, int index)
+{
+    const picasso__tile_job *job = user;
+    const picasso_draw_list *dl = job->dl;
+
+    int begin = dl->bin_start[index];
+    int end = dl->bin_start[index + 1];
+    if (begin == end) return;
+
+    int tx = index % job->tiles_x;
+    int ty = index / job->tiles_x;
+    picasso_rect r = {
+        tx * PICASSO_DRAW_TILE_SIZE, ty * PICASSO_DRAW_TILE_SIZE,
+        PICASSO_DRAW_TILE_SIZE, PICASSO_DRAW_TILE_SIZE
+    };
+
+    // Damage stays off in the tile, the caller records it once for the whole list
+    picasso_view tile_view = picasso_subview(&job->target, r);
+    picasso_backbuffer tile = picasso_backbuffer_from_view(&tile_view);
+    picasso_draw_bounds tile_bounds = {
+        r.x, r.y, r.x + tile_view.width, r.y + tile_view.height
+    };
+
+    for (int i = begin; i < end; ++i) {
+        const picasso__draw_cmd *cmd = &dl->cmds[dl->bin_items[i]];
+        picasso_draw_bounds clip;
+        picasso__intersect(cmd->bounds, tile_bounds, &clip);
+        picasso__run_cmd(dl, cmd, &tile, r.x, r.y, clip);
+    }
+}
+
+// One test for the whole list: does any of it land on bf when drawn at (dx, dy)
+static bool picasso__list_visible(const picasso_draw_list *dl, const picasso_backbuffer *bf, int dx, int dy)
+{
+    if (dl->empty) return false;
+    return dl->bounds.x0 + dx < (int)bf->width && dl->bounds.x1 + dx > 0 &&
+           dl->bounds.y0 + dy < (int)bf->height && dl->bounds.y1 + dy > 0;
+}
+
+/* Draws the list on the calling thread, moved by (dx, dy). Commands that
+ * miss bf are skipped without being run */
+void picasso_draw_list_replay(const picasso_draw_list *dl, picasso_backbuffer *bf, int dx, int dy)
+{
+    if (!dl || !bf || !bf->pixels || !picasso__list_visible(dl, bf, dx, dy)) return;
+
+    // bf in the coordinates the list was recorded in
+    picasso_draw_bounds screen = { -dx, -dy, (int)bf->width - dx, (int)bf->height - dy };
+
+    for (int i = 0; i < dl->count; ++i) {
+        picasso_draw_bounds clip;
+        if (!picasso__intersect(dl->cmds[i].bounds, screen, &clip)) continue;
+        picasso__run_cmd(dl, &dl->cmds[i], bf, -dx, -dy, clip);
+    }
+}
+
+void picasso_draw_list_execute(picasso_draw_list *dl, picasso_backbuffer *bf)
+{
+    if (!dl || !bf || !bf->pixels || !picasso__list_visible(dl, bf, 0, 0)) return;
+
+    const int T = PICASSO_DRAW_TILE_SIZE;
+    int tiles_x = ((int)bf->width + T - 1) / T;
+    int tiles_y = ((int)bf->height + T - 1) / T;
+    int tile_count = tiles_x * tiles_y;
+    picasso_draw_bounds screen = { 0, 0, (int)bf->width, (int)bf->height };
+
+    if (!picasso__grow((void **)&dl->bin_start, &dl->bin_capacity, tile_count + 1, sizeof(int))) {
+        ERROR("Failed to allocate tile bins");
+        return;
+    }
+    memset(dl->bin_start, 0, (size_t)(tile_count + 1) * sizeof(int));
+
+    // Count pass: how many commands land in each tile
+    size_t total = 0;
+    for (int i = 0; i < dl->count; ++i) {
+        picasso_draw_bounds b;
+        if (!picasso__intersect(dl->cmds[i].bounds, screen, &b)) continue;
+        for (int ty = b.y0 / T; ty <= (b.y1 - 1) / T; ++ty)
+            for (int tx = b.x0 / T; tx <= (b.x1 - 1) / T; ++tx)
+                dl->bin_start[ty * tiles_x + tx + 1]++;
+        total += (size_t)((b.y1 - 1) / T - b.y0 / T + 1) * ((b.x1 - 1) / T - b.x0 / T + 1);
+    }
+
+    if (total > dl->item_capacity) {
+        int *items = picasso_realloc(dl->bin_items, total * sizeof(int));
+        if (!items) {
+            ERROR("Failed to allocate %zu tile bin entries", total);
+            return;
+        }
+        dl->bin_items = items;
+        dl->item_capacity = total;
+    }
+
+    for (int t = 0; t < tile_count; ++t) {
+        dl->bin_start[t + 1] += dl->bin_start[t];
+    }
+
+    /* Fill pass, in recorded order so every tile replays its commands in the
+     * order they were drawn. bin_start[t] is used as the write cursor and
+     * ends up at the start of tile t + 1, shift it back afterwards */
+    for (int i = 0; i < dl->count; ++i) {
+        picasso_draw_bounds b;
+        if (!picasso__intersect(dl->cmds[i].bounds, screen, &b)) continue;
+        for (int ty = b.y0 / T; ty <= (b.y1 - 1) / T; ++ty)
+            for (int tx = b.x0 / T; tx <= (b.x1 - 1) / T; ++tx)
+                dl->bin_items[dl->bin_start[ty * tiles_x + tx]++] = i;
+    }
+    memmove(dl->bin_start + 1, dl->bin_start, (size_t)tile_count * sizeof(int));
+    dl->bin_start[0] = 0;
+
+    picasso__tile_job job = {
+        .dl = dl,
+        .target = picasso_view_from_backbuffer(bf),
+        .tiles_x = tiles_x,
+    };
+    picasso_parallel_for(tile_count, picasso__render_tile, &job);
+
+    if (bf->damage.enabled) {
+        for (int i = 0; i < dl->count; ++i) {
+            picasso_draw_bounds b = dl->cmds[i].bounds;
+            if (b.x1 <= b.x0 || b.y1 <= b.y0) continue;
+            picasso_backbuffer_add_damage(bf, &(picasso_rect){ b.x0, b.y0, b.x1 - b.x0, b.y1 - b.y0 });
+        }
+    }
+}
+
+/* -------------------- Serialization -------------------- */
+/* Little endian, everything 32 bit except the kind and color bytes:
+ *
+ *   "PDL2" u32 command count, u32 view count
+ *   per command: u8 kind, u8 r g b a, s32 args[4], s32 extra
+ *   per view:    s32 width, s32 height, s32 format, then width * height RGBA pixels
+ *
+ * Bounds are rebuilt on load. Views are stored tightly packed, as RGBA or
+ * premultiplied RGBA, so a loaded list no longer depends on the original pixels.
+ * "PDL1" lists are still read, their views have no format field and are RGBA */
+#define PICASSO__DL_MAGIC        "PDL2"
+#define PICASSO__DL_MAGIC_V1     "PDL1"
+#define PICASSO__DL_HEADER_BYTES 12
+#define PICASSO__DL_CMD_BYTES    25
+#define PICASSO__DL_VIEW_BYTES   12
+#define PICASSO__DL_VIEW_BYTES_V1 8
+
+static uint8_t *picasso__put_u32(uint8_t *p, uint32_t v)
+{
+    p[0] = v & 0xFF;
+    p[1] = (v >> 8) & 0xFF;
+    p[2] = (v >> 16) & 0xFF;
+    p[3] = (v >> 24) & 0xFF;
+    return p + 4;
+}
+
+/* Writes the list to buffer if it fits in capacity. Returns the number of
+ * bytes the list needs either way, pass NULL to just ask. 0 on error */
+size_t picasso_draw_list_serialize(const picasso_draw_list *dl, void *buffer, size_t capacity)
+{
+    if (!dl) return 0;
+
+    size_t size = PICASSO__DL_HEADER_BYTES + (size_t)dl->count * PICASSO__DL_CMD_BYTES;
+    for (int i = 0; i < dl->view_count; ++i) {
+        size += PICASSO__DL_VIEW_BYTES + (size_t)dl->views[i].width * dl->views[i].height * 4;
+    }
+    if (!buffer || capacity < size) return size;
+
+    uint8_t *p = buffer;
+    memcpy(p, PICASSO__DL_MAGIC, 4);
+    p = picasso__put_u32(p + 4, (uint32_t)dl->count);
+    p = picasso__put_u32(p, (uint32_t)dl->view_count);
+
+    for (int i = 0; i < dl->count; ++i) {
+        const picasso__draw_cmd *cmd = &dl->cmds[i];
+        *p++ = cmd->kind;
+        *p++ = cmd->c.r;
+        *p++ = cmd->c.g;
+        *p++ = cmd->c.b;
+        *p++ = cmd->c.a;
+        for (int k = 0; k < 4; ++k) p = picasso__put_u32(p, (uint32_t)cmd->args[k]);
+        p = picasso__put_u32(p, (uint32_t)cmd->extra);
+    }
+
+    for (int i = 0; i < dl->view_count; ++i) {
+        const picasso_view *v = &dl->views[i];
+        picasso_format format = v->format == PICASSO_FORMAT_RGB8 ? PICASSO_FORMAT_RGBA8 : v->format;
+        p = picasso__put_u32(p, (uint32_t)v->width);
+        p = picasso__put_u32(p, (uint32_t)v->height);
+        p = picasso__put_u32(p, (uint32_t)format);
+
+        if (v->format != PICASSO_FORMAT_RGB8) {
+            for (int y = 0; y < v->height; ++y) {
+                memcpy(p + (size_t)y * v->width * 4, v->pixels + y * v->stride, (size_t)v->width * 4);
+            }
+        } else {
+            /* RGB blits are opaque, so blitting onto a chunk is a plain conversion.
+             * The output has no alignment, the chunk gets copied in afterwards */
+            uint32_t chunk[256];
+            picasso_view staged = picasso_view_from_pixels(chunk, 256, 1, sizeof(chunk), PICASSO_FORMAT_RGBA8);
+            picasso_backbuffer out = picasso_backbuffer_from_view(&staged);
+            for (int y = 0; y < v->height; ++y) {
+                uint8_t *row = p + (size_t)y * v->width * 4;
+                for (int x = 0; x < v->width; x += 256) {
+                    int n = PICASSO_MIN(v->width - x, 256);
+                    picasso_view part = picasso_subview(v, (picasso_rect){ x, y, n, 1 });
+                    picasso_blit_view(&out, &part, 0, 0);
+                    memcpy(row + (size_t)x * 4, chunk, (size_t)n * 4);
+                }
+            }
+        }
+        p += (size_t)v->width * v->height * 4;
+    }
+    return size;
+}
+
+picasso_draw_list *picasso_draw_list_deserialize(const void *data, size_t size)
+{
+    const uint8_t *p = data;
+    if (!p || size < PICASSO__DL_HEADER_BYTES ||
+        (memcmp(p, PICASSO__DL_MAGIC, 4) != 0 && memcmp(p, PICASSO__DL_MAGIC_V1, 4) != 0)) {
+        ERROR("Not a serialized draw list");
+        return NULL;
+    }
+    bool v1 = memcmp(p, PICASSO__DL_MAGIC_V1, 4) == 0;
+    size_t view_header = v1 ? PICASSO__DL_VIEW_BYTES_V1 : PICASSO__DL_VIEW_BYTES;
+
+    uint32_t count = picasso_read_u32_le(p + 4);
+    uint32_t view_count = picasso_read_u32_le(p + 8);
+    const uint8_t *end = p + size;
+    p += PICASSO__DL_HEADER_BYTES;
+
+    if (count > (size - PICASSO__DL_HEADER_BYTES) / PICASSO__DL_CMD_BYTES || view_count > count) {
+        ERROR("Draw list data is truncated");
+        return NULL;
+    }
+
+    picasso_draw_list *dl = picasso_draw_list_create();
+    if (!dl) return NULL;
+
+    // Views first, blit commands need their sizes for bounds
+    const uint8_t *views = p + (size_t)count * PICASSO__DL_CMD_BYTES;
+    if ((size_t)(end - views) < (size_t)view_count * view_header) goto truncated;
+
+    size_t pixel_bytes = (size_t)(end - views) - (size_t)view_count * view_header;
+    if (!picasso__grow((void **)&dl->views, &dl->view_capacity, (int)view_count, sizeof(picasso_view)) ||
+        (pixel_bytes && !(dl->owned_pixels = picasso_malloc(pixel_bytes)))) {
+        ERROR("Failed to load draw list views");
+        picasso_draw_list_destroy(dl);
+        return NULL;
+    }
+
+    uint8_t *pixels = dl->owned_pixels;
+    size_t room = pixel_bytes;
+    for (uint32_t i = 0; i < view_count; ++i) {
+        if ((size_t)(end - views) < view_header) goto truncated;
+        int32_t w = picasso_read_s32_le(views);
+        int32_t h = picasso_read_s32_le(views + 4);
+        uint32_t format = v1 ? PICASSO_FORMAT_RGBA8 : picasso_read_u32_le(views + 8);
+        views += view_header;
+
+        if (w <= 0 || h <= 0 || w > PICASSO_MAX_DIM || h > PICASSO_MAX_DIM ||
+            room < (size_t)w * h * 4) goto truncated;
+        if (format != PICASSO_FORMAT_RGBA8 && format != PICASSO_FORMAT_RGBA8_PREMUL) {
+            ERROR("Draw list view %u has unsupported pixel format %u", i, format);
+            picasso_draw_list_destroy(dl);
+            return NULL;
+        }
+
+        size_t bytes = (size_t)w * h * 4;
+        memcpy(pixels, views, bytes);
+        room -= bytes;
+        dl->views[i] = picasso_view_from_pixels(pixels, w, h, (ptrdiff_t)w * 4, (picasso_format)format);
+        pixels += bytes;
+        views += bytes;
+    }
+    dl->view_count = (int)view_count;
+
+    for (uint32_t i = 0; i < count; ++i, p += PICASSO__DL_CMD_BYTES) {
+        color c = { p[1], p[2], p[3], p[4] };
+        int32_t a[5];
+        for (int k = 0; k < 5; ++k) a[k] = picasso_read_s32_le(p + 5 + 4 * k);
+
+        switch (p[0]) {
+        case PICASSO__CMD_FILL_RECT:   picasso_draw_list_fill_rect(dl, (picasso_rect){ a[0], a[1], a[2], a[3] }, c); break;
+        case PICASSO__CMD_CLEAR_RECT:  picasso_draw_list_clear_rect(dl, (picasso_rect){ a[0], a[1], a[2], a[3] }, c); break;
+        case PICASSO__CMD_DRAW_RECT:   picasso_draw_list_draw_rect(dl, (picasso_rect){ a[0], a[1], a[2], a[3] }, a[4], c); break;
+        case PICASSO__CMD_LINE:        picasso_draw_list_draw_line(dl, a[0], a[1], a[2], a[3], c); break;
+        case PICASSO__CMD_FILL_CIRCLE: picasso_draw_list_fill_circle(dl, a[0], a[1], a[2], c); break;
+        case PICASSO__CMD_DRAW_CIRCLE: picasso_draw_list_draw_circle(dl, a[0], a[1], a[2], a[4], c); break;
+        case PICASSO__CMD_BLIT: {
+            if (a[4] < 0 || (uint32_t)a[4] >= view_count) goto truncated;
+            // Re-record against the loaded view without adding a second copy of it
+            picasso__draw_cmd *cmd = picasso__push_cmd(dl, PICASSO__CMD_BLIT, c);
+            if (!cmd) goto truncated;
+            const picasso_view *v = &dl->views[a[4]];
+            cmd->args[0] = a[0];
+            cmd->args[1] = a[1];
+            cmd->extra = a[4];
+            cmd->bounds = (picasso_draw_bounds){ a[0], a[1], a[0] + v->width, a[1] + v->height };
+            picasso__grow_bounds(dl, cmd->bounds);
+            break;
+        }
+        default:
+            goto truncated;
+        }
+    }
+    return dl;
+
+truncated:
+    ERROR("Draw list data is corrupt or truncated");
+    picasso_draw_list_destroy(dl);
+    return NULL;
+}
+
+int picasso_draw_list_save(const picasso_draw_list *dl, const char *file_path)
+{
+    size_t size = picasso_draw_list_serialize(dl, NULL, 0);
+    if (!size) return -1;
+
+    void *data = picasso_malloc(size);
+    if (!data) {
+        ERROR("Failed to allocate %zu bytes for draw list", size);
+        return -1;
+    }
+    picasso_draw_list_serialize(dl, data, size);
+
+    int ok = picasso_write_file(file_path, data, size);
+    picasso_free(data);
+    if (!ok) {
+        ERROR("Failed to write draw list to %s", file_path);
+        return -1;
+    }
+    INFO("Saved draw list to %s (%d commands, %zu bytes)", file_path, dl->count, size);
+    return 0;
+}
+
+picasso_draw_list *picasso_draw_list_load(const char *file_path)
+{
+    size_t size = 0;
+    void *data = picasso_read_entire_file(file_path, &size);
+    if (!data) {
+        ERROR("Failed to read draw list from %s", file_path);
+        return NULL;
+    }
+    picasso_draw_list *dl = picasso_draw_list_deserialize(data, size);
+    picasso_free(data);
+    return dl;
+}
@@ -0,0 +1,260 @@
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "picasso.h"
+#include "logger.h"
+
+/* A ring of backbuffers cycling through free -> acquired (being rendered)
+ * -> queued -> presenting -> free. One render thread acquires and submits,
+ * the present thread hands queued buffers to the user callback in order */
+typedef enum {
+    PICASSO__BUFFER_FREE,
+    PICASSO__BUFFER_ACQUIRED,
+    PICASSO__BUFFER_QUEUED,
+    PICASSO__BUFFER_PRESENTING,
+} picasso__buffer_state;
+
+typedef struct {
+    uint64_t frame;          // frame that was drawn, 0 if none yet
+    picasso_damage damage;   // what that frame drew
+} picasso__frame_record;
+
+struct picasso_swapchain {
+    picasso_swapchain_desc desc;
+    picasso_backbuffer **buffers;
+    picasso__buffer_state *state;
+    uint64_t *content;               // frame each buffer currently holds
+    picasso__frame_record *history;  // last buffer_count frames, by frame % count
+    int *queue;                      // submitted buffers, oldest first
+    int queue_head, queue_len;
+
+    uint64_t frames_submitted;
+    int latest;                      // buffer holding the newest submitted frame, -1 if none
+
+    pthread_mutex_t lock;
+    pthread_cond_t queued;           // present thread waits for work
+    pthread_cond_t released;         // render thread waits for a free buffer
+    pthread_t thread;
+    bool stop;
+};
+
+static void *picasso__present_thread(void *arg)
+{
+    picasso_swapchain *sc = arg;
+
+    pthread_mutex_lock(&sc->lock);
+    for (;;) {
+        while (sc->queue_len == 0 && !sc->stop) {
+            pthread_cond_wait(&sc->queued, &sc->lock);
+        }
+        if (sc->queue_len == 0) break; // stopping, and nothing left to show
+
+        int i = sc->queue[sc->queue_head];
+        sc->queue_head = (sc->queue_head + 1) % sc->desc.buffer_count;
+        sc->queue_len--;
+        sc->state[i] = PICASSO__BUFFER_PRESENTING;
+
+        // Full frame unless copy-forward keeps the rest of the buffer current
+        picasso_backbuffer *bf = sc->buffers[i];
+        picasso_rect damage[PICASSO_MAX_DAMAGE_RECTS];
+        int count = 1;
+        damage[0] = (picasso_rect){ 0, 0, (int)bf->width, (int)bf->height };
+        if (sc->desc.copy_forward) {
+            count = picasso_backbuffer_get_damage(bf, damage, PICASSO_MAX_DAMAGE_RECTS);
+        }
+        pthread_mutex_unlock(&sc->lock);
+
+        sc->desc.present(bf, damage, count, sc->desc.user);
+
+        pthread_mutex_lock(&sc->lock);
+        sc->state[i] = PICASSO__BUFFER_FREE;
+        pthread_cond_broadcast(&sc->released);
+    }
+    pthread_mutex_unlock(&sc->lock);
+    return NULL;
+}
+
+picasso_swapchain *picasso_swapchain_create(const picasso_swapchain_desc *desc)
+{
+    if (!desc || !desc->present || desc->buffer_count < 2 || desc->width <= 0 || desc->height <= 0) {
+        ERROR("Swap chain needs a present callback, a size and at least 2 buffers");
+        return NULL;
+    }
+
+    int n = desc->buffer_count;
+    picasso_swapchain *sc = picasso_calloc(1, sizeof(picasso_swapchain));
+    if (!sc) return NULL;
+
+    sc->desc     = *desc;
+    sc->latest   = -1;
+    sc->buffers  = picasso_calloc(n, sizeof(picasso_backbuffer *));
+    sc->state    = picasso_calloc(n, sizeof(picasso__buffer_state));
+    sc->content  = picasso_calloc(n, sizeof(uint64_t));
+    sc->history  = picasso_calloc(n, sizeof(picasso__frame_record));
+    sc->queue    = picasso_calloc(n, sizeof(int));
+    if (!sc->buffers || !sc->state || !sc->content || !sc->history || !sc->queue) goto fail;
+
+    for (int i = 0; i < n; ++i) {
+        sc->buffers[i] = picasso_create_backbuffer_ex(desc->width, desc->height, desc->alloc_flags);
+        if (!sc->buffers[i]) goto fail;
+    }
+
+    pthread_mutex_init(&sc->lock, NULL);
+    pthread_cond_init(&sc->queued, NULL);
+    pthread_cond_init(&sc->released, NULL);
+    if (pthread_create(&sc->thread, NULL, picasso__present_thread, sc) != 0) {
+        ERROR("Failed to start present thread");
+        pthread_cond_destroy(&sc->released);
+        pthread_cond_destroy(&sc->queued);
+        pthread_mutex_destroy(&sc->lock);
+        goto fail;
+    }
+
+    TRACE("Swap chain %dx%d with %d buffers%s", desc->width, desc->height, n,
+          desc->copy_forward ? ", copy-forward" : "");
+    return sc;
+
+fail:
+    for (int i = 0; sc->buffers && i < n; ++i) picasso_destroy_backbuffer(sc->buffers[i]);
+    picasso_free(sc->buffers);
+    picasso_free(sc->state);
+    picasso_free(sc->content);
+    picasso_free(sc->history);
+    picasso_free(sc->queue);
+    picasso_free(sc);
+    return NULL;
+}
+
+/* Presents everything still queued, then tears down */
+void picasso_swapchain_destroy(picasso_swapchain *sc)
+{
+    if (!sc) return;
+
+    pthread_mutex_lock(&sc->lock);
+    sc->stop = true;
+    pthread_cond_signal(&sc->queued);
+    pthread_mutex_unlock(&sc->lock);
+    pthread_join(sc->thread, NULL);
+
+    pthread_cond_destroy(&sc->released);
+    pthread_cond_destroy(&sc->queued);
+    pthread_mutex_destroy(&sc->lock);
+
+    for (int i = 0; i < sc->desc.buffer_count; ++i) picasso_destroy_backbuffer(sc->buffers[i]);
+    picasso_free(sc->buffers);
+    picasso_free(sc->state);
+    picasso_free(sc->content);
+    picasso_free(sc->history);
+    picasso_free(sc->queue);
+    picasso_free(sc);
+}
+
+static void picasso__copy_region(picasso_backbuffer *dst, const picasso_backbuffer *src, picasso_draw_bounds b)
+{
+    size_t bytes = (size_t)(b.x1 - b.x0) * sizeof(uint32_t);
+    for (int y = b.y0; y < b.y1; ++y) {
+        memcpy((uint8_t *)dst->pixels + (size_t)y * dst->pitch + (size_t)b.x0 * sizeof(uint32_t),
+               (const uint8_t *)src->pixels + (size_t)y * src->pitch + (size_t)b.x0 * sizeof(uint32_t),
+               bytes);
+    }
+}
+
+/* Blocks until a buffer is free. With copy-forward the buffer comes back
+ * holding the previous frame: only the areas drawn in the frames it missed
+ * are copied over from the newest one */
+picasso_backbuffer *picasso_swapchain_acquire(picasso_swapchain *sc)
+{
+    if (!sc) return NULL;
+    int n = sc->desc.buffer_count;
+
+    pthread_mutex_lock(&sc->lock);
+    int pick = -1;
+    while (pick < 0) {
+        // Of the free ones, the buffer with the newest content needs the least copying
+        for (int i = 0; i < n; ++i) {
+            if (sc->state[i] == PICASSO__BUFFER_FREE &&
+                (pick < 0 || sc->content[i] > sc->content[pick])) {
+                pick = i;
+            }
+        }
+        if (pick < 0) pthread_cond_wait(&sc->released, &sc->lock);
+    }
+    sc->state[pick] = PICASSO__BUFFER_ACQUIRED;
+
+    picasso_backbuffer *bf = sc->buffers[pick];
+    if (sc->desc.copy_forward && sc->latest >= 0 && sc->latest != pick) {
+        // The newest frame's buffer is queued, presenting or free, all read-only
+        picasso_backbuffer *latest = sc->buffers[sc->latest];
+        uint64_t have = sc->content[pick];
+        uint64_t want = sc->frames_submitted;
+        bool full = have == 0 || want - have >= (uint64_t)n;
+
+        picasso_damage missed[n];
+        int missed_count = 0;
+        for (uint64_t f = have + 1; !full && f <= want; ++f) {
+            picasso__frame_record *rec = &sc->history[f % n];
+            if (rec->frame != f) { full = true; break; }
+            missed[missed_count++] = rec->damage;
+        }
+        pthread_mutex_unlock(&sc->lock);
+
+        if (full) {
+            picasso__copy_region(bf, latest, (picasso_draw_bounds){ 0, 0, (int)bf->width, (int)bf->height });
+        } else {
+            for (int f = 0; f < missed_count; ++f) {
+                for (int r = 0; r < missed[f].count; ++r) {
+                    picasso__copy_region(bf, latest, missed[f].rects[r]);
+                }
+            }
+        }
+    } else {
+        pthread_mutex_unlock(&sc->lock);
+    }
+
+    // Only what gets drawn from here on is this frame's damage
+    picasso_backbuffer_track_damage(bf, sc->desc.copy_forward);
+    return bf;
+}
+
+void picasso_swapchain_submit(picasso_swapchain *sc, picasso_backbuffer *bf)
+{
+    if (!sc || !bf) return;
+    int n = sc->desc.buffer_count;
+
+    pthread_mutex_lock(&sc->lock);
+    int i = 0;
+    while (i < n && sc->buffers[i] != bf) ++i;
+    if (i == n || sc->state[i] != PICASSO__BUFFER_ACQUIRED) {
+        pthread_mutex_unlock(&sc->lock);
+        ERROR("Submitted a backbuffer that was not acquired from this swap chain");
+        return;
+    }
+
+    uint64_t frame = ++sc->frames_submitted;
+    sc->content[i] = frame;
+    sc->history[frame % n] = (picasso__frame_record){ frame, bf->damage };
+    sc->latest = i;
+
+    sc->queue[(sc->queue_head + sc->queue_len) % n] = i;
+    sc->queue_len++;
+    sc->state[i] = PICASSO__BUFFER_QUEUED;
+    pthread_cond_signal(&sc->queued);
+    pthread_mutex_unlock(&sc->lock);
+}
+
+/* Returns once every submitted frame has been presented */
+void picasso_swapchain_wait_idle(picasso_swapchain *sc)
+{
+    if (!sc) return;
+    pthread_mutex_lock(&sc->lock);
+    for (;;) {
+        bool busy = sc->queue_len > 0;
+        for (int i = 0; i < sc->desc.buffer_count; ++i) {
+            busy |= sc->state[i] == PICASSO__BUFFER_PRESENTING;
+        }
+        if (!busy) break;
+        pthread_cond_wait(&sc->released, &sc->lock);
+    }
+    pthread_mutex_unlock(&sc->lock);
+}
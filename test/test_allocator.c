@@ -0,0 +1,118 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "picasso.h"
+#include "logger.h"
+#include "test_util.h"
+
+/* Runs Picasso's allocations through the arena and pool backends and checks
+ * where the blocks land, that freeing and resetting give the space back, and
+ * that running out is reported rather than written past */
+
+static _Alignas(64) uint8_t arena_buffer[1 << 16];
+static _Alignas(64) uint8_t pool_buffer[1 << 14];
+
+static bool inside(const void *p, const uint8_t *buffer, size_t size)
+{
+    return (const uint8_t *)p >= buffer && (const uint8_t *)p < buffer + size;
+}
+
+static int check_arena(void)
+{
+    int failed = 0;
+    picasso_arena arena;
+    picasso_arena_init(&arena, arena_buffer, sizeof(arena_buffer));
+    picasso_allocator a = picasso_arena_allocator(&arena);
+    picasso_set_allocator(&a);
+
+    void *first = picasso_malloc(100);
+    TEST_CHECK(first && inside(first, arena_buffer, sizeof(arena_buffer)), "Arena block is outside the arena");
+
+    // Only the most recent block gives its space back
+    void *second = picasso_malloc(200);
+    size_t after_second = arena.offset;
+    picasso_free(first);
+    TEST_CHECK(arena.offset == after_second, "Freeing an older block moved the arena");
+    picasso_free(second);
+    TEST_CHECK(arena.offset < after_second && picasso_malloc(200) == second,
+               "Freeing the newest block did not give its space back");
+
+    void *aligned = picasso_malloc_aligned(10, 64);
+    TEST_CHECK(aligned && ((uintptr_t)aligned & 63) == 0, "Aligned arena block is at %p", aligned);
+
+    picasso_image *img = picasso_alloc_image(16, 16, 4);
+    TEST_CHECK(img && inside(img->pixels, arena_buffer, sizeof(arena_buffer)),
+               "Image pixels did not come from the arena");
+
+    void *too_big = picasso_malloc(sizeof(arena_buffer));
+    TEST_CHECK(!too_big, "Arena handed out more than its capacity");
+
+    size_t peak = arena.peak;
+    picasso_arena_reset(&arena);
+    TEST_CHECK(arena.offset == 0 && arena.peak == peak, "Reset left offset %zu, peak %zu", arena.offset, arena.peak);
+    void *again = picasso_malloc(100);
+    TEST_CHECK(again == first, "After a reset the arena did not start over");
+
+    picasso_set_allocator(NULL);
+    void *heap = picasso_malloc(100);
+    TEST_CHECK(heap && !inside(heap, arena_buffer, sizeof(arena_buffer)), "libc was not restored");
+    picasso_free(heap);
+
+    // A heap block grown while the arena is active stays on the heap
+    void *grown = picasso_malloc(16);
+    picasso_set_allocator(&a);
+    size_t offset = arena.offset;
+    grown = picasso_realloc(grown, 4096);
+    picasso_set_allocator(NULL);
+    TEST_CHECK(grown && !inside(grown, arena_buffer, sizeof(arena_buffer)) && arena.offset == offset,
+               "Realloc moved a heap block into the arena");
+    picasso_free(grown);
+    return failed;
+}
+
+static int check_pool(void)
+{
+    int failed = 0;
+    picasso_pool pool;
+    picasso_pool_init(&pool, pool_buffer, sizeof(pool_buffer), 100);
+    TEST_CHECK(pool.block_size % PICASSO_POOL_ALIGN == 0 && pool.block_size >= 100 + PICASSO_ALLOC_OVERHEAD,
+               "Pool block size %zu", pool.block_size);
+    TEST_CHECK(pool.block_count == sizeof(pool_buffer) / pool.block_size, "Pool has %zu blocks", pool.block_count);
+
+    // Only the calling thread's allocations go to the pool
+    picasso_allocator a = picasso_pool_allocator(&pool);
+    picasso_set_thread_allocator(&a);
+
+    void *x = picasso_malloc(100), *y = picasso_malloc(1);
+    TEST_CHECK(x && y && x != y && inside(x, pool_buffer, sizeof(pool_buffer)) &&
+               inside(y, pool_buffer, sizeof(pool_buffer)), "Pool blocks are wrong");
+    TEST_CHECK(pool.used == 2, "Pool counts %zu blocks in use", pool.used);
+
+    picasso_free(x);
+    void *z = picasso_malloc(50);
+    TEST_CHECK(z == x && pool.used == 2, "Freed pool block was not reused");
+    TEST_CHECK(!picasso_malloc(pool.block_size), "Pool handed out a block bigger than its blocks");
+
+    size_t live = pool.used;
+    void *blocks[1 << 8];
+    size_t n = 0;
+    while (n < sizeof(blocks) / sizeof(blocks[0]) && (blocks[n] = picasso_malloc(8))) n++;
+    TEST_CHECK(live + n == pool.block_count, "Pool ran out after %zu of %zu blocks", live + n, pool.block_count);
+
+    picasso_pool_reset(&pool);
+    TEST_CHECK(pool.used == 0 && pool.next == 0 && !pool.free_list, "Reset did not empty the pool");
+    TEST_CHECK(picasso_malloc(8) == x, "Reset pool did not start over");
+
+    picasso_set_thread_allocator(NULL);
+    void *heap = picasso_malloc(8);
+    TEST_CHECK(heap && !inside(heap, pool_buffer, sizeof(pool_buffer)), "Thread allocator was not cleared");
+    picasso_free(heap);
+    return failed;
+}
+
+int main(void)
+{
+    int failed = check_arena() | check_pool();
+    if (!failed) INFO("Arena and pool allocators behave");
+    return failed;
+}
@@ -0,0 +1,110 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "picasso.h"
+#include "logger.h"
+#include "test_util.h"
+
+/* Blits and fills through the span kernels this build picked, and checks
+ * every pixel against the blend formula worked out one pixel at a time here.
+ * Sources have runs of opaque, transparent and mixed pixels long enough for
+ * whole vector blocks of each, and the odd sizes leave a tail on every row */
+
+#define WIDTH  173
+#define HEIGHT 61
+
+static uint32_t div255(uint32_t x)
+{
+    return ((x + 128) * 257) >> 16;
+}
+
+static uint32_t blend(uint32_t dst, uint32_t src)
+{
+    uint32_t a = src >> 24;
+    if (a == 255) return src;
+    if (a == 0) return dst;
+    uint32_t out = 0xFF000000u;
+    for (int shift = 0; shift < 24; shift += 8) {
+        uint32_t s = (src >> shift) & 0xFF, d = (dst >> shift) & 0xFF;
+        out |= div255(s * a + d * (255 - a)) << shift;
+    }
+    return out;
+}
+
+static uint32_t *pixel(picasso_backbuffer *bf, int x, int y)
+{
+    return (uint32_t *)((uint8_t *)bf->pixels + (size_t)y * bf->pitch) + x;
+}
+
+// Expected result of drawing src (NULL for a solid color) at x, y
+static void expect(picasso_backbuffer *ref, const uint32_t *src, int sw, int sh, uint32_t solid, int x, int y)
+{
+    for (int row = 0; row < sh; ++row) {
+        for (int col = 0; col < sw; ++col) {
+            int dx = x + col, dy = y + row;
+            if (dx < 0 || dy < 0 || dx >= WIDTH || dy >= HEIGHT) continue;
+            uint32_t *d = pixel(ref, dx, dy);
+            *d = blend(*d, src ? src[row * sw + col] : solid);
+        }
+    }
+}
+
+int main(void)
+{
+    int failed = 0;
+    enum { SW = 97, SH = 23 };
+    static uint32_t src[SW * SH];
+    static uint8_t rgb[SW * SH * 3];
+    picasso_backbuffer *out = picasso_create_backbuffer(WIDTH, HEIGHT);
+    picasso_backbuffer *ref = picasso_create_backbuffer(WIDTH, HEIGHT);
+    if (!out || !ref) {
+        ERROR("Out of memory");
+        return 1;
+    }
+
+    test_seed = 9;
+    test_fill_random(out->pixels, (size_t)WIDTH * HEIGHT);
+    memcpy(ref->pixels, out->pixels, (size_t)out->pitch * HEIGHT);
+    test_fill_random(src, SW * SH);
+    for (int i = 0; i < SW * SH; ++i) {
+        // Runs of 9 opaque, 9 transparent, then 9 of anything
+        uint32_t run = (uint32_t)(i / 9) % 3;
+        if (run == 0) src[i] |= 0xFF000000u;
+        if (run == 1) src[i] &= 0x00FFFFFFu;
+    }
+    for (size_t i = 0; i < sizeof(rgb); ++i) rgb[i] = test_next_byte();
+
+    picasso_view view = picasso_view_from_pixels(src, SW, SH, SW * 4, PICASSO_FORMAT_RGBA8);
+    int spots[][2] = { { 0, 0 }, { -3, -2 }, { 5, 7 }, { 101, 44 }, { 76, -20 } };
+    for (size_t i = 0; i < sizeof(spots) / sizeof(spots[0]); ++i) {
+        picasso_blit_view(out, &view, spots[i][0], spots[i][1]);
+        expect(ref, src, SW, SH, 0, spots[i][0], spots[i][1]);
+    }
+    TEST_CHECK(test_same_pixels(out, ref), "RGBA blits differ from the per pixel blend");
+
+    // Translucent, opaque and fully transparent colors
+    color colors[] = { { 200, 10, 99, 77 }, { 1, 2, 3, 255 }, { 255, 255, 255, 0 }, { 9, 250, 128, 1 },
+                       { 60, 70, 80, 254 } };
+    for (size_t i = 0; i < sizeof(colors) / sizeof(colors[0]); ++i) {
+        picasso_rect r = { (int)i * 31 - 10, (int)i * 11 - 5, 45 + (int)i * 7, 30 };
+        picasso_fill_rect(out, &r, colors[i]);
+        expect(ref, NULL, r.width, r.height, color_to_u32(colors[i]), r.x, r.y);
+    }
+    TEST_CHECK(test_same_pixels(out, ref), "Filled rects differ from the per pixel blend");
+
+    // RGB is opaque, each pixel is just converted
+    picasso_view rgb_view = picasso_view_from_pixels(rgb, SW, SH, SW * 3, PICASSO_FORMAT_RGB8);
+    picasso_blit_view(out, &rgb_view, 40, 30);
+    for (int y = 0; y < SH; ++y) {
+        for (int x = 0; x < SW && 40 + x < WIDTH && 30 + y < HEIGHT; ++x) {
+            const uint8_t *p = rgb + (y * SW + x) * 3;
+            *pixel(ref, 40 + x, 30 + y) = 0xFF000000u | (uint32_t)p[2] << 16 | (uint32_t)p[1] << 8 | p[0];
+        }
+    }
+    TEST_CHECK(test_same_pixels(out, ref), "RGB blit differs from a plain conversion");
+
+    if (!failed) INFO("Span kernels match the per pixel blend");
+    picasso_destroy_backbuffer(out);
+    picasso_destroy_backbuffer(ref);
+    return failed;
+}
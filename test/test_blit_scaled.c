@@ -0,0 +1,103 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "picasso.h"
+#include "logger.h"
+#include "test_util.h"
+
+/* Scaled blits that land on whole source pixels must match a plain blit:
+ * both filters at 1:1 (bilinear against the premultiplied source), nearest at 2x against a source doubled by hand, and
+ * nearest at 1/3 against every third pixel picked by hand. Straight,
+ * premultiplied and RGB sources, straight and premultiplied targets, with
+ * the target rect clipped on the left and top */
+
+#define WIDTH  160
+#define HEIGHT 100
+#define SW     51
+#define SH     30
+
+static uint32_t background[WIDTH * HEIGHT];
+
+static void reset(picasso_backbuffer *bf)
+{
+    for (int y = 0; y < HEIGHT; ++y) {
+        memcpy((uint8_t *)bf->pixels + (size_t)y * bf->pitch, background + y * WIDTH, WIDTH * 4);
+    }
+}
+
+// Source pixel sx, sy of v, repeated or skipped into the same format
+static picasso_view resample(const picasso_view *v, void *out, int w, int h, int num, int den, int phase)
+{
+    int bpp = picasso_format_bytes(v->format);
+    for (int y = 0; y < h; ++y) {
+        for (int x = 0; x < w; ++x) {
+            int sx = (x * num + phase) / den, sy = (y * num + phase) / den;
+            memcpy((uint8_t *)out + ((size_t)y * w + x) * bpp, v->pixels + sy * v->stride + sx * bpp, bpp);
+        }
+    }
+    return picasso_view_from_pixels(out, w, h, (ptrdiff_t)w * bpp, v->format);
+}
+
+int main(void)
+{
+    int failed = 0;
+    static uint32_t straight[SW * SH], premul[SW * SH];
+    static uint8_t rgb[SW * SH * 3];
+    static uint32_t scratch[(2 * SW) * (2 * SH)];
+    test_seed = 33;
+    test_fill_random(straight, SW * SH);
+    picasso_premultiply_pixels((uint8_t *)premul, (const uint8_t *)straight, SW * SH);
+    for (size_t i = 0; i < sizeof(rgb); ++i) rgb[i] = test_next_byte();
+    test_fill_random(background, WIDTH * HEIGHT);
+
+    picasso_view views[] = {
+        picasso_view_from_pixels(straight, SW, SH, SW * 4, PICASSO_FORMAT_RGBA8),
+        picasso_view_from_pixels(premul, SW, SH, SW * 4, PICASSO_FORMAT_RGBA8_PREMUL),
+        picasso_view_from_pixels(rgb, SW, SH, SW * 3, PICASSO_FORMAT_RGB8),
+    };
+    const char *names[] = { "straight", "premultiplied", "RGB" };
+    int x = -7, y = -4;
+
+    for (int premultiplied = 0; premultiplied < 2; ++premultiplied) {
+        uint32_t flags = premultiplied ? PICASSO_ALLOC_PREMULTIPLIED : 0;
+        const char *target = premultiplied ? "premultiplied" : "straight";
+        picasso_backbuffer *out = picasso_create_backbuffer_ex(WIDTH, HEIGHT, flags);
+        picasso_backbuffer *ref = picasso_create_backbuffer_ex(WIDTH, HEIGHT, flags);
+        if (!out || !ref) return 1;
+
+        for (int s = 0; s < 3; ++s) {
+            const picasso_view *v = &views[s];
+            for (int filter = PICASSO_FILTER_NEAREST; filter <= PICASSO_FILTER_BILINEAR; ++filter) {
+                reset(out);
+                reset(ref);
+                picasso_blit_scaled(out, v, (picasso_rect){ x, y, SW, SH }, (picasso_filter)filter);
+                // Bilinear mixes premultiplied colors, so a straight source arrives premultiplied
+                bool bilinear = filter == PICASSO_FILTER_BILINEAR;
+                picasso_blit_view(ref, bilinear && s == 0 ? &views[1] : v, x, y);
+                TEST_CHECK(test_same_pixels(out, ref), "%s 1:1 %s blit differs from a plain blit on a %s target",
+                           bilinear ? "Bilinear" : "Nearest", names[s], target);
+            }
+
+            reset(out);
+            reset(ref);
+            picasso_view doubled = resample(v, scratch, 2 * SW, 2 * SH, 1, 2, 0);
+            picasso_blit_scaled(out, v, (picasso_rect){ x, y, 2 * SW, 2 * SH }, PICASSO_FILTER_NEAREST);
+            picasso_blit_view(ref, &doubled, x, y);
+            TEST_CHECK(test_same_pixels(out, ref), "Nearest 2x %s blit differs from a doubled source on a %s target",
+                       names[s], target);
+
+            reset(out);
+            reset(ref);
+            picasso_view third = resample(v, scratch, SW / 3, SH / 3, 3, 1, 1);
+            picasso_blit_scaled(out, v, (picasso_rect){ x, y, SW / 3, SH / 3 }, PICASSO_FILTER_NEAREST);
+            picasso_blit_view(ref, &third, x, y);
+            TEST_CHECK(test_same_pixels(out, ref), "Nearest 1/3 %s blit differs from every third pixel on a %s target",
+                       names[s], target);
+        }
+        picasso_destroy_backbuffer(out);
+        picasso_destroy_backbuffer(ref);
+    }
+
+    if (!failed) INFO("Scaled blits on whole pixels match plain blits");
+    return failed;
+}
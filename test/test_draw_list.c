@@ -0,0 +1,304 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "picasso.h"
+#include "logger.h"
+#include "test_util.h"
+
+/* Draws one scene of overlapping, mostly translucent primitives straight into
+ * a backbuffer and through a draw list, and checks that executing the list
+ * gives the same pixels on one thread and on four, and that replaying it does
+ * too. The scene spans several tiles and most primitives cross a tile edge.
+ * The list is then sent through serialize / deserialize and through a file,
+ * and every copy must replay to the same pixels and serialize back to the
+ * same bytes */
+
+#define WIDTH  200 // not a multiple of PICASSO_DRAW_TILE_SIZE, so edge tiles are partial
+#define HEIGHT 150
+#define OPS    90
+
+typedef enum { OP_FILL, OP_CLEAR, OP_RECT, OP_LINE, OP_CIRCLE, OP_RING, OP_BLIT, OP_KIND_COUNT } op_kind;
+
+typedef struct {
+    op_kind kind;
+    picasso_rect r;
+    int thickness;
+    color c;
+    const picasso_view *view;
+} op;
+
+static op scene[OPS];
+
+static void make_scene(const picasso_view *views, int view_count)
+{
+    test_seed = 11;
+    for (int i = 0; i < OPS; ++i) {
+        op *o = &scene[i];
+        o->kind = (op_kind)(i % OP_KIND_COUNT);
+        o->r.x = test_next_byte() % (WIDTH + 40) - 20;
+        o->r.y = test_next_byte() % (HEIGHT + 40) - 20;
+        o->r.width = 1 + test_next_byte() % 90;
+        o->r.height = 1 + test_next_byte() % 90;
+        o->thickness = 1 + test_next_byte() % 6;
+        o->c.r = test_next_byte();
+        o->c.g = test_next_byte();
+        o->c.b = test_next_byte();
+        o->c.a = i % 4 == 0 ? 255 : test_next_byte();
+        o->view = &views[i % view_count];
+    }
+}
+
+static void draw_immediate(picasso_backbuffer *bf, int dx, int dy)
+{
+    for (int i = 0; i < OPS; ++i) {
+        op moved = scene[i], *o = &moved;
+        o->r.x += dx;
+        o->r.y += dy;
+        switch (o->kind) {
+        case OP_FILL:   picasso_fill_rect(bf, &o->r, o->c); break;
+        case OP_CLEAR:  picasso_clear_rect(bf, &o->r, o->c); break;
+        case OP_RECT:   picasso_draw_rect(bf, &o->r, o->thickness, o->c); break;
+        case OP_LINE:   picasso_draw_line(bf, o->r.x, o->r.y, o->r.x + o->r.width, o->r.y + o->r.height, o->c); break;
+        case OP_CIRCLE: picasso_fill_circle(bf, o->r.x, o->r.y, o->r.width / 2, o->c); break;
+        case OP_RING:   picasso_draw_circle(bf, o->r.x, o->r.y, o->r.width / 2, o->thickness, o->c); break;
+        case OP_BLIT:   picasso_blit_view(bf, o->view, o->r.x, o->r.y); break;
+        default: break;
+        }
+    }
+}
+
+static void record(picasso_draw_list *dl)
+{
+    for (int i = 0; i < OPS; ++i) {
+        const op *o = &scene[i];
+        switch (o->kind) {
+        case OP_FILL:   picasso_draw_list_fill_rect(dl, o->r, o->c); break;
+        case OP_CLEAR:  picasso_draw_list_clear_rect(dl, o->r, o->c); break;
+        case OP_RECT:   picasso_draw_list_draw_rect(dl, o->r, o->thickness, o->c); break;
+        case OP_LINE:   picasso_draw_list_draw_line(dl, o->r.x, o->r.y, o->r.x + o->r.width, o->r.y + o->r.height, o->c); break;
+        case OP_CIRCLE: picasso_draw_list_fill_circle(dl, o->r.x, o->r.y, o->r.width / 2, o->c); break;
+        case OP_RING:   picasso_draw_list_draw_circle(dl, o->r.x, o->r.y, o->r.width / 2, o->thickness, o->c); break;
+        case OP_BLIT:   picasso_draw_list_blit_view(dl, o->view, o->r.x, o->r.y); break;
+        default: break;
+        }
+    }
+}
+
+static bool replay_matches(const picasso_draw_list *a, const picasso_draw_list *b, const char *what)
+{
+    picasso_backbuffer *fa = picasso_create_backbuffer(WIDTH, HEIGHT);
+    picasso_backbuffer *fb = picasso_create_backbuffer(WIDTH, HEIGHT);
+    bool same = false;
+    if (fa && fb) {
+        picasso_clear_backbuffer(fa);
+        picasso_clear_backbuffer(fb);
+        picasso_draw_list_replay(a, fa, 3, -2);
+        picasso_draw_list_replay(b, fb, 3, -2);
+        same = test_same_pixels(fa, fb);
+    }
+    if (!same) ERROR("%s draw list replays differently", what);
+    picasso_destroy_backbuffer(fa);
+    picasso_destroy_backbuffer(fb);
+    return same;
+}
+
+static bool bytes_match(const picasso_draw_list *a, const picasso_draw_list *b, const char *what)
+{
+    size_t size_a = picasso_draw_list_serialize(a, NULL, 0);
+    size_t size_b = picasso_draw_list_serialize(b, NULL, 0);
+    uint8_t *data_a = malloc(size_a), *data_b = malloc(size_b);
+    bool same = data_a && data_b && size_a == size_b &&
+                picasso_draw_list_serialize(a, data_a, size_a) == size_a &&
+                picasso_draw_list_serialize(b, data_b, size_b) == size_b &&
+                memcmp(data_a, data_b, size_a) == 0;
+    if (!same) ERROR("%s draw list serializes differently", what);
+    free(data_a);
+    free(data_b);
+    return same;
+}
+
+static int check_round_trip(const picasso_draw_list *dl)
+{
+    int failed = 0;
+    size_t size = picasso_draw_list_serialize(dl, NULL, 0);
+    uint8_t *data = malloc(size);
+    if (!data || picasso_draw_list_serialize(dl, data, size) != size) {
+        ERROR("Failed to serialize draw list");
+        free(data);
+        return 1;
+    }
+
+    picasso_draw_list *loaded = picasso_draw_list_deserialize(data, size);
+    if (!loaded) {
+        ERROR("Failed to deserialize draw list");
+        failed = 1;
+    } else {
+        TEST_CHECK(picasso_draw_list_count(loaded) == picasso_draw_list_count(dl), "Loaded %d commands, recorded %d",
+                   picasso_draw_list_count(loaded), picasso_draw_list_count(dl));
+        if (!replay_matches(dl, loaded, "Deserialized")) failed = 1;
+        if (!bytes_match(dl, loaded, "Deserialized")) failed = 1;
+    }
+
+    // Cut short anywhere, the data must be refused rather than read past its end
+    for (size_t cut = 0; cut < size; cut += 97) {
+        picasso_draw_list *partial = picasso_draw_list_deserialize(data, cut);
+        if (partial) {
+            ERROR("Draw list cut to %zu of %zu bytes still loaded", cut, size);
+            picasso_draw_list_destroy(partial);
+            failed = 1;
+        }
+    }
+
+    const char *file_path = "test_draw_list.pdl";
+    picasso_draw_list *from_file = NULL;
+    if (picasso_draw_list_save(dl, file_path) != 0 || !(from_file = picasso_draw_list_load(file_path))) {
+        ERROR("Failed to save and load %s", file_path);
+        failed = 1;
+    } else {
+        if (!replay_matches(dl, from_file, "File")) failed = 1;
+        if (!bytes_match(dl, from_file, "File")) failed = 1;
+    }
+    remove(file_path);
+
+    picasso_draw_list_destroy(from_file);
+    picasso_draw_list_destroy(loaded);
+    free(data);
+    return failed;
+}
+
+// RGB views wider than one conversion chunk are packed to RGBA in pieces
+static int check_wide_rgb(void)
+{
+    enum { W = 300, H = 2 };
+    int failed = 0;
+    static uint8_t rgb_px[W * H * 3];
+    for (size_t i = 0; i < sizeof(rgb_px); ++i) rgb_px[i] = test_next_byte();
+    picasso_view rgb = picasso_view_from_pixels(rgb_px, W, H, W * 3, PICASSO_FORMAT_RGB8);
+
+    picasso_draw_list *dl = picasso_draw_list_create();
+    picasso_backbuffer *ref = picasso_create_backbuffer(W, H);
+    picasso_backbuffer *out = picasso_create_backbuffer(W, H);
+    if (!dl || !ref || !out) {
+        ERROR("Out of memory");
+        return 1;
+    }
+    picasso_draw_list_blit_view(dl, &rgb, 0, 0);
+    size_t size = picasso_draw_list_serialize(dl, NULL, 0);
+    uint8_t *data = malloc(size + 1);
+    picasso_draw_list *loaded = NULL;
+    // One byte in, so the packed pixels land on an odd address
+    if (!data || picasso_draw_list_serialize(dl, data + 1, size) != size ||
+        !(loaded = picasso_draw_list_deserialize(data + 1, size))) {
+        ERROR("Failed to round trip a %dx%d RGB view", W, H);
+        failed = 1;
+    } else {
+        picasso_clear_backbuffer(ref);
+        picasso_clear_backbuffer(out);
+        picasso_blit_view(ref, &rgb, 0, 0);
+        picasso_draw_list_replay(loaded, out, 0, 0);
+        TEST_CHECK(test_same_pixels(out, ref), "Round tripped %dx%d RGB view differs from a blit", W, H);
+    }
+    picasso_draw_list_destroy(loaded);
+    picasso_draw_list_destroy(dl);
+    picasso_destroy_backbuffer(ref);
+    picasso_destroy_backbuffer(out);
+    free(data);
+    return failed;
+}
+
+// Equal views share one serialized copy, whatever their struct padding holds
+static int check_shared_view(const picasso_view *v)
+{
+    int failed = 0;
+    picasso_view dirty;
+    memset(&dirty, 0xFF, sizeof(dirty));
+    dirty.pixels = v->pixels;
+    dirty.width = v->width;
+    dirty.height = v->height;
+    dirty.stride = v->stride;
+    dirty.format = v->format;
+
+    picasso_draw_list *once = picasso_draw_list_create();
+    picasso_draw_list *twice = picasso_draw_list_create();
+    if (!once || !twice) {
+        ERROR("Out of memory");
+        return 1;
+    }
+    picasso_draw_list_blit_view(once, v, 0, 0);
+    picasso_draw_list_blit_view(twice, v, 0, 0);
+    picasso_draw_list_blit_view(twice, &dirty, 5, 5);
+    size_t view_bytes = (size_t)v->width * v->height * 4;
+    size_t once_size = picasso_draw_list_serialize(once, NULL, 0);
+    size_t twice_size = picasso_draw_list_serialize(twice, NULL, 0);
+    TEST_CHECK(twice_size < once_size + view_bytes, "Blitting an equal view again stored its pixels twice");
+    picasso_draw_list_destroy(once);
+    picasso_draw_list_destroy(twice);
+    return failed;
+}
+
+int main(void)
+{
+    int failed = 0;
+    uint32_t rgba_px[37 * 29], premul_px[19 * 23];
+    uint8_t rgb_px[45 * 21 * 3];
+    test_seed = 5;
+    test_fill_random(rgba_px, sizeof(rgba_px) / sizeof(rgba_px[0]));
+    test_fill_random(premul_px, sizeof(premul_px) / sizeof(premul_px[0]));
+    picasso_premultiply_pixels((uint8_t *)premul_px, (uint8_t *)premul_px, sizeof(premul_px) / sizeof(premul_px[0]));
+    for (size_t i = 0; i < sizeof(rgb_px); ++i) rgb_px[i] = test_next_byte();
+    picasso_view views[] = {
+        picasso_view_from_pixels(rgba_px, 37, 29, 37 * 4, PICASSO_FORMAT_RGBA8),
+        picasso_view_from_pixels(rgb_px, 45, 21, 45 * 3, PICASSO_FORMAT_RGB8),
+        picasso_view_from_pixels(premul_px, 19, 23, 19 * 4, PICASSO_FORMAT_RGBA8_PREMUL),
+    };
+    make_scene(views, sizeof(views) / sizeof(views[0]));
+
+    picasso_backbuffer *ref = picasso_create_backbuffer(WIDTH, HEIGHT);
+    picasso_backbuffer *out = picasso_create_backbuffer(WIDTH, HEIGHT);
+    picasso_draw_list *dl = picasso_draw_list_create();
+    if (!ref || !out || !dl) {
+        ERROR("Out of memory");
+        return 1;
+    }
+    test_fill_random(ref->pixels, (size_t)WIDTH * HEIGHT);
+    uint32_t *background = malloc((size_t)ref->pitch * HEIGHT);
+    if (!background) return 1;
+    memcpy(background, ref->pixels, (size_t)ref->pitch * HEIGHT);
+    draw_immediate(ref, 0, 0);
+
+    record(dl);
+    TEST_CHECK(picasso_draw_list_count(dl) == OPS, "Recorded %d of %d commands", picasso_draw_list_count(dl), OPS);
+
+    int threads[] = { 1, 4 };
+    for (size_t i = 0; i < sizeof(threads) / sizeof(threads[0]); ++i) {
+        picasso_set_thread_count(threads[i]);
+        memcpy(out->pixels, background, (size_t)out->pitch * HEIGHT);
+        picasso_draw_list_execute(dl, out);
+        TEST_CHECK(test_same_pixels(out, ref), "Draw list on %d threads differs from immediate drawing", threads[i]);
+    }
+
+    memcpy(out->pixels, background, (size_t)out->pitch * HEIGHT);
+    picasso_draw_list_replay(dl, out, 0, 0);
+    TEST_CHECK(test_same_pixels(out, ref), "Replayed draw list differs from immediate drawing");
+
+    // Replaying with an offset moves every command
+    memcpy(ref->pixels, background, (size_t)ref->pitch * HEIGHT);
+    draw_immediate(ref, 17, -9);
+    memcpy(out->pixels, background, (size_t)out->pitch * HEIGHT);
+    picasso_draw_list_replay(dl, out, 17, -9);
+    TEST_CHECK(test_same_pixels(out, ref), "Draw list replayed at 17, -9 differs from immediate drawing");
+
+    failed |= check_round_trip(dl);
+    failed |= check_wide_rgb();
+    failed |= check_shared_view(&views[0]);
+
+    picasso_draw_list_reset(dl);
+    TEST_CHECK(picasso_draw_list_count(dl) == 0, "Reset left %d commands", picasso_draw_list_count(dl));
+
+    if (!failed) INFO("Draw list of %d commands matches immediate drawing and round trips", OPS);
+    picasso_draw_list_destroy(dl);
+    picasso_destroy_backbuffer(ref);
+    picasso_destroy_backbuffer(out);
+    free(background);
+    return failed;
+}
@@ -0,0 +1,112 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "picasso.h"
+#include "logger.h"
+#include "test_util.h"
+
+/* Releases and re-acquires images and backbuffers through an image pool and
+ * checks the hit and miss counts, the cached byte totals, and that the budget
+ * evicts the least recently released buffer first */
+
+static size_t image_bytes(int width, int height, int channels)
+{
+    return (size_t)width * channels * height + sizeof(picasso_image);
+}
+
+int main(void)
+{
+    int failed = 0;
+    size_t hits;
+    picasso_image_pool *pool = picasso_image_pool_create(1 << 20);
+    if (!pool) {
+        ERROR("Failed to create image pool");
+        return 1;
+    }
+
+    // The same key comes back as the same buffer
+    picasso_image *img = picasso_image_pool_acquire(pool, 64, 32, 4, 0);
+    picasso_image_pool_release(pool, img);
+    picasso_image_pool_stats stats = picasso_image_pool_get_stats(pool);
+    TEST_CHECK(stats.misses == 1 && stats.hits == 0, "First acquire counted %zu hits, %zu misses",
+               stats.hits, stats.misses);
+    TEST_CHECK(stats.buffers_cached == 1 && stats.bytes_cached == image_bytes(64, 32, 4),
+               "Pool caches %zu buffers of %zu bytes", stats.buffers_cached, stats.bytes_cached);
+
+    picasso_image *again = picasso_image_pool_acquire(pool, 64, 32, 4, 0);
+    stats = picasso_image_pool_get_stats(pool);
+    TEST_CHECK(again == img && stats.hits == 1 && stats.buffers_cached == 0 && stats.bytes_cached == 0,
+               "Re-acquiring the same key missed");
+
+    // Channels are part of the key
+    picasso_image *rgb = picasso_image_pool_acquire(pool, 64, 32, 3, 0);
+    TEST_CHECK(rgb && rgb != img && picasso_image_pool_get_stats(pool).misses == 2, "RGB acquire hit an RGBA image");
+    picasso_image_pool_release(pool, rgb);
+    picasso_image_pool_release(pool, again);
+
+    // A recycled backbuffer keeps its pixels, but not the damage it was tracking
+    picasso_backbuffer *bf = picasso_image_pool_acquire_backbuffer(pool, 40, 30, 0);
+    picasso_backbuffer_track_damage(bf, true);
+    picasso_fill_rect(bf, &(picasso_rect){ 2, 3, 10, 10 }, (color){ 1, 2, 3, 255 });
+    picasso_image_pool_release_backbuffer(pool, bf);
+    picasso_backbuffer *bf_again = picasso_image_pool_acquire_backbuffer(pool, 40, 30, 0);
+    TEST_CHECK(bf_again == bf && bf_again->width == 40 && bf_again->height == 30, "Backbuffer was not reused");
+    TEST_CHECK(!bf_again->damage.enabled && bf_again->damage.count == 0,
+               "Recycled backbuffer still tracks %d damage rects", bf_again->damage.count);
+    picasso_image_pool_release_backbuffer(pool, bf_again);
+
+    // Huge pages are best effort and not part of the key, whatever was granted serves either request
+    picasso_backbuffer *huge = picasso_image_pool_acquire_backbuffer(pool, 48, 16, PICASSO_ALLOC_HUGE_PAGES);
+    picasso_image_pool_release_backbuffer(pool, huge);
+    hits = picasso_image_pool_get_stats(pool).hits;
+    picasso_backbuffer *huge_again = picasso_image_pool_acquire_backbuffer(pool, 48, 16, PICASSO_ALLOC_HUGE_PAGES);
+    picasso_image_pool_release_backbuffer(pool, huge_again);
+    picasso_backbuffer *plain = picasso_image_pool_acquire_backbuffer(pool, 48, 16, 0);
+    TEST_CHECK(huge_again == huge && plain == huge && picasso_image_pool_get_stats(pool).hits == hits + 2,
+               "Re-acquiring a huge page backbuffer missed");
+    picasso_image_pool_release_backbuffer(pool, plain);
+
+    // Room for the two newest of three, the oldest goes
+    picasso_image_pool_set_budget(pool, 0);
+    stats = picasso_image_pool_get_stats(pool);
+    TEST_CHECK(stats.buffers_cached == 0 && stats.bytes_cached == 0 && stats.evictions == 4,
+               "A zero budget left %zu buffers and counted %zu evictions", stats.buffers_cached, stats.evictions);
+
+    picasso_image_pool_set_budget(pool, image_bytes(100, 101, 4) + image_bytes(100, 102, 4));
+    picasso_image *a = picasso_image_pool_acquire(pool, 100, 100, 4, 0);
+    picasso_image *b = picasso_image_pool_acquire(pool, 100, 101, 4, 0);
+    picasso_image *c = picasso_image_pool_acquire(pool, 100, 102, 4, 0);
+    picasso_image_pool_release(pool, a);
+    picasso_image_pool_release(pool, b);
+    picasso_image_pool_release(pool, c);
+    stats = picasso_image_pool_get_stats(pool);
+    TEST_CHECK(stats.evictions == 5 && stats.buffers_cached == 2 &&
+               stats.bytes_cached == image_bytes(100, 101, 4) + image_bytes(100, 102, 4),
+               "Budget kept %zu buffers of %zu bytes", stats.buffers_cached, stats.bytes_cached);
+
+    hits = stats.hits;
+    picasso_image *b2 = picasso_image_pool_acquire(pool, 100, 101, 4, 0);
+    picasso_image *c2 = picasso_image_pool_acquire(pool, 100, 102, 4, 0);
+    picasso_image *a2 = picasso_image_pool_acquire(pool, 100, 100, 4, 0);
+    stats = picasso_image_pool_get_stats(pool);
+    TEST_CHECK(b2 == b && c2 == c && stats.hits == hits + 2, "The newest two were not kept");
+    TEST_CHECK(a2 && a2 != b && a2 != c, "The oldest buffer came back");
+
+    // Bigger than the whole budget, it is freed straight away
+    picasso_image *big = picasso_image_pool_acquire(pool, 200, 200, 4, 0);
+    picasso_image_pool_release(pool, big);
+    stats = picasso_image_pool_get_stats(pool);
+    TEST_CHECK(stats.evictions == 6 && stats.buffers_cached == 0, "Oversize buffer was cached");
+
+    picasso_image_pool_release(pool, a2);
+    picasso_image_pool_release(pool, b2);
+    picasso_image_pool_release(pool, c2);
+    picasso_image_pool_trim(pool, image_bytes(100, 102, 4));
+    stats = picasso_image_pool_get_stats(pool);
+    TEST_CHECK(stats.buffers_cached == 1 && stats.bytes_cached == image_bytes(100, 102, 4),
+               "Trim kept %zu buffers of %zu bytes", stats.buffers_cached, stats.bytes_cached);
+
+    picasso_image_pool_destroy(pool);
+    if (!failed) INFO("Image pool hits, misses and evictions match");
+    return failed;
+}
@@ -0,0 +1,126 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "picasso.h"
+#include "logger.h"
+#include "test_util.h"
+
+/* Draws nine patches and compares them with a plain blit of the whole frame
+ * built by hand: corners copied, edges and center repeated from their top
+ * left (tile) or sampled at nearest pixel centers (stretch). At its own size
+ * a patch is just a blit of its source. One source has a flat translucent
+ * center, which the patch draws as a fill. Straight, premultiplied and RGB
+ * sources on straight and premultiplied targets, partly off screen */
+
+#define WIDTH  180
+#define HEIGHT 130
+#define SW     23
+#define SH     19
+#define L      5
+#define T      4
+#define R      7
+#define B      3
+
+static uint32_t background[WIDTH * HEIGHT];
+
+static void reset(picasso_backbuffer *bf)
+{
+    for (int y = 0; y < HEIGHT; ++y) {
+        memcpy((uint8_t *)bf->pixels + (size_t)y * bf->pitch, background + y * WIDTH, WIDTH * 4);
+    }
+}
+
+// Source column (or row) for target position i of size, margins lo and hi over src pixels
+static int source_pos(int i, int size, int src, int lo, int hi, picasso_nine_patch_mode mode)
+{
+    if (i < lo) return i;
+    if (i >= size - hi) return src - (size - i);
+    int d = size - lo - hi, s = src - lo - hi;
+    if (mode == PICASSO_NINE_PATCH_TILE) return lo + (i - lo) % s;
+    // Nearest samples target pixel centers, in 16.16 like the scaler
+    int64_t step = ((int64_t)s << 16) / d;
+    int64_t pos = (int64_t)(i - lo) * step + step / 2;
+    return lo + (int)PICASSO_MIN(pos >> 16, (int64_t)s - 1);
+}
+
+static void build(const uint32_t *src, uint32_t *out, int w, int h, picasso_nine_patch_mode mode)
+{
+    for (int y = 0; y < h; ++y) {
+        int sy = source_pos(y, h, SH, T, B, mode);
+        for (int x = 0; x < w; ++x) out[y * w + x] = src[sy * SW + source_pos(x, w, SW, L, R, mode)];
+    }
+}
+
+int main(void)
+{
+    int failed = 0;
+    static uint32_t straight[SW * SH], premul[SW * SH], flat[SW * SH], flat_premul[SW * SH], widened[SW * SH];
+    static uint8_t rgb[SW * SH * 3];
+    static uint32_t expected[WIDTH * HEIGHT];
+    test_seed = 49;
+    test_fill_random(straight, SW * SH);
+    picasso_premultiply_pixels((uint8_t *)premul, (const uint8_t *)straight, SW * SH);
+    for (size_t i = 0; i < sizeof(rgb); ++i) rgb[i] = test_next_byte();
+    for (int i = 0; i < SW * SH; ++i) {
+        const uint8_t *p = rgb + i * 3;
+        widened[i] = 0xFF000000u | (uint32_t)p[2] << 16 | (uint32_t)p[1] << 8 | p[0];
+    }
+    memcpy(flat, straight, sizeof(flat));
+    for (int y = T; y < SH - B; ++y) {
+        for (int x = L; x < SW - R; ++x) flat[y * SW + x] = 0x80402010u;
+    }
+    picasso_premultiply_pixels((uint8_t *)flat_premul, (const uint8_t *)flat, SW * SH);
+    test_fill_random(background, WIDTH * HEIGHT);
+
+    struct {
+        const char *name;
+        picasso_view view;
+        const uint32_t *pixels; // what the patch holds, RGB widened
+        picasso_format format;
+    } sources[] = {
+        { "straight", picasso_view_from_pixels(straight, SW, SH, SW * 4, PICASSO_FORMAT_RGBA8), straight, PICASSO_FORMAT_RGBA8 },
+        { "premultiplied", picasso_view_from_pixels(premul, SW, SH, SW * 4, PICASSO_FORMAT_RGBA8_PREMUL), premul, PICASSO_FORMAT_RGBA8_PREMUL },
+        { "RGB", picasso_view_from_pixels(rgb, SW, SH, SW * 3, PICASSO_FORMAT_RGB8), widened, PICASSO_FORMAT_RGBA8 },
+        { "solid center", picasso_view_from_pixels(flat, SW, SH, SW * 4, PICASSO_FORMAT_RGBA8), flat, PICASSO_FORMAT_RGBA8 },
+        { "premultiplied solid center", picasso_view_from_pixels(flat_premul, SW, SH, SW * 4, PICASSO_FORMAT_RGBA8_PREMUL), flat_premul, PICASSO_FORMAT_RGBA8_PREMUL },
+    };
+    picasso_rect rects[] = { { 10, 12, SW, SH }, { -9, 20, 150, 41 }, { 60, -6, 37, 110 }, { 170, 100, 55, 44 } };
+
+    for (int premultiplied = 0; premultiplied < 2; ++premultiplied) {
+        uint32_t flags = premultiplied ? PICASSO_ALLOC_PREMULTIPLIED : 0;
+        const char *target = premultiplied ? "premultiplied" : "straight";
+        picasso_backbuffer *out = picasso_create_backbuffer_ex(WIDTH, HEIGHT, flags);
+        picasso_backbuffer *ref = picasso_create_backbuffer_ex(WIDTH, HEIGHT, flags);
+        if (!out || !ref) return 1;
+
+        for (size_t s = 0; s < sizeof(sources) / sizeof(sources[0]); ++s) {
+            for (int mode = PICASSO_NINE_PATCH_STRETCH; mode <= PICASSO_NINE_PATCH_TILE; ++mode) {
+                picasso_nine_patch *np = picasso_nine_patch_create(&sources[s].view, L, T, R, B,
+                                                                   (picasso_nine_patch_mode)mode);
+                if (!np) {
+                    ERROR("Failed to create %s nine patch", sources[s].name);
+                    return 1;
+                }
+                for (size_t i = 0; i < sizeof(rects) / sizeof(rects[0]); ++i) {
+                    picasso_rect r = rects[i];
+                    build(sources[s].pixels, expected, r.width, r.height, (picasso_nine_patch_mode)mode);
+                    picasso_view whole = picasso_view_from_pixels(expected, r.width, r.height, (ptrdiff_t)r.width * 4,
+                                                                  sources[s].format);
+                    reset(out);
+                    reset(ref);
+                    picasso_draw_nine_patch(out, np, r);
+                    picasso_blit_view(ref, &whole, r.x, r.y);
+                    TEST_CHECK(test_same_pixels(out, ref), "%s %s nine patch at %dx%d differs on a %s target",
+                               mode == PICASSO_NINE_PATCH_TILE ? "Tiled" : "Stretched", sources[s].name,
+                               r.width, r.height, target);
+                }
+                picasso_nine_patch_destroy(np);
+            }
+        }
+        picasso_destroy_backbuffer(out);
+        picasso_destroy_backbuffer(ref);
+    }
+
+    if (!failed) INFO("Nine patches match frames built by hand");
+    return failed;
+}
@@ -0,0 +1,81 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "picasso.h"
+#include "logger.h"
+#include "test_util.h"
+
+/* Blits prepared sprites and the views they were prepared from to the same
+ * spots, clipped on every side, and checks the pixels are identical. Covers
+ * straight, premultiplied and RGB sources on straight and premultiplied
+ * targets, under every kernel set this CPU runs */
+
+#define WIDTH  150
+#define HEIGHT 90
+#define SW     53
+#define SH     31
+
+int main(void)
+{
+    int failed = 0;
+    static uint32_t straight[SW * SH], premul[SW * SH];
+    static uint8_t rgb[SW * SH * 3];
+    test_seed = 21;
+    test_fill_random(straight, SW * SH);
+    for (int i = 0; i < SW * SH; ++i) {
+        // Long runs of each kind, and single pixels between them
+        uint32_t run = (uint32_t)(i % 40);
+        if (run < 12) straight[i] |= 0xFF000000u;
+        else if (run < 25) straight[i] &= 0x00FFFFFFu;
+    }
+    picasso_premultiply_pixels((uint8_t *)premul, (const uint8_t *)straight, SW * SH);
+    for (size_t i = 0; i < sizeof(rgb); ++i) rgb[i] = test_next_byte();
+
+    picasso_view views[] = {
+        picasso_view_from_pixels(straight, SW, SH, SW * 4, PICASSO_FORMAT_RGBA8),
+        picasso_view_from_pixels(premul, SW, SH, SW * 4, PICASSO_FORMAT_RGBA8_PREMUL),
+        picasso_view_from_pixels(rgb, SW, SH, SW * 3, PICASSO_FORMAT_RGB8),
+    };
+    picasso_prepared_sprite *sprites[3];
+    for (int i = 0; i < 3; ++i) {
+        sprites[i] = picasso_prepare_sprite(&views[i]);
+        if (!sprites[i]) {
+            ERROR("Failed to prepare sprite %d", i);
+            return 1;
+        }
+    }
+
+    int spots[][2] = { { 10, 10 }, { -20, 5 }, { 120, 70 }, { 40, -25 }, { -52, -30 }, { WIDTH, 0 } };
+    static uint32_t background[WIDTH * HEIGHT];
+    test_fill_random(background, WIDTH * HEIGHT);
+
+    for (int level = PICASSO_SIMD_SCALAR; level < PICASSO_SIMD_LEVEL_COUNT; ++level) {
+        if (!picasso_set_simd_level((picasso_simd_level)level)) continue;
+        for (int premultiplied = 0; premultiplied < 2; ++premultiplied) {
+            uint32_t flags = premultiplied ? PICASSO_ALLOC_PREMULTIPLIED : 0;
+            picasso_backbuffer *out = picasso_create_backbuffer_ex(WIDTH, HEIGHT, flags);
+            picasso_backbuffer *ref = picasso_create_backbuffer_ex(WIDTH, HEIGHT, flags);
+            if (!out || !ref) return 1;
+
+            for (int s = 0; s < 3; ++s) {
+                for (int y = 0; y < HEIGHT; ++y) {
+                    memcpy((uint8_t *)out->pixels + (size_t)y * out->pitch, background + y * WIDTH, WIDTH * 4);
+                    memcpy((uint8_t *)ref->pixels + (size_t)y * ref->pitch, background + y * WIDTH, WIDTH * 4);
+                }
+                for (size_t i = 0; i < sizeof(spots) / sizeof(spots[0]); ++i) {
+                    picasso_blit_prepared_sprite(out, sprites[s], spots[i][0], spots[i][1]);
+                    picasso_blit_view(ref, &views[s], spots[i][0], spots[i][1]);
+                }
+                TEST_CHECK(test_same_pixels(out, ref), "%s: prepared sprite %d differs from its view on a %s target",
+                           picasso_simd_level_name((picasso_simd_level)level), s,
+                           premultiplied ? "premultiplied" : "straight");
+            }
+            picasso_destroy_backbuffer(out);
+            picasso_destroy_backbuffer(ref);
+        }
+    }
+
+    for (int i = 0; i < 3; ++i) picasso_destroy_prepared_sprite(sprites[i]);
+    if (!failed) INFO("Prepared sprites match plain blits");
+    return failed;
+}
@@ -0,0 +1,114 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "picasso.h"
+#include "logger.h"
+#include "test_util.h"
+
+/* Draws the same scene under every kernel set this CPU runs and checks they
+ * all give the exact pixels of the plain C one */
+
+#define WIDTH  203 // odd sizes, so every kernel also runs its tail
+#define HEIGHT 67
+
+static void fill_random(uint8_t *p, size_t n, bool premul)
+{
+    test_fill_random(p, n / 4);
+    // The top rows get runs of opaque and of clear pixels, long enough for every vector width to skip the math
+    for (size_t i = 0; i < (size_t)WIDTH * (HEIGHT / 3) && i < n / 4; ++i) {
+        if ((i / 21) % 3 == 0) p[i * 4 + 3] = 255;
+        if ((i / 21) % 3 == 1) memset(p + i * 4, 0, 4);
+    }
+    if (premul) picasso_premultiply_pixels(p, p, n / 4);
+}
+
+static void draw_scene(picasso_backbuffer *bf, const picasso_view *rgba, const picasso_view *premul,
+                       const picasso_view *rgb)
+{
+    test_seed = 42;
+    for (int i = 0; i < 40; ++i) {
+        picasso_rect r;
+        r.x = test_next_byte() % WIDTH - 20;
+        r.y = test_next_byte() % HEIGHT - 20;
+        r.width = test_next_byte() % WIDTH;
+        r.height = test_next_byte() % HEIGHT;
+        color c;
+        c.r = test_next_byte();
+        c.g = test_next_byte();
+        c.b = test_next_byte();
+        c.a = i % 3 ? test_next_byte() : 255;
+        if (i % 5 == 0) picasso_clear_rect(bf, &r, c);
+        else            picasso_fill_rect_blend(bf, &r, c, (picasso_blend_mode)(i % PICASSO_BLEND_COPY));
+    }
+    picasso_fill_circle(bf, 100, 30, 25, (color){ 9, 99, 199, 120 });
+    picasso_draw_line(bf, 0, 0, WIDTH - 1, HEIGHT - 1, (color){ 255, 0, 0, 255 });
+
+    picasso_blit_view(bf, rgba, 3, 1);
+    picasso_blit_view(bf, premul, -1, 2);
+    picasso_blit_view(bf, rgb, 5, -3);
+    picasso_blit_view_blend(bf, rgba, 7, 4, PICASSO_BLEND_SCREEN);
+    picasso_blit_scaled(bf, premul, (picasso_rect){ 10, 5, 150, 50 }, PICASSO_FILTER_BILINEAR);
+    picasso_blit_scaled(bf, rgba, (picasso_rect){ -20, 20, 300, 30 }, PICASSO_FILTER_NEAREST);
+    picasso_blit_affine(bf, rgba, &(picasso_affine){ 0.8f, 0.6f, -0.6f, 0.8f, 90.0f, -10.0f }, PICASSO_FILTER_BILINEAR);
+}
+
+int main(void)
+{
+    size_t bytes = (size_t)WIDTH * HEIGHT * 4;
+    uint8_t *base = malloc(bytes), *rgba = malloc(bytes), *premul = malloc(bytes);
+    uint8_t *rgb = malloc((size_t)WIDTH * HEIGHT * 3);
+    uint32_t *reference[2] = { malloc(bytes), malloc(bytes) };
+    if (!base || !rgba || !premul || !rgb || !reference[0] || !reference[1]) {
+        ERROR("Out of memory");
+        return 1;
+    }
+
+    test_seed = 7;
+    fill_random(base, bytes, false);
+    fill_random(rgba, bytes, false);
+    fill_random(premul, bytes, true);
+    for (size_t i = 0; i < (size_t)WIDTH * HEIGHT * 3; ++i) rgb[i] = test_next_byte();
+
+    picasso_view rgba_view = picasso_view_from_pixels(rgba, WIDTH - 5, HEIGHT - 3, WIDTH * 4, PICASSO_FORMAT_RGBA8);
+    picasso_view premul_view = picasso_view_from_pixels(premul + 4, WIDTH - 9, HEIGHT - 3, WIDTH * 4,
+                                                        PICASSO_FORMAT_RGBA8_PREMUL);
+    picasso_view rgb_view = picasso_view_from_pixels(rgb + 3, WIDTH - 7, HEIGHT - 1, WIDTH * 3, PICASSO_FORMAT_RGB8);
+
+    int failed = 0;
+    for (int level = PICASSO_SIMD_SCALAR; level < PICASSO_SIMD_LEVEL_COUNT; ++level) {
+        if (!picasso_set_simd_level((picasso_simd_level)level)) continue;
+
+        // Straight and premultiplied targets take different kernels
+        for (int premultiplied = 0; premultiplied < 2; ++premultiplied) {
+            picasso_backbuffer *bf = picasso_create_backbuffer_ex(WIDTH, HEIGHT,
+                                                                  premultiplied ? PICASSO_ALLOC_PREMULTIPLIED : 0);
+            if (!bf) {
+                ERROR("Failed to create backbuffer");
+                return 1;
+            }
+            if (premultiplied) picasso_premultiply_pixels((uint8_t *)bf->pixels, base, (size_t)WIDTH * HEIGHT);
+            else               memcpy(bf->pixels, base, bytes);
+            draw_scene(bf, &rgba_view, &premul_view, &rgb_view);
+
+            if (level == PICASSO_SIMD_SCALAR) {
+                memcpy(reference[premultiplied], bf->pixels, bytes);
+            } else if (memcmp(reference[premultiplied], bf->pixels, bytes) != 0) {
+                ERROR("%s kernels differ from scalar on a %s backbuffer", picasso_simd_level_name(level),
+                      premultiplied ? "premultiplied" : "straight");
+                failed = 1;
+            } else {
+                INFO("%s kernels match scalar on a %s backbuffer", picasso_simd_level_name(level),
+                     premultiplied ? "premultiplied" : "straight");
+            }
+            picasso_destroy_backbuffer(bf);
+        }
+    }
+
+    free(base);
+    free(rgba);
+    free(premul);
+    free(rgb);
+    free(reference[0]);
+    free(reference[1]);
+    return failed;
+}
@@ -0,0 +1,96 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "picasso.h"
+#include "logger.h"
+#include "test_util.h"
+
+/* Draws a shuffled batch of overlapping sprites from two sheets and checks it
+ * against drawing the same entries one at a time, sorted by layer. Sheet A
+ * only uses even layers and sheet B odd ones, so the order is fully defined.
+ * Runs sorted on one thread and split into bands across four */
+
+#define WIDTH   230
+#define HEIGHT  170
+#define FRAME_W 24
+#define FRAME_H 20
+#define SHEET_W (2 + 4 * FRAME_W + 3 * 3)
+#define SHEET_H (2 + 2 * FRAME_H + 1 * 3)
+#define ENTRIES 300
+
+static int compare_layers(const void *a, const void *b)
+{
+    const picasso_sprite_batch_entry *ea = a, *eb = b;
+    if (ea->layer != eb->layer) return ea->layer < eb->layer ? -1 : 1;
+    return ea < eb ? -1 : ea > eb; // entries of one layer are all from one sheet, keep their order
+}
+
+int main(void)
+{
+    int failed = 0;
+    static uint32_t pixels_a[SHEET_W * SHEET_H], pixels_b[SHEET_W * SHEET_H];
+    static uint32_t background[WIDTH * HEIGHT];
+    static picasso_sprite_batch_entry entries[ENTRIES], sorted[ENTRIES];
+    test_seed = 48;
+    test_fill_random(pixels_a, SHEET_W * SHEET_H);
+    test_fill_random(pixels_b, SHEET_W * SHEET_H);
+    picasso_premultiply_pixels((uint8_t *)pixels_b, (const uint8_t *)pixels_b, SHEET_W * SHEET_H);
+    test_fill_random(background, WIDTH * HEIGHT);
+
+    picasso_sprite_sheet *a = picasso_create_sprite_sheet(pixels_a, SHEET_W, SHEET_H, FRAME_W, FRAME_H, 1, 1, 3, 3);
+    picasso_sprite_sheet *b = picasso_create_sprite_sheet(pixels_b, SHEET_W, SHEET_H, FRAME_W, FRAME_H, 1, 1, 3, 3);
+    if (!a || !b) {
+        ERROR("Failed to create sprite sheets");
+        return 1;
+    }
+    b->premultiplied = true;
+
+    for (int i = 0; i < ENTRIES; ++i) {
+        picasso_sprite_batch_entry *e = &entries[i];
+        int layer = test_next_byte() % 8;
+        e->sheet = layer % 2 ? b : a;
+        e->layer = layer;
+        e->frame = test_next_byte() % (i % 50 == 0 ? 9 : 8); // now and then one past the end
+        e->x = test_next_byte() % (WIDTH + FRAME_W) - FRAME_W;
+        e->y = test_next_byte() % (HEIGHT + FRAME_H) - FRAME_H;
+        e->flags = test_next_byte() % 8;
+        e->tint = (color){ test_next_byte(), test_next_byte(), test_next_byte(), i % 3 ? 255 : test_next_byte() };
+    }
+    memcpy(sorted, entries, sizeof(entries));
+    qsort(sorted, ENTRIES, sizeof(sorted[0]), compare_layers);
+
+    picasso_set_thread_count(4);
+    picasso_set_parallel_threshold(1);
+    for (int premultiplied = 0; premultiplied < 2; ++premultiplied) {
+        uint32_t flags = premultiplied ? PICASSO_ALLOC_PREMULTIPLIED : 0;
+        picasso_backbuffer *ref = picasso_create_backbuffer_ex(WIDTH, HEIGHT, flags);
+        picasso_backbuffer *out = picasso_create_backbuffer_ex(WIDTH, HEIGHT, flags);
+        if (!ref || !out) return 1;
+
+        for (int y = 0; y < HEIGHT; ++y) {
+            memcpy((uint8_t *)ref->pixels + (size_t)y * ref->pitch, background + y * WIDTH, WIDTH * 4);
+        }
+        // Tints are batch only, so tinted entries go through a batch of one
+        for (int i = 0; i < ENTRIES; ++i) {
+            const picasso_sprite_batch_entry *e = &sorted[i];
+            if (e->flags & PICASSO_SPRITE_TINT) picasso_draw_sprite_batch(ref, e, 1, false);
+            else picasso_blit_sprite(ref, e->sheet, e->frame, e->x, e->y, e->flags);
+        }
+
+        for (int parallel = 0; parallel < 2; ++parallel) {
+            for (int y = 0; y < HEIGHT; ++y) {
+                memcpy((uint8_t *)out->pixels + (size_t)y * out->pitch, background + y * WIDTH, WIDTH * 4);
+            }
+            picasso_draw_sprite_batch(out, entries, ENTRIES, parallel);
+            TEST_CHECK(test_same_pixels(out, ref), "%s sprite batch differs from sorted blits on a %s target",
+                       parallel ? "Parallel" : "Sorted", premultiplied ? "premultiplied" : "straight");
+        }
+        picasso_destroy_backbuffer(ref);
+        picasso_destroy_backbuffer(out);
+    }
+
+    picasso_destroy_sprite_sheet(a);
+    picasso_destroy_sprite_sheet(b);
+    if (!failed) INFO("Sprite batch of %d entries matches sorted blits", ENTRIES);
+    return failed;
+}
@@ -0,0 +1,163 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "picasso.h"
+#include "logger.h"
+#include "test_util.h"
+
+/* Runs a copy-forward triple buffered swap chain where every frame draws one
+ * small rect over the last. The present callback checks each buffer against
+ * the same frames drawn into a single backbuffer, and that the damage it is
+ * handed is exactly that frame's rect. Holding some presents back makes
+ * buffers miss one, two or many frames, so acquire takes both the per-frame
+ * damage copy and the full copy */
+
+#define WIDTH  64
+#define HEIGHT 48
+#define FRAMES 24
+
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+    int hold;          // frame whose present waits until released
+    bool released;
+
+    int presented;     // only touched by the present thread
+    int failed;
+    uint32_t *expected[FRAMES + 1];
+} present_state;
+
+static picasso_rect frame_rect(int frame)
+{
+    if (frame == 1) return (picasso_rect){ 0, 0, WIDTH, HEIGHT };
+    return (picasso_rect){ (frame * 13) % (WIDTH - 8), (frame * 7) % (HEIGHT - 6), 3 + frame % 6, 2 + frame % 5 };
+}
+
+static void draw_frame(picasso_backbuffer *bf, int frame)
+{
+    picasso_rect r = frame_rect(frame);
+    picasso_fill_rect(bf, &r, (color){ (uint8_t)(frame * 40), (uint8_t)(frame * 90), (uint8_t)(255 - frame), 255 });
+}
+
+static void present(picasso_backbuffer *bf, const picasso_rect *damage, int damage_count, void *user)
+{
+    present_state *st = user;
+    int frame = ++st->presented;
+
+    pthread_mutex_lock(&st->lock);
+    while (frame == st->hold && !st->released) pthread_cond_wait(&st->changed, &st->lock);
+    pthread_mutex_unlock(&st->lock);
+
+    if (frame > FRAMES) {
+        ERROR("Presented %d frames, only %d were drawn", frame, FRAMES);
+        st->failed = 1;
+        return;
+    }
+    for (int y = 0; y < HEIGHT; ++y) {
+        if (memcmp((uint8_t *)bf->pixels + (size_t)y * bf->pitch, st->expected[frame] + y * WIDTH, WIDTH * 4) != 0) {
+            ERROR("Frame %d differs from immediate drawing at row %d", frame, y);
+            st->failed = 1;
+            break;
+        }
+    }
+    picasso_rect r = frame_rect(frame);
+    if (damage_count != 1 || memcmp(&damage[0], &r, sizeof(r)) != 0) {
+        ERROR("Frame %d presented %d damage rects, first %d,%d %dx%d", frame, damage_count,
+              damage_count ? damage[0].x : 0, damage_count ? damage[0].y : 0,
+              damage_count ? damage[0].width : 0, damage_count ? damage[0].height : 0);
+        st->failed = 1;
+    }
+}
+
+static void hold_present(present_state *st, int frame)
+{
+    pthread_mutex_lock(&st->lock);
+    st->hold = frame;
+    st->released = false;
+    pthread_mutex_unlock(&st->lock);
+}
+
+static void release_present(present_state *st)
+{
+    pthread_mutex_lock(&st->lock);
+    st->released = true;
+    pthread_cond_broadcast(&st->changed);
+    pthread_mutex_unlock(&st->lock);
+}
+
+static void render(picasso_swapchain *sc, int frame)
+{
+    picasso_backbuffer *bf = picasso_swapchain_acquire(sc);
+    draw_frame(bf, frame);
+    picasso_swapchain_submit(sc, bf);
+}
+
+int main(void)
+{
+    static present_state st = { .lock = PTHREAD_MUTEX_INITIALIZER, .changed = PTHREAD_COND_INITIALIZER };
+    int failed = 0;
+
+    // Every frame drawn in turn into one backbuffer
+    picasso_backbuffer *ref = picasso_create_backbuffer(WIDTH, HEIGHT);
+    if (!ref) return 1;
+    for (int frame = 1; frame <= FRAMES; ++frame) {
+        draw_frame(ref, frame);
+        st.expected[frame] = malloc(WIDTH * HEIGHT * 4);
+        if (!st.expected[frame]) return 1;
+        for (int y = 0; y < HEIGHT; ++y) {
+            memcpy(st.expected[frame] + y * WIDTH, (uint8_t *)ref->pixels + (size_t)y * ref->pitch, WIDTH * 4);
+        }
+    }
+
+    picasso_swapchain *sc = picasso_swapchain_create(&(picasso_swapchain_desc){
+        .width = WIDTH, .height = HEIGHT, .buffer_count = 3, .copy_forward = true,
+        .present = present, .user = &st,
+    });
+    if (!sc) {
+        ERROR("Failed to create swap chain");
+        return 1;
+    }
+
+    // Frame 1 is held, so 2 and 3 land in the two buffers that hold nothing yet
+    int frame = 1;
+    hold_present(&st, 1);
+    render(sc, frame++);
+    render(sc, frame++);
+    render(sc, frame++);
+    release_present(&st);
+    picasso_swapchain_wait_idle(sc);
+
+    // Idle between frames, the newest buffer is reused and the other two fall behind
+    while (frame <= 7) {
+        render(sc, frame++);
+        picasso_swapchain_wait_idle(sc);
+    }
+
+    // 8 is held, 9 and 10 go to the two stale buffers, 5 and 6 frames behind
+    hold_present(&st, 8);
+    render(sc, frame++);
+    render(sc, frame++);
+    render(sc, frame++);
+    release_present(&st);
+    picasso_swapchain_wait_idle(sc);
+
+    // 11 is held, 12 goes to a buffer two frames behind and copies just their rects
+    hold_present(&st, 11);
+    render(sc, frame++);
+    render(sc, frame++);
+    release_present(&st);
+    picasso_swapchain_wait_idle(sc);
+
+    // The rest run free and are still queued when the chain is destroyed
+    while (frame <= FRAMES) render(sc, frame++);
+    picasso_swapchain_destroy(sc);
+
+    TEST_CHECK(st.presented == FRAMES, "Presented %d of %d frames", st.presented, FRAMES);
+    failed |= st.failed;
+    if (!failed) INFO("Swap chain presented %d frames matching immediate drawing", FRAMES);
+
+    for (int i = 1; i <= FRAMES; ++i) free(st.expected[i]);
+    picasso_destroy_backbuffer(ref);
+    return failed;
+}
@@ -0,0 +1,118 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "picasso.h"
+#include "logger.h"
+#include "test_util.h"
+
+/* Checks the overflow-checked sizing at and past PICASSO_MAX_DIM through an
+ * allocator that records what it is asked for, and that a tiled image written
+ * and blitted across tile seams gives the pixels of one flat canvas */
+
+#define CANVAS_W 600
+#define CANVAS_H 400
+
+static size_t largest_request, allocs, frees;
+
+// libc underneath, refusing anything over 64 MB so nothing huge is touched
+static void *recording_alloc(void *user, size_t size, size_t alignment)
+{
+    (void)user;
+    if (size > largest_request) largest_request = size;
+    if (size > ((size_t)64 << 20)) return NULL;
+    void *p = NULL;
+    if (posix_memalign(&p, alignment < sizeof(void *) ? sizeof(void *) : alignment, size) != 0) return NULL;
+    allocs++;
+    return p;
+}
+
+static void recording_free(void *user, void *ptr, size_t size, size_t alignment)
+{
+    (void)user; (void)size; (void)alignment;
+    frees++;
+    free(ptr);
+}
+
+static int check_sizing(void)
+{
+    int failed = 0;
+    picasso_allocator recorder = { recording_alloc, recording_free, NULL };
+    picasso_set_allocator(&recorder);
+
+    // 16384 x 16384 x 4 is exactly 1 GB of pixels, asked for in one block with its header
+    picasso_image *img = picasso_alloc_image_ex(PICASSO_MAX_DIM, PICASSO_MAX_DIM, 4, 0);
+    TEST_CHECK(!img, "Refused allocation still returned an image");
+    TEST_CHECK(largest_request >= ((size_t)1 << 30) && largest_request <= ((size_t)1 << 30) + PICASSO_ALLOC_OVERHEAD,
+               "Max size image asked for %zu bytes", largest_request);
+    TEST_CHECK(allocs == frees, "Failed image allocation leaked %zu blocks", allocs - frees);
+
+    // Rows past INT32_MAX bytes are refused before anything is allocated
+    largest_request = 0;
+    TEST_CHECK(!picasso_alloc_image_ex(INT32_MAX, 2, 4, 0) && largest_request == 0,
+               "Oversize row reached the allocator");
+    TEST_CHECK(!picasso_alloc_image_ex(INT32_MAX, INT32_MAX, 4, PICASSO_ALLOC_PAD_ROWS) && largest_request == 0,
+               "Overflowing image reached the allocator");
+    TEST_CHECK(!picasso_create_backbuffer(INT32_MAX / 2, 4) && largest_request == 0,
+               "Overflowing backbuffer reached the allocator");
+
+    picasso_set_allocator(NULL);
+    return failed;
+}
+
+static int check_tiles(void)
+{
+    int failed = 0;
+    picasso_tiled_image *ti = picasso_tiled_image_create(CANVAS_W, CANVAS_H, 4);
+    uint32_t *canvas = calloc((size_t)CANVAS_W * CANVAS_H, sizeof(uint32_t));
+    uint32_t *src = malloc(300 * 300 * sizeof(uint32_t));
+    picasso_backbuffer *out = picasso_create_backbuffer(320, 240);
+    picasso_backbuffer *ref = picasso_create_backbuffer(320, 240);
+    if (!ti || !canvas || !src || !out || !ref) {
+        ERROR("Out of memory");
+        return 1;
+    }
+    TEST_CHECK(picasso_tiled_image_bytes(ti) == 0, "New tiled image holds %zu bytes", picasso_tiled_image_bytes(ti));
+
+    // Crosses the seams at x = 256 and y = 256, touching four tiles
+    test_seed = 3;
+    test_fill_random(src, 300 * 300);
+    picasso_view src_view = picasso_view_from_pixels(src, 300, 300, 300 * 4, PICASSO_FORMAT_RGBA8);
+    TEST_CHECK(picasso_tiled_image_write(ti, &src_view, 100, 50) == 0, "Tiled write failed");
+    for (int y = 0; y < 300; ++y) memcpy(canvas + (size_t)(50 + y) * CANVAS_W + 100, src + y * 300, 300 * 4);
+
+    size_t tile_bytes = (size_t)PICASSO_TILE_SIZE * PICASSO_TILE_SIZE * 4;
+    TEST_CHECK(ti->tiles_used == 4 && picasso_tiled_image_bytes(ti) == 4 * tile_bytes,
+               "Write touched %zu tiles, %zu bytes", ti->tiles_used, picasso_tiled_image_bytes(ti));
+
+    // A small write inside one of those tiles allocates nothing new
+    picasso_view corner = picasso_subview(&src_view, (picasso_rect){ 0, 0, 20, 20 });
+    picasso_tiled_image_write(ti, &corner, 260, 260);
+    for (int y = 0; y < 20; ++y) memcpy(canvas + (size_t)(260 + y) * CANVAS_W + 260, src + y * 300, 20 * 4);
+    TEST_CHECK(ti->tiles_used == 4, "Write inside a tile allocated another");
+
+    picasso_view canvas_view = picasso_view_from_pixels(canvas, CANVAS_W, CANVAS_H, CANVAS_W * 4, PICASSO_FORMAT_RGBA8);
+    picasso_rect regions[] = { { 0, 0, CANVAS_W, CANVAS_H }, { 200, 220, 120, 90 }, { 250, 0, 12, 400 } };
+    for (size_t i = 0; i < sizeof(regions) / sizeof(regions[0]); ++i) {
+        test_fill_random(out->pixels, (size_t)out->width * out->height);
+        memcpy(ref->pixels, out->pixels, (size_t)ref->pitch * ref->height);
+
+        picasso_blit_tiled_image(out, ti, regions[i], 10 - (int)i * 40, 20);
+        picasso_view part = picasso_subview(&canvas_view, regions[i]);
+        picasso_blit_view(ref, &part, 10 - (int)i * 40, 20);
+        TEST_CHECK(test_same_pixels(out, ref), "Tiled blit of region %zu differs from a flat canvas", i);
+    }
+
+    picasso_destroy_backbuffer(out);
+    picasso_destroy_backbuffer(ref);
+    picasso_tiled_image_destroy(ti);
+    free(canvas);
+    free(src);
+    return failed;
+}
+
+int main(void)
+{
+    int failed = check_sizing() | check_tiles();
+    if (!failed) INFO("Image sizing and tiled storage behave");
+    return failed;
+}
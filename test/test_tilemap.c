@@ -0,0 +1,152 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "picasso.h"
+#include "logger.h"
+#include "test_util.h"
+
+/* Draws tilemaps through viewports at pixel scroll offsets and compares them
+ * with every cell blitted as a sprite into the same viewport. Runs with the
+ * chunk cache off and on, changing a tile between draws so cached chunks
+ * are rebuilt. Straight and premultiplied sheets on straight and
+ * premultiplied targets. Tiles too big to cache must draw the same with the
+ * cache on */
+
+#define WIDTH   170
+#define HEIGHT  130
+#define TILE    8
+#define SHEET_W 64
+#define SHEET_H 48
+#define OPAQUE_FRAMES 16 // frames with only fully opaque and fully transparent pixels
+#define COLUMNS 37
+#define ROWS    29
+
+static uint32_t background[WIDTH * HEIGHT];
+
+static void reset(picasso_backbuffer *bf)
+{
+    for (int y = 0; y < HEIGHT; ++y) {
+        memcpy((uint8_t *)bf->pixels + (size_t)y * bf->pitch, background + y * WIDTH, WIDTH * 4);
+    }
+}
+
+// What the map should look like: each cell blitted into the viewport's part of ref
+static void draw_reference(picasso_backbuffer *ref, const picasso_sprite_sheet *sheet, const picasso_tilemap *map,
+                           picasso_rect viewport, int scroll_x, int scroll_y)
+{
+    picasso_view whole = picasso_view_from_backbuffer(ref);
+    picasso_view part = picasso_subview(&whole, viewport);
+    if (!part.pixels) return;
+    picasso_backbuffer sub = picasso_backbuffer_from_view(&part);
+    int ox = viewport.x - PICASSO_MAX(viewport.x, 0) - scroll_x;
+    int oy = viewport.y - PICASSO_MAX(viewport.y, 0) - scroll_y;
+    for (int row = 0; row < ROWS; ++row) {
+        for (int col = 0; col < COLUMNS; ++col) {
+            int frame = picasso_tilemap_get_tile(map, col, row);
+            if (frame != PICASSO_TILE_NONE) picasso_blit_sprite(&sub, sheet, frame, ox + col * TILE, oy + row * TILE, 0);
+        }
+    }
+}
+
+// About one cell in five left empty, the rest any of the first frames
+static void fill_map(picasso_tilemap *map, int frames)
+{
+    for (int row = 0; row < ROWS; ++row) {
+        for (int col = 0; col < COLUMNS; ++col) {
+            int frame = test_next_byte() % 5 == 0 ? PICASSO_TILE_NONE : test_next_byte() % frames;
+            picasso_tilemap_set_tile(map, col, row, frame);
+        }
+    }
+}
+
+static int check_big_tiles(void)
+{
+    int failed = 0;
+    enum { TW = 1100, TH = 3, W = 4000, H = 9 };
+    uint32_t *pixels = malloc(TW * 2 * TH * 4);
+    picasso_backbuffer *cached = picasso_create_backbuffer(W, H), *plain = picasso_create_backbuffer(W, H);
+    if (!pixels || !cached || !plain) return 1;
+    test_fill_random(pixels, TW * 2 * TH);
+    picasso_sprite_sheet *sheet = picasso_create_sprite_sheet(pixels, TW * 2, TH, TW, TH, 0, 0, 0, 0);
+    picasso_tilemap *map = picasso_tilemap_create(sheet, 20, 3);
+    if (!sheet || !map) return 1;
+    for (int row = 0; row < 3; ++row) {
+        for (int col = 0; col < 20; ++col) {
+            picasso_tilemap_set_tile(map, col, row, (col + row) % 3 == 0 ? PICASSO_TILE_NONE : (col + row) % 2);
+        }
+    }
+    test_fill_random(plain->pixels, (size_t)W * H);
+    memcpy(cached->pixels, plain->pixels, (size_t)plain->pitch * H);
+
+    picasso_draw_tilemap(plain, map, (picasso_rect){ 0, 0, W, H }, 15000, 0);
+    picasso_tilemap_set_cache(map, true);
+    picasso_draw_tilemap(cached, map, (picasso_rect){ 0, 0, W, H }, 15000, 0);
+    TEST_CHECK(test_same_pixels(cached, plain), "Tiles of %dx%d draw differently with the cache on", TW, TH);
+
+    picasso_tilemap_destroy(map);
+    picasso_destroy_sprite_sheet(sheet);
+    picasso_destroy_backbuffer(cached);
+    picasso_destroy_backbuffer(plain);
+    free(pixels);
+    return failed;
+}
+
+int main(void)
+{
+    int failed = 0;
+    static uint32_t pixels[SHEET_W * SHEET_H];
+    struct { picasso_rect viewport; int scroll_x, scroll_y; } views[] = {
+        { { 0, 0, WIDTH, HEIGHT }, 0, 0 },
+        { { 13, 7, 120, 100 }, 37, 21 },
+        { { -11, 30, 90, 140 }, -5, 150 },
+        { { 100, -4, 90, 60 }, 250, -13 },
+    };
+
+    for (int premul_sheet = 0; premul_sheet < 2; ++premul_sheet) {
+        test_seed = 50;
+        test_fill_random(pixels, SHEET_W * SHEET_H);
+        for (int i = 0; i < SHEET_W * SHEET_H; ++i) {
+            int frame = (i / SHEET_W / TILE) * (SHEET_W / TILE) + (i % SHEET_W) / TILE;
+            if (frame < OPAQUE_FRAMES) pixels[i] = (pixels[i] & 0x00FFFFFFu) | (frame % 4 && i % 7 ? 0xFF000000u : 0);
+        }
+        if (premul_sheet) picasso_premultiply_pixels((uint8_t *)pixels, (const uint8_t *)pixels, SHEET_W * SHEET_H);
+        picasso_sprite_sheet *sheet = picasso_create_sprite_sheet(pixels, SHEET_W, SHEET_H, TILE, TILE, 0, 0, 0, 0);
+        if (!sheet) return 1;
+        sheet->premultiplied = premul_sheet;
+
+        picasso_tilemap *map = picasso_tilemap_create(sheet, COLUMNS, ROWS);
+        if (!map) return 1;
+
+        for (int premultiplied = 0; premultiplied < 2; ++premultiplied) {
+            uint32_t flags = premultiplied ? PICASSO_ALLOC_PREMULTIPLIED : 0;
+            picasso_backbuffer *out = picasso_create_backbuffer_ex(WIDTH, HEIGHT, flags);
+            picasso_backbuffer *ref = picasso_create_backbuffer_ex(WIDTH, HEIGHT, flags);
+            if (!out || !ref) return 1;
+
+            fill_map(map, sheet->frame_count);
+            for (int cache = 0; cache < 2; ++cache) {
+                picasso_tilemap_set_cache(map, cache);
+                for (size_t v = 0; v < sizeof(views) / sizeof(views[0]); ++v) {
+                    // Every other draw changes a tile somewhere in view first
+                    if (v % 2) picasso_tilemap_set_tile(map, (int)v * 3, (int)v * 2, test_next_byte() % sheet->frame_count);
+                    reset(out);
+                    reset(ref);
+                    picasso_draw_tilemap(out, map, views[v].viewport, views[v].scroll_x, views[v].scroll_y);
+                    draw_reference(ref, sheet, map, views[v].viewport, views[v].scroll_x, views[v].scroll_y);
+                    TEST_CHECK(test_same_pixels(out, ref),
+                               "Tilemap view %zu with the cache %s differs from per tile blits (%s sheet, %s target)",
+                               v, cache ? "on" : "off", premul_sheet ? "premultiplied" : "straight",
+                               premultiplied ? "premultiplied" : "straight");
+                }
+            }
+            picasso_destroy_backbuffer(out);
+            picasso_destroy_backbuffer(ref);
+        }
+        picasso_tilemap_destroy(map);
+        picasso_destroy_sprite_sheet(sheet);
+    }
+
+    failed |= check_big_tiles();
+    if (!failed) INFO("Tilemaps match per tile blits, cached and uncached");
+    return failed;
+}
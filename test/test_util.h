@@ -0,0 +1,52 @@
+#ifndef TEST_UTIL_H
+#define TEST_UTIL_H
+
+#include <stdint.h>
+#include <string.h>
+#include "picasso.h"
+#include "logger.h"
+
+/* Shared by the check programs. The random sequence is fixed, so every run
+ * draws the same pixels, and TEST_CHECK logs a failure and marks the `failed`
+ * variable of the calling function */
+
+#define TEST_CHECK(cond, ...)                      \
+    do {                                           \
+        if (!(cond)) {                             \
+            ERROR(__VA_ARGS__);                    \
+            failed = 1;                            \
+        }                                          \
+    } while (0)
+
+static uint32_t test_seed = 1;
+
+static inline uint8_t test_next_byte(void)
+{
+    test_seed = test_seed * 1103515245u + 12345u;
+    return (uint8_t)(test_seed >> 16);
+}
+
+// Random RGBA pixels, with plenty of fully opaque and fully transparent ones
+static inline void test_fill_random(void *pixels, size_t count)
+{
+    uint8_t *p = pixels;
+    for (size_t i = 0; i < count * 4; ++i) p[i] = test_next_byte();
+    for (size_t i = 0; i < count; ++i) {
+        if (i % 4 == 0) p[i * 4 + 3] = 255;
+        if (i % 4 == 1) p[i * 4 + 3] = 0;
+    }
+}
+
+// Same size and the same visible pixels, whatever the pitches
+static inline bool test_same_pixels(const picasso_backbuffer *a, const picasso_backbuffer *b)
+{
+    if (!a || !b || a->width != b->width || a->height != b->height) return false;
+    for (uint32_t y = 0; y < a->height; ++y) {
+        const uint8_t *ra = (const uint8_t *)a->pixels + (size_t)y * a->pitch;
+        const uint8_t *rb = (const uint8_t *)b->pixels + (size_t)y * b->pitch;
+        if (memcmp(ra, rb, (size_t)a->width * 4) != 0) return false;
+    }
+    return true;
+}
+
+#endif // TEST_UTIL_H
@@ -0,0 +1,204 @@
+#include <stdlib.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "picasso.h"
+#include "logger.h"
+
+/* One persistent pool of workers shared by everything in Picasso that
+ * splits work up. A job is just a count and a function: indices are handed
+ * out one at a time, and the calling thread works on them too. Workers are
+ * started on first use */
+static struct {
+    pthread_mutex_t lock;
+    pthread_cond_t wake;          // workers wait here for a new job
+    pthread_cond_t done;          // the caller waits here for workers to finish
+    pthread_mutex_t busy;         // held for the duration of a job
+
+    pthread_t *threads;
+    int worker_count;             // threads in the pool, not counting the caller
+    atomic_int requested;         // total threads wanted, 0 = one per core
+    bool running;
+    bool stop;
+
+    uint64_t generation;          // bumped for every job
+    int pending;                  // workers still inside the current job
+    picasso_task_fn fn;
+    void *user;
+    int count;
+    atomic_int next;
+} picasso__pool = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .wake = PTHREAD_COND_INITIALIZER,
+    .done = PTHREAD_COND_INITIALIZER,
+    .busy = PTHREAD_MUTEX_INITIALIZER,
+};
+
+static atomic_size_t picasso__parallel_threshold = PICASSO_PARALLEL_THRESHOLD;
+
+// Set on pool threads and on a caller while its job runs, nested jobs run inline
+static _Thread_local bool picasso__in_job = false;
+
+static void picasso__run_indices(picasso_task_fn fn, void *user, int count)
+{
+    int i;
+    while ((i = atomic_fetch_add(&picasso__pool.next, 1)) < count) {
+        fn(user, i);
+    }
+}
+
+static void *picasso__worker(void *arg)
+{
+    (void)arg;
+    picasso__in_job = true;
+    uint64_t seen = 0;
+
+    pthread_mutex_lock(&picasso__pool.lock);
+    for (;;) {
+        while (picasso__pool.generation == seen && !picasso__pool.stop) {
+            pthread_cond_wait(&picasso__pool.wake, &picasso__pool.lock);
+        }
+        if (picasso__pool.stop) break;
+
+        seen = picasso__pool.generation;
+        picasso_task_fn fn = picasso__pool.fn;
+        void *user = picasso__pool.user;
+        int count = picasso__pool.count;
+        pthread_mutex_unlock(&picasso__pool.lock);
+
+        picasso__run_indices(fn, user, count);
+
+        pthread_mutex_lock(&picasso__pool.lock);
+        if (--picasso__pool.pending == 0) pthread_cond_signal(&picasso__pool.done);
+    }
+    pthread_mutex_unlock(&picasso__pool.lock);
+    return NULL;
+}
+
+// Asked once, sysconf can end up reading a file
+static int picasso__core_count(void)
+{
+    static atomic_int cached = 0;
+    int cores = atomic_load_explicit(&cached, memory_order_relaxed);
+    if (cores == 0) {
+        long n = sysconf(_SC_NPROCESSORS_ONLN);
+        cores = n > 0 ? (int)n : 1;
+        atomic_store_explicit(&cached, cores, memory_order_relaxed);
+    }
+    return cores;
+}
+
+// Called with busy held
+static void picasso__pool_start(void)
+{
+    int requested = atomic_load(&picasso__pool.requested);
+    int total = requested > 0 ? requested : picasso__core_count();
+    int workers = total - 1;
+
+    picasso__pool.running = true;
+    picasso__pool.worker_count = 0;
+    if (workers <= 0) return;
+
+    picasso__pool.threads = picasso_calloc(workers, sizeof(pthread_t));
+    if (!picasso__pool.threads) return;
+
+    for (int i = 0; i < workers; ++i) {
+        if (pthread_create(&picasso__pool.threads[i], NULL, picasso__worker, NULL) != 0) {
+            WARN("Could only start %d of %d worker threads", i, workers);
+            break;
+        }
+        picasso__pool.worker_count++;
+    }
+    TRACE("Thread pool started with %d workers", picasso__pool.worker_count);
+}
+
+// Called with busy held
+static void picasso__pool_shutdown(void)
+{
+    if (!picasso__pool.running) return;
+
+    pthread_mutex_lock(&picasso__pool.lock);
+    picasso__pool.stop = true;
+    pthread_cond_broadcast(&picasso__pool.wake);
+    pthread_mutex_unlock(&picasso__pool.lock);
+
+    for (int i = 0; i < picasso__pool.worker_count; ++i) {
+        pthread_join(picasso__pool.threads[i], NULL);
+    }
+    picasso_free(picasso__pool.threads);
+    picasso__pool.threads = NULL;
+    picasso__pool.worker_count = 0;
+    picasso__pool.running = false;
+    picasso__pool.stop = false;
+    picasso__pool.generation = 0;
+}
+
+/* Total threads used for parallel work, including the caller. 0 means one
+ * per core, 1 runs everything on the calling thread. Takes effect on the
+ * next job, the pool is restarted lazily */
+void picasso_set_thread_count(int count)
+{
+    pthread_mutex_lock(&picasso__pool.busy);
+    picasso__pool_shutdown();
+    atomic_store(&picasso__pool.requested, count < 0 ? 0 : count);
+    pthread_mutex_unlock(&picasso__pool.busy);
+}
+
+int picasso_get_thread_count(void)
+{
+    int requested = atomic_load(&picasso__pool.requested);
+    return requested > 0 ? requested : picasso__core_count();
+}
+
+void picasso_set_parallel_threshold(size_t pixels)
+{
+    atomic_store(&picasso__parallel_threshold, pixels);
+}
+
+size_t picasso_get_parallel_threshold(void)
+{
+    return atomic_load_explicit(&picasso__parallel_threshold, memory_order_relaxed);
+}
+
+/* Calls fn(user, i) for every i in [0, count) and returns when all are done.
+ * Indices run in no particular order, on any thread. Runs inline when
+ * nested inside another job, or when another thread has the pool busy */
+void picasso_parallel_for(int count, picasso_task_fn fn, void *user)
+{
+    if (count <= 0 || !fn) return;
+
+    if (count == 1 || picasso__in_job || pthread_mutex_trylock(&picasso__pool.busy) != 0) {
+        for (int i = 0; i < count; ++i) fn(user, i);
+        return;
+    }
+
+    if (!picasso__pool.running) picasso__pool_start();
+    if (picasso__pool.worker_count == 0) {
+        pthread_mutex_unlock(&picasso__pool.busy);
+        for (int i = 0; i < count; ++i) fn(user, i);
+        return;
+    }
+
+    pthread_mutex_lock(&picasso__pool.lock);
+    picasso__pool.fn = fn;
+    picasso__pool.user = user;
+    picasso__pool.count = count;
+    atomic_store(&picasso__pool.next, 0);
+    picasso__pool.pending = picasso__pool.worker_count;
+    picasso__pool.generation++;
+    pthread_cond_broadcast(&picasso__pool.wake);
+    pthread_mutex_unlock(&picasso__pool.lock);
+
+    picasso__in_job = true;
+    picasso__run_indices(fn, user, count);
+    picasso__in_job = false;
+
+    pthread_mutex_lock(&picasso__pool.lock);
+    while (picasso__pool.pending > 0) {
+        pthread_cond_wait(&picasso__pool.done, &picasso__pool.lock);
+    }
+    pthread_mutex_unlock(&picasso__pool.lock);
+
+    pthread_mutex_unlock(&picasso__pool.busy);
+}